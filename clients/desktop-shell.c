@@ -30,6 +30,7 @@
 #include <math.h>
 #include <cairo.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <sys/timerfd.h>
 #include <sys/epoll.h> 
 #include <linux/input.h>
@@ -53,6 +54,8 @@ struct desktop {
 	struct unlock_dialog *unlock_dialog;
 	struct task unlock_task;
 	struct wl_list outputs;
+	struct wl_list thumbnails;
+	struct wl_list windows;
 
 	struct window *grab_window;
 	struct widget *grab_widget;
@@ -141,6 +144,20 @@ struct taskbar_button {
 	struct wl_list link;
 };
 
+struct taskbar_window {
+	unsigned int id;
+	char *title;
+	struct wl_list link;
+};
+
+struct taskbar_thumbnail {
+	unsigned int id;
+	void *data;
+	size_t size;
+	cairo_surface_t *surface;
+	struct wl_list link;
+};
+
 struct unlock_dialog {
 	struct window *window;
 	struct widget *widget;
@@ -159,6 +176,9 @@ taskbar_add_button(struct taskbar *taskbar, unsigned int id, const char *name);
 static void
 taskbar_destroy_button(struct taskbar_button *button);
 
+static void
+taskbar_thumbnail_destroy(struct taskbar_thumbnail *thumb);
+
 static void
 sigchild_handler(int s)
 {
@@ -287,12 +307,55 @@ panel_launcher_redraw_handler(struct widget *widget, void *data)
 	cairo_destroy(cr);
 }
 
+static struct taskbar_thumbnail *
+taskbar_get_thumbnail(struct desktop *desktop, unsigned int id)
+{
+	struct taskbar_thumbnail *thumb;
+
+	wl_list_for_each(thumb, &desktop->thumbnails, link)
+		if (thumb->id == id)
+			return thumb;
+
+	return NULL;
+}
+
+/* Draws the window preview in place of the icon, scaled to the
+ * taskbar height, and returns the width it took. */
+static int
+taskbar_button_draw_thumbnail(struct taskbar_button *button, cairo_t *cr,
+			      struct rectangle *allocation)
+{
+	struct taskbar_thumbnail *thumb;
+	double scale, w, h, y;
+
+	thumb = taskbar_get_thumbnail(button->taskbar->desktop, button->id);
+	if (!thumb)
+		return 0;
+
+	h = cairo_image_surface_get_height(thumb->surface);
+	w = cairo_image_surface_get_width(thumb->surface);
+	scale = 24.0 / h;
+	if (w * scale > 32.0)
+		scale = 32.0 / w;
+	y = allocation->y + allocation->height / 2 - h * scale / 2;
+
+	cairo_save(cr);
+	cairo_translate(cr, allocation->x, y);
+	cairo_scale(cr, scale, scale);
+	cairo_set_source_surface(cr, thumb->surface, 0, 0);
+	cairo_paint(cr);
+	cairo_restore(cr);
+
+	return w * scale;
+}
+
 static void
 taskbar_button_redraw_handler(struct widget *widget, void *data)
 {
 	struct taskbar_button *button = data;
 	struct rectangle allocation;
 	cairo_t *cr;
+	int width;
 
 	cr = widget_cairo_create(button->taskbar->widget);
 
@@ -302,13 +365,17 @@ taskbar_button_redraw_handler(struct widget *widget, void *data)
 		allocation.y++;
 	}
 
-	cairo_set_source_surface(cr, button->icon,
-				 allocation.x, allocation.y);
-	cairo_paint(cr);
+	width = taskbar_button_draw_thumbnail(button, cr, &allocation);
+	if (width == 0) {
+		cairo_set_source_surface(cr, button->icon,
+					 allocation.x, allocation.y);
+		cairo_paint(cr);
+		width = 16;
+	}
 
 	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 1.0);
 	/* cairo_set_font_size (cr, 20); */
-	cairo_move_to (cr, allocation.x+20, allocation.y+12);
+	cairo_move_to (cr, allocation.x + width + 4, allocation.y+12);
 	cairo_show_text (cr, button->name);
 
 	if (button->focused) {
@@ -772,6 +839,7 @@ static struct taskbar *
 taskbar_create(struct desktop *desktop)
 {
 	struct taskbar *taskbar;
+	struct taskbar_window *window;
 	struct weston_config_section *s;
 
 	taskbar = xzalloc(sizeof *taskbar);
@@ -793,6 +861,9 @@ taskbar_create(struct desktop *desktop)
 	weston_config_section_get_uint(s, "taskbar-color",
 				       &taskbar->color, 0xaabbbbbb);
 
+	wl_list_for_each(window, &desktop->windows, link)
+		taskbar_add_button(taskbar, window->id, window->title);
+
 	return taskbar;
 }
 
@@ -1254,6 +1325,11 @@ desktop_shell_unmap(void *data,
 
 	struct taskbar_button *button;
 	struct taskbar_button *tmp;
+	struct taskbar_thumbnail *thumb;
+
+	thumb = taskbar_get_thumbnail(desktop, id);
+	if (thumb)
+		taskbar_thumbnail_destroy(thumb);
 
 	wl_list_for_each(output, &desktop->outputs, link) {
 		if (output->taskbar && output->taskbar->painted) {		
@@ -1268,6 +1344,191 @@ desktop_shell_unmap(void *data,
 	}
 }
 
+static void
+taskbar_thumbnail_destroy(struct taskbar_thumbnail *thumb)
+{
+	cairo_surface_destroy(thumb->surface);
+	munmap(thumb->data, thumb->size);
+	wl_list_remove(&thumb->link);
+	free(thumb);
+}
+
+static void
+taskbar_schedule_redraw_button(struct desktop *desktop, unsigned int id)
+{
+	struct output *output;
+	struct taskbar_button *button;
+
+	wl_list_for_each(output, &desktop->outputs, link) {
+		if (!output->taskbar)
+			continue;
+		wl_list_for_each(button, &output->taskbar->button_list, link)
+			if (button->id == id)
+				widget_schedule_redraw(button->widget);
+	}
+}
+
+static void
+desktop_shell_thumbnail(void *data,
+			struct desktop_shell *desktop_shell,
+			uint32_t id, int32_t fd,
+			int32_t width, int32_t height, int32_t stride)
+{
+	struct desktop *desktop = data;
+	struct taskbar_thumbnail *thumb;
+	void *map;
+
+	map = mmap(NULL, stride * height, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "failed to map thumbnail: %m\n");
+		return;
+	}
+
+	thumb = taskbar_get_thumbnail(desktop, id);
+	if (thumb)
+		taskbar_thumbnail_destroy(thumb);
+
+	thumb = xzalloc(sizeof *thumb);
+	thumb->id = id;
+	thumb->data = map;
+	thumb->size = stride * height;
+	thumb->surface =
+		cairo_image_surface_create_for_data(map, CAIRO_FORMAT_ARGB32,
+						    width, height, stride);
+	wl_list_insert(&desktop->thumbnails, &thumb->link);
+
+	taskbar_schedule_redraw_button(desktop, id);
+}
+
+static void
+desktop_shell_thumbnail_damage(void *data,
+			       struct desktop_shell *desktop_shell,
+			       uint32_t id, int32_t x, int32_t y,
+			       int32_t width, int32_t height)
+{
+	struct desktop *desktop = data;
+	struct taskbar_thumbnail *thumb;
+
+	/* the compositor wrote into the mapped image behind cairo's back */
+	thumb = taskbar_get_thumbnail(desktop, id);
+	if (thumb)
+		cairo_surface_mark_dirty_rectangle(thumb->surface,
+						   x, y, width, height);
+
+	taskbar_schedule_redraw_button(desktop, id);
+}
+
+static struct taskbar_window *
+desktop_get_window(struct desktop *desktop, unsigned int id)
+{
+	struct taskbar_window *window;
+
+	wl_list_for_each(window, &desktop->windows, link)
+		if (window->id == id)
+			return window;
+
+	return NULL;
+}
+
+static void
+taskbar_window_destroy(struct taskbar_window *window)
+{
+	free(window->title);
+	wl_list_remove(&window->link);
+	free(window);
+}
+
+/* Window list batches (desktop_shell version 4) only update the
+ * button lists; relayout happens once, on the terminating 'done'. */
+static void
+desktop_shell_window_added(void *data,
+			   struct desktop_shell *desktop_shell,
+			   uint32_t id, const char *title)
+{
+	struct desktop *desktop = data;
+	struct taskbar_window *window;
+	struct output *output;
+
+	window = xzalloc(sizeof *window);
+	window->id = id;
+	window->title = strdup(title);
+	wl_list_insert(desktop->windows.prev, &window->link);
+
+	wl_list_for_each(output, &desktop->outputs, link)
+		if (output->taskbar)
+			taskbar_add_button(output->taskbar, id, title);
+}
+
+static void
+desktop_shell_window_removed(void *data,
+			     struct desktop_shell *desktop_shell,
+			     uint32_t id)
+{
+	struct desktop *desktop = data;
+	struct taskbar_window *window;
+	struct taskbar_thumbnail *thumb;
+	struct taskbar_button *button, *tmp;
+	struct output *output;
+
+	window = desktop_get_window(desktop, id);
+	if (window)
+		taskbar_window_destroy(window);
+
+	thumb = taskbar_get_thumbnail(desktop, id);
+	if (thumb)
+		taskbar_thumbnail_destroy(thumb);
+
+	wl_list_for_each(output, &desktop->outputs, link) {
+		if (!output->taskbar)
+			continue;
+		wl_list_for_each_safe(button, tmp,
+				      &output->taskbar->button_list, link)
+			if (button->id == id)
+				taskbar_destroy_button(button);
+	}
+}
+
+static void
+desktop_shell_window_title(void *data,
+			   struct desktop_shell *desktop_shell,
+			   uint32_t id, const char *title)
+{
+	struct desktop *desktop = data;
+	struct taskbar_window *window;
+	struct taskbar_button *button;
+	struct output *output;
+
+	window = desktop_get_window(desktop, id);
+	if (window) {
+		free(window->title);
+		window->title = strdup(title);
+	}
+
+	wl_list_for_each(output, &desktop->outputs, link) {
+		if (!output->taskbar)
+			continue;
+		wl_list_for_each(button, &output->taskbar->button_list, link) {
+			if (button->id != id)
+				continue;
+			free(button->name);
+			button->name = strdup(title);
+		}
+	}
+}
+
+static void
+desktop_shell_done(void *data, struct desktop_shell *desktop_shell)
+{
+	struct desktop *desktop = data;
+	struct output *output;
+
+	wl_list_for_each(output, &desktop->outputs, link)
+		if (output->taskbar)
+			window_schedule_resize(output->taskbar->window,
+					       1000, 32);
+}
+
 static void
 desktop_shell_prepare_lock_surface(void *data,
 				   struct desktop_shell *desktop_shell)
@@ -1337,7 +1598,13 @@ static const struct desktop_shell_listener listener = {
 	desktop_shell_prepare_lock_surface,
 	desktop_shell_grab_cursor,
 	desktop_shell_map,
-	desktop_shell_unmap
+	desktop_shell_unmap,
+	desktop_shell_thumbnail,
+	desktop_shell_thumbnail_damage,
+	desktop_shell_window_added,
+	desktop_shell_window_removed,
+	desktop_shell_window_title,
+	desktop_shell_done
 };
 
 static void
@@ -1554,7 +1821,7 @@ global_handler(struct display *display, uint32_t id,
 	struct desktop *desktop = data;
 
 	if (!strcmp(interface, "desktop_shell")) {
-		desktop->interface_version = (version < 2) ? version : 2;
+		desktop->interface_version = (version < 4) ? version : 4;
 		desktop->shell = display_bind(desktop->display,
 					      id, &desktop_shell_interface,
 					      desktop->interface_version);
@@ -1604,10 +1871,14 @@ int main(int argc, char *argv[])
 {
 	struct desktop desktop = { 0 };
 	struct output *output;
+	struct taskbar_thumbnail *thumb, *tmp;
+	struct taskbar_window *window, *wtmp;
 	struct weston_config_section *s;
 
 	desktop.unlock_task.run = unlock_dialog_finish;
 	wl_list_init(&desktop.outputs);
+	wl_list_init(&desktop.thumbnails);
+	wl_list_init(&desktop.windows);
 
 	desktop.config = weston_config_parse("weston.ini");
 	s = weston_config_get_section(desktop.config, "shell", NULL, NULL);
@@ -1637,6 +1908,10 @@ int main(int argc, char *argv[])
 	/* Cleanup */
 	grab_surface_destroy(&desktop);
 	desktop_destroy_outputs(&desktop);
+	wl_list_for_each_safe(thumb, tmp, &desktop.thumbnails, link)
+		taskbar_thumbnail_destroy(thumb);
+	wl_list_for_each_safe(window, wtmp, &desktop.windows, link)
+		taskbar_window_destroy(window);
 	if (desktop.unlock_dialog)
 		unlock_dialog_destroy(desktop.unlock_dialog);
 	desktop_shell_destroy(desktop.shell);
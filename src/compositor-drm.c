@@ -102,6 +102,7 @@ struct drm_compositor {
 	int cursors_are_broken;
 
 	int use_pixman;
+	int pixman_shadow;
 
 	uint32_t prev_state;
 
@@ -163,7 +164,8 @@ struct drm_output {
 	struct drm_fb *dumb[2];
 	pixman_image_t *image[2];
 	int current_image;
-	pixman_region32_t previous_damage;
+	uint32_t image_frame[2];	/* frame last rendered, 0 for never */
+	uint32_t pixman_frame;
 
 	struct vaapi_recorder *recorder;
 	struct wl_listener recorder_frame_listener;
@@ -509,26 +511,22 @@ static void
 drm_output_render_pixman(struct drm_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *ec = output->base.compositor;
-	pixman_region32_t total_damage, previous_damage;
-
-	pixman_region32_init(&total_damage);
-	pixman_region32_init(&previous_damage);
-
-	pixman_region32_copy(&previous_damage, damage);
-
-	pixman_region32_union(&total_damage, damage, &output->previous_damage);
-	pixman_region32_copy(&output->previous_damage, &previous_damage);
+	int i, age;
 
 	output->current_image ^= 1;
+	i = output->current_image;
+	output->pixman_frame++;
 
-	output->next = output->dumb[output->current_image];
-	pixman_renderer_output_set_buffer(&output->base,
-					  output->image[output->current_image]);
+	/* The renderer redraws what the buffer missed since its last use. */
+	age = output->image_frame[i] ?
+		output->pixman_frame - output->image_frame[i] : 0;
+	output->image_frame[i] = output->pixman_frame;
 
-	ec->renderer->repaint_output(&output->base, &total_damage);
+	output->next = output->dumb[i];
+	pixman_renderer_output_set_buffer(&output->base, output->image[i]);
+	pixman_renderer_output_set_buffer_age(&output->base, age);
 
-	pixman_region32_fini(&total_damage);
-	pixman_region32_fini(&previous_damage);
+	ec->renderer->repaint_output(&output->base, damage);
 }
 
 static void
@@ -1532,8 +1530,10 @@ drm_output_init_pixman(struct drm_output *output, struct drm_compositor *c)
 	if (pixman_renderer_output_create(&output->base) < 0)
 		goto err;
 
-	pixman_region32_init_rect(&output->previous_damage,
-				  output->base.x, output->base.y, output->base.width, output->base.height);
+	/* Dumb buffers are often mapped write-combined, which makes
+	 * blending into them slow; the shadow is kept unless disabled. */
+	pixman_renderer_output_set_direct(&output->base, !c->pixman_shadow);
+	output->image_frame[0] = output->image_frame[1] = 0;
 
 	return 0;
 
@@ -1557,7 +1557,6 @@ drm_output_fini_pixman(struct drm_output *output)
 	unsigned int i;
 
 	pixman_renderer_output_destroy(&output->base);
-	pixman_region32_fini(&output->previous_damage);
 
 	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
 		drm_fb_destroy_dumb(output->dumb[i]);
@@ -2565,6 +2564,7 @@ drm_compositor_create(struct wl_display *display,
 {
 	struct drm_compositor *ec;
 	struct udev_device *drm_device;
+	struct weston_config_section *section;
 	struct wl_event_loop *loop;
 	const char *path;
 	uint32_t key;
@@ -2587,6 +2587,10 @@ drm_compositor_create(struct wl_display *display,
 		goto err_base;
 	}
 
+	section = weston_config_get_section(config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "pixman-shadow",
+				       &ec->pixman_shadow, 1);
+
 	/* Check if we run drm-backend using weston-launch */
 	ec->base.launcher = weston_launcher_connect(&ec->base, tty);
 	if (ec->base.launcher == NULL) {
@@ -623,6 +623,8 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 	if (compositor->use_pixman) {
 		if (pixman_renderer_output_create(&output->base) < 0)
 			goto out_shadow_surface;
+		/* shadow_surface is only copied to the frame buffer */
+		pixman_renderer_output_set_direct(&output->base, 1);
 	} else {
 		setenv("HYBRIS_EGLPLATFORM", "wayland", 1);
 		if (gl_renderer_output_create(&output->base,
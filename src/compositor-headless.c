@@ -24,32 +24,74 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <sys/eventfd.h>
 
 #include "compositor.h"
+#include "pixman-renderer.h"
+
+enum headless_repaint_mode {
+	HEADLESS_REPAINT_TIMER,		/* wall clock, fixed frame period */
+	HEADLESS_REPAINT_UNCAPPED,	/* wall clock, next frame at once */
+	HEADLESS_REPAINT_VIRTUAL	/* virtual clock, next frame at once */
+};
 
 struct headless_compositor {
 	struct weston_compositor base;
 	struct weston_seat fake_seat;
+	int use_pixman;
+	struct weston_recorder *recorder;
+	enum headless_repaint_mode repaint_mode;
+	uint32_t frame_step;		/* ms */
 };
 
 struct headless_output {
 	struct weston_output base;
 	struct weston_mode mode;
 	struct wl_event_source *finish_frame_timer;
+	int finish_frame_fd;
+	struct wl_event_source *finish_frame_source;
+	uint32_t virtual_time;
+	uint32_t *image_buf;
+	pixman_image_t *image;
 };
 
+struct headless_parameters {
+	int width;
+	int height;
+	int scale;
+	uint32_t transform;
+	int output_count;
+	int use_pixman;
+	char *record;
+	enum headless_repaint_mode repaint_mode;
+	uint32_t frame_step;
+};
 
-static void
-headless_output_start_repaint_loop(struct weston_output *output)
+static uint32_t
+headless_output_get_time(struct headless_output *output)
 {
-	uint32_t msec;
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->base.compositor;
 	struct timeval tv;
 
+	if (c->repaint_mode == HEADLESS_REPAINT_VIRTUAL)
+		return output->virtual_time;
+
 	gettimeofday(&tv, NULL);
-	msec = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-	weston_output_finish_frame(output, msec);
+	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void
+headless_output_start_repaint_loop(struct weston_output *output_base)
+{
+	struct headless_output *output = (struct headless_output *) output_base;
+
+	weston_output_finish_frame(&output->base,
+				   headless_output_get_time(output));
 }
 
 static int
@@ -60,6 +102,45 @@ finish_frame_handler(void *data)
 	return 1;
 }
 
+/* Uncapped and virtual frames complete through an eventfd rather than
+ * an idle callback, so that client requests still get dispatched
+ * between back-to-back frames. */
+static int
+finish_frame_fd_handler(int fd, uint32_t mask, void *data)
+{
+	struct headless_output *output = data;
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->base.compositor;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) != sizeof count)
+		return 1;
+
+	if (c->repaint_mode == HEADLESS_REPAINT_VIRTUAL)
+		output->virtual_time += c->frame_step;
+
+	headless_output_start_repaint_loop(&output->base);
+
+	return 1;
+}
+
+static void
+headless_output_schedule_finish_frame(struct headless_output *output)
+{
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->base.compositor;
+	uint64_t one = 1;
+
+	if (c->repaint_mode == HEADLESS_REPAINT_TIMER) {
+		wl_event_source_timer_update(output->finish_frame_timer,
+					     c->frame_step);
+		return;
+	}
+
+	if (write(output->finish_frame_fd, &one, sizeof one) != sizeof one)
+		weston_log("headless: failed to schedule frame: %m\n");
+}
+
 static int
 headless_output_repaint(struct weston_output *output_base,
 		       pixman_region32_t *damage)
@@ -72,7 +153,7 @@ headless_output_repaint(struct weston_output *output_base,
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 16);
+	headless_output_schedule_finish_frame(output);
 
 	return 0;
 }
@@ -81,40 +162,95 @@ static void
 headless_output_destroy(struct weston_output *output_base)
 {
 	struct headless_output *output = (struct headless_output *) output_base;
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->base.compositor;
 
+	wl_list_remove(&output->base.link);
 	wl_event_source_remove(output->finish_frame_timer);
+	if (output->finish_frame_source)
+		wl_event_source_remove(output->finish_frame_source);
+	if (output->finish_frame_fd >= 0)
+		close(output->finish_frame_fd);
+
+	if (c->use_pixman) {
+		pixman_renderer_output_destroy(&output->base);
+		pixman_image_unref(output->image);
+		free(output->image_buf);
+	}
+
+	weston_output_destroy(&output->base);
 	free(output);
 
 	return;
 }
 
 static int
+headless_output_init_pixman(struct headless_output *output)
+{
+	int width = output->mode.width;
+	int height = output->mode.height;
+
+	/* The image is in mode (framebuffer) orientation; the renderer
+	 * applies the output transform and scale when compositing. */
+	output->image_buf = malloc(width * height * 4);
+	if (output->image_buf == NULL)
+		return -1;
+
+	output->image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+						 width, height,
+						 output->image_buf,
+						 width * 4);
+	if (output->image == NULL)
+		goto err_buf;
+
+	if (pixman_renderer_output_create(&output->base) < 0)
+		goto err_image;
+
+	pixman_renderer_output_set_buffer(&output->base, output->image);
+	pixman_renderer_output_set_direct(&output->base, 1);
+
+	return 0;
+
+err_image:
+	pixman_image_unref(output->image);
+err_buf:
+	free(output->image_buf);
+	return -1;
+}
+
+static struct headless_output *
 headless_compositor_create_output(struct headless_compositor *c,
-				 int width, int height)
+				  int x, int width, int height,
+				  uint32_t transform, int32_t scale)
 {
 	struct headless_output *output;
 	struct wl_event_loop *loop;
 
 	output = zalloc(sizeof *output);
 	if (output == NULL)
-		return -1;
+		return NULL;
 
+	output->finish_frame_fd = -1;
 	output->mode.flags =
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
-	output->mode.width = width;
-	output->mode.height = height;
+	output->mode.width = width * scale;
+	output->mode.height = height * scale;
 	output->mode.refresh = 60;
 	wl_list_init(&output->base.mode_list);
 	wl_list_insert(&output->base.mode_list, &output->mode.link);
 
 	output->base.current_mode = &output->mode;
-	weston_output_init(&output->base, &c->base, 0, 0, width, height,
-			   WL_OUTPUT_TRANSFORM_NORMAL, 1);
+	weston_output_init(&output->base, &c->base, x, 0, width, height,
+			   transform, scale);
 
 	output->base.make = "weston";
 	output->base.model = "headless";
 
-	weston_output_move(&output->base, 0, 0);
+	if (c->use_pixman && headless_output_init_pixman(output) < 0) {
+		weston_output_destroy(&output->base);
+		free(output);
+		return NULL;
+	}
 
 	loop = wl_display_get_event_loop(c->base.wl_display);
 	output->finish_frame_timer =
@@ -130,6 +266,116 @@ headless_compositor_create_output(struct headless_compositor *c,
 
 	wl_list_insert(c->base.output_list.prev, &output->base.link);
 
+	if (c->repaint_mode != HEADLESS_REPAINT_TIMER) {
+		output->finish_frame_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (output->finish_frame_fd < 0) {
+			weston_log("headless: eventfd failed: %m\n");
+			headless_output_destroy(&output->base);
+			return NULL;
+		}
+		output->finish_frame_source =
+			wl_event_loop_add_fd(loop, output->finish_frame_fd,
+					     WL_EVENT_READABLE,
+					     finish_frame_fd_handler, output);
+	}
+
+	weston_log("headless output %dx%d at %d,0, scale %d, transform %d\n",
+		   output->mode.width, output->mode.height, x, scale,
+		   transform);
+
+	return output;
+}
+
+static uint32_t
+parse_transform(const char *transform, const char *output_name)
+{
+	static const struct { const char *name; uint32_t token; } names[] = {
+		{ "normal",	WL_OUTPUT_TRANSFORM_NORMAL },
+		{ "90",		WL_OUTPUT_TRANSFORM_90 },
+		{ "180",	WL_OUTPUT_TRANSFORM_180 },
+		{ "270",	WL_OUTPUT_TRANSFORM_270 },
+		{ "flipped",	WL_OUTPUT_TRANSFORM_FLIPPED },
+		{ "flipped-90",	WL_OUTPUT_TRANSFORM_FLIPPED_90 },
+		{ "flipped-180", WL_OUTPUT_TRANSFORM_FLIPPED_180 },
+		{ "flipped-270", WL_OUTPUT_TRANSFORM_FLIPPED_270 },
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(names); i++)
+		if (strcmp(names[i].name, transform) == 0)
+			return names[i].token;
+
+	weston_log("Invalid transform \"%s\" for output %s\n",
+		   transform, output_name);
+
+	return WL_OUTPUT_TRANSFORM_NORMAL;
+}
+
+/* Outputs come from [output] sections whose name starts with 'H', then
+ * the command line fills up to --output-count with the default size. */
+static int
+headless_compositor_create_outputs(struct headless_compositor *c,
+				   struct headless_parameters *param)
+{
+	struct headless_output *output;
+	struct weston_config_section *section;
+	const char *section_name;
+	char *name, *mode, *t;
+	int width, height, scale, x = 0, count = 0;
+	uint32_t transform;
+
+	section = NULL;
+	while (weston_config_next_section(c->base.config,
+					  &section, &section_name)) {
+		if (strcmp(section_name, "output") != 0)
+			continue;
+		weston_config_section_get_string(section, "name", &name, NULL);
+		if (name == NULL || name[0] != 'H') {
+			free(name);
+			continue;
+		}
+
+		weston_config_section_get_string(section, "mode", &mode, NULL);
+		if (mode == NULL ||
+		    sscanf(mode, "%dx%d", &width, &height) != 2) {
+			if (mode)
+				weston_log("Invalid mode \"%s\" for output "
+					   "%s\n", mode, name);
+			width = param->width;
+			height = param->height;
+		}
+		free(mode);
+
+		weston_config_section_get_int(section, "scale", &scale,
+					      param->scale);
+		weston_config_section_get_string(section,
+						 "transform", &t, "normal");
+		transform = parse_transform(t, name);
+		free(t);
+		free(name);
+
+		output = headless_compositor_create_output(c, x, width, height,
+							   transform, scale);
+		if (output == NULL)
+			return -1;
+
+		x = pixman_region32_extents(&output->base.region)->x2;
+		if (++count == param->output_count)
+			return 0;
+	}
+
+	for (; count < param->output_count; count++) {
+		output = headless_compositor_create_output(c, x,
+							   param->width,
+							   param->height,
+							   param->transform,
+							   param->scale);
+		if (output == NULL)
+			return -1;
+
+		x = pixman_region32_extents(&output->base.region)->x2;
+	}
+
 	return 0;
 }
 
@@ -143,21 +389,32 @@ headless_destroy(struct weston_compositor *ec)
 {
 	struct headless_compositor *c = (struct headless_compositor *) ec;
 
-	ec->renderer->destroy(ec);
+	if (c->recorder)
+		weston_recorder_stop(c->recorder);
 
 	weston_seat_release(&c->fake_seat);
 	weston_compositor_shutdown(ec);
 
+	ec->renderer->destroy(ec);
+
 	free(ec);
 }
 
+static const char *repaint_mode_names[] = {
+	[HEADLESS_REPAINT_TIMER] = "timer",
+	[HEADLESS_REPAINT_UNCAPPED] = "uncapped",
+	[HEADLESS_REPAINT_VIRTUAL] = "virtual",
+};
+
 static struct weston_compositor *
 headless_compositor_create(struct wl_display *display,
-			   int width, int height, const char *display_name,
+			   struct headless_parameters *param,
+			   const char *display_name,
 			   int *argc, char *argv[],
 			   struct weston_config *config)
 {
 	struct headless_compositor *c;
+	struct weston_output *output;
 
 	c = zalloc(sizeof *c);
 	if (c == NULL)
@@ -171,14 +428,42 @@ headless_compositor_create(struct wl_display *display,
 	c->base.destroy = headless_destroy;
 	c->base.restore = headless_restore;
 
-	if (headless_compositor_create_output(c, width, height) < 0)
-		goto err_compositor;
-
-	if (noop_renderer_init(&c->base) < 0)
-		goto err_compositor;
+	c->repaint_mode = param->repaint_mode;
+	c->frame_step = param->frame_step;
+
+	c->use_pixman = param->use_pixman;
+	if (c->use_pixman) {
+		if (pixman_renderer_init(&c->base) < 0)
+			goto err_compositor;
+	} else {
+		if (noop_renderer_init(&c->base) < 0)
+			goto err_compositor;
+	}
+	weston_log("Using %s renderer\n", c->use_pixman ? "pixman" : "noop");
+	weston_log("headless repaint mode %s, frame step %u ms\n",
+		   repaint_mode_names[c->repaint_mode], c->frame_step);
+
+	if (headless_compositor_create_outputs(c, param) < 0)
+		goto err_renderer;
+
+	if (param->record) {
+		if (!c->use_pixman) {
+			weston_log("--record requires --use-pixman\n");
+			goto err_renderer;
+		}
+
+		output = container_of(c->base.output_list.next,
+				      struct weston_output, link);
+		weston_log("starting recorder, file %s\n", param->record);
+		c->recorder = weston_recorder_start(output, param->record);
+		if (c->recorder == NULL)
+			goto err_renderer;
+	}
 
 	return &c->base;
 
+err_renderer:
+	c->base.renderer->destroy(&c->base);
 err_compositor:
 	weston_compositor_shutdown(&c->base);
 err_free:
@@ -190,17 +475,60 @@ WL_EXPORT struct weston_compositor *
 backend_init(struct wl_display *display, int *argc, char *argv[],
 	     struct weston_config *config)
 {
-	int width = 1024, height = 640;
+	struct headless_parameters param = { 0, };
+	struct weston_compositor *ec;
 	char *display_name = NULL;
+	char *transform = NULL;
+	char *repaint = NULL;
+	int32_t frame_step = 16;
+	unsigned int i;
 
 	const struct weston_option headless_options[] = {
-		{ WESTON_OPTION_INTEGER, "width", 0, &width },
-		{ WESTON_OPTION_INTEGER, "height", 0, &height },
+		{ WESTON_OPTION_INTEGER, "width", 0, &param.width },
+		{ WESTON_OPTION_INTEGER, "height", 0, &param.height },
+		{ WESTON_OPTION_INTEGER, "scale", 0, &param.scale },
+		{ WESTON_OPTION_STRING, "transform", 0, &transform },
+		{ WESTON_OPTION_INTEGER, "output-count", 0, &param.output_count },
+		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &param.use_pixman },
+		{ WESTON_OPTION_STRING, "record", 0, &param.record },
+		{ WESTON_OPTION_STRING, "repaint", 0, &repaint },
+		{ WESTON_OPTION_INTEGER, "frame-step", 0, &frame_step },
 	};
 
+	param.width = 1024;
+	param.height = 640;
+	param.scale = 1;
+	param.output_count = 1;
+
 	parse_options(headless_options,
 		      ARRAY_LENGTH(headless_options), argc, argv);
 
-	return headless_compositor_create(display, width, height, display_name,
-					  argc, argv, config);
+	param.transform = WL_OUTPUT_TRANSFORM_NORMAL;
+	if (transform) {
+		param.transform = parse_transform(transform, "headless");
+		free(transform);
+	}
+
+	param.repaint_mode = HEADLESS_REPAINT_TIMER;
+	if (repaint) {
+		for (i = 0; i < ARRAY_LENGTH(repaint_mode_names); i++)
+			if (strcmp(repaint_mode_names[i], repaint) == 0)
+				break;
+		if (i == ARRAY_LENGTH(repaint_mode_names))
+			weston_log("Invalid repaint mode \"%s\", "
+				   "using timer\n", repaint);
+		else
+			param.repaint_mode = i;
+		free(repaint);
+	}
+
+	if (frame_step < 1)
+		frame_step = 1;
+	param.frame_step = frame_step;
+
+	ec = headless_compositor_create(display, &param, display_name,
+					argc, argv, config);
+	free(param.record);
+
+	return ec;
 }
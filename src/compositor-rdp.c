@@ -25,6 +25,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <linux/input.h>
 
 #include <freerdp/freerdp.h>
@@ -41,6 +44,8 @@
 
 #define MAX_FREERDP_FDS 32
 #define DEFAULT_AXIS_STEP_DISTANCE wl_fixed_from_int(10)
+#define RDP_TILE_SIZE 64
+#define RDP_MAX_ENCODER_THREADS 16
 
 struct rdp_compositor_config {
 	int width;
@@ -52,9 +57,52 @@ struct rdp_compositor_config {
 	char *server_key;
 	char *extra_modes;
 	int env_socket;
+	int encoder_threads;
 };
 
 struct rdp_output;
+struct rdp_peer_context;
+
+/* A band of one peer's damage: a snapshot of its pixels taken on the
+ * compositor thread and the message an encoder thread makes of it. */
+struct rdp_encode_band {
+	struct rdp_encode_frame *frame;
+	int index;			/* selects the peer's codec contexts */
+	pixman_box32_t extents;		/* output coordinates */
+	RFX_RECT *rfx_rects;		/* relative to extents */
+	int nrects;
+	uint32_t *pixels;
+	int stride;
+	struct wl_list link;		/* rdp_encoder::jobs */
+};
+
+/* One repaint's worth of damage for one peer, split in bands that the
+ * encoder threads work on in parallel.  A peer has at most one frame in
+ * flight; it is sent in band order once every band is encoded. */
+struct rdp_encode_frame {
+	struct rdp_peer_context *peer;
+	int nsc;
+	pixman_region32_t damage;
+	int nbands;
+	int bands_done;			/* under rdp_encoder::mutex */
+	struct rdp_encode_band bands[RDP_MAX_ENCODER_THREADS];
+	struct wl_list link;		/* rdp_encoder::done */
+};
+
+struct rdp_encoder {
+	pthread_t threads[RDP_MAX_ENCODER_THREADS];
+	int thread_count;
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;
+	pthread_cond_t done_cond;
+	struct wl_list jobs;
+	struct wl_list done;
+	int quit;
+
+	/* Signalled by the encoder threads when a frame is done. */
+	int done_fd;
+	struct wl_event_source *done_source;
+};
 
 struct rdp_compositor {
 	struct weston_compositor base;
@@ -67,6 +115,8 @@ struct rdp_compositor {
 	char *server_key;
 	char *rdp_key;
 	int tls_enabled;
+
+	struct rdp_encoder encoder;
 };
 
 enum peer_item_flags {
@@ -87,6 +137,11 @@ struct rdp_output {
 	struct wl_event_source *finish_frame_timer;
 	pixman_image_t *shadow_surface;
 
+	/* One hash per RDP_TILE_SIZE square of the shadow surface, kept up
+	 * to date with every repaint. */
+	uint64_t *tile_hashes;
+	int tiles_x, tiles_y;
+
 	struct wl_list peers;
 };
 
@@ -95,10 +150,22 @@ struct rdp_peer_context {
 
 	struct rdp_compositor *rdpCompositor;
 	struct wl_event_source *events[MAX_FREERDP_FDS];
-	RFX_CONTEXT *rfx_context;
-	wStream *encode_stream;
-	RFX_RECT *rfx_rects;
-	NSC_CONTEXT *nsc_context;
+
+	/* Codec state per band, created as bands get used. */
+	RFX_CONTEXT *rfx_contexts[RDP_MAX_ENCODER_THREADS];
+	NSC_CONTEXT *nsc_contexts[RDP_MAX_ENCODER_THREADS];
+	wStream *encode_streams[RDP_MAX_ENCODER_THREADS];
+
+	/* The frame being encoded, and damage that arrived meanwhile. */
+	struct rdp_encode_frame *encoding;
+	pixman_region32_t pending;
+
+	/* Hashes of the tile contents this peer was last sent, 0 meaning
+	 * unknown. */
+	uint64_t *tile_hashes;
+	int tiles_x, tiles_y;
+	uint64_t tiles_sent, tiles_skipped;
+	uint64_t bytes_saved;
 
 	struct rdp_peers_item item;
 };
@@ -115,95 +182,405 @@ rdp_compositor_config_init(struct rdp_compositor_config *config) {
 	config->server_key = NULL;
 	config->extra_modes = NULL;
 	config->env_socket = 0;
+	config->encoder_threads = 0;
+}
+
+/* Creates the codec state for band index i of a peer on first use. */
+static int
+rdp_peer_band_contexts(RdpPeerContext *context, int i, int nsc)
+{
+	rdpSettings *settings = context->item.peer->settings;
+	RFX_CONTEXT *rfx;
+
+	if (!context->encode_streams[i]) {
+		context->encode_streams[i] = Stream_New(NULL, 65536);
+		if (!context->encode_streams[i])
+			return -1;
+	}
+
+	if (nsc && !context->nsc_contexts[i]) {
+		context->nsc_contexts[i] = nsc_context_new();
+		if (!context->nsc_contexts[i])
+			return -1;
+		nsc_context_set_pixel_format(context->nsc_contexts[i],
+					     RDP_PIXEL_FORMAT_B8G8R8A8);
+	}
+
+	if (!nsc && !context->rfx_contexts[i]) {
+		rfx = rfx_context_new();
+		if (!rfx)
+			return -1;
+		rfx->mode = RLGR3;
+		rfx->width = settings->DesktopWidth;
+		rfx->height = settings->DesktopHeight;
+		rfx_context_set_pixel_format(rfx, RDP_PIXEL_FORMAT_B8G8R8A8);
+		context->rfx_contexts[i] = rfx;
+	}
+
+	return 0;
+}
+
+/* Runs on an encoder thread, touching only the band and the codec state
+ * of its index, which no other band in flight uses. */
+static void
+rdp_encode_band(struct rdp_encode_band *band)
+{
+	struct rdp_encode_frame *frame = band->frame;
+	RdpPeerContext *context = frame->peer;
+	wStream *stream = context->encode_streams[band->index];
+	int width = band->extents.x2 - band->extents.x1;
+	int height = band->extents.y2 - band->extents.y1;
+
+	Stream_Clear(stream);
+	Stream_SetPosition(stream, 0);
+
+	if (frame->nsc)
+		nsc_compose_message(context->nsc_contexts[band->index], stream,
+				    (BYTE *)band->pixels, width, height,
+				    band->stride);
+	else
+		rfx_compose_message(context->rfx_contexts[band->index], stream,
+				    band->rfx_rects, band->nrects,
+				    (BYTE *)band->pixels, width, height,
+				    band->stride);
 }
 
 static void
-rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_encode_frame_destroy(struct rdp_encode_frame *frame)
 {
-	int width, height, nrects, i;
-	pixman_box32_t *region, *rects;
-	uint32_t *ptr;
-	RFX_RECT *rfxRect;
+	int i;
+
+	for (i = 0; i < RDP_MAX_ENCODER_THREADS; i++) {
+		free(frame->bands[i].pixels);
+		free(frame->bands[i].rfx_rects);
+	}
+	pixman_region32_fini(&frame->damage);
+	free(frame);
+}
+
+static void
+rdp_peer_send_frame(struct rdp_encode_frame *frame)
+{
+	freerdp_peer *peer = frame->peer->item.peer;
 	rdpUpdate *update = peer->update;
 	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	struct rdp_encode_band *band;
+	wStream *stream;
+	int i;
 
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
+	for (i = 0; i < frame->nbands; i++) {
+		band = &frame->bands[i];
+		stream = frame->peer->encode_streams[band->index];
+
+		cmd->destLeft = band->extents.x1;
+		cmd->destTop = band->extents.y1;
+		cmd->destRight = band->extents.x2;
+		cmd->destBottom = band->extents.y2;
+		cmd->bpp = 32;
+		cmd->codecID = frame->nsc ? peer->settings->NSCodecId :
+			peer->settings->RemoteFxCodecId;
+		cmd->width = band->extents.x2 - band->extents.x1;
+		cmd->height = band->extents.y2 - band->extents.y1;
+		cmd->bitmapDataLength = Stream_GetPosition(stream);
+		cmd->bitmapData = Stream_Buffer(stream);
+
+		update->SurfaceBits(update->context, cmd);
+	}
 
-	width = (damage->extents.x2 - damage->extents.x1);
-	height = (damage->extents.y2 - damage->extents.y1);
+	/* The raw path reallocates bitmapData, which must not be ours. */
+	cmd->bitmapData = NULL;
+}
 
-	cmd->destLeft = damage->extents.x1;
-	cmd->destTop = damage->extents.y1;
-	cmd->destRight = damage->extents.x2;
-	cmd->destBottom = damage->extents.y2;
-	cmd->bpp = 32;
-	cmd->codecID = peer->settings->RemoteFxCodecId;
-	cmd->width = width;
-	cmd->height = height;
+/* Snapshots the damaged pixels in bands and queues them for the encoder
+ * threads.  While the peer still has a frame in flight, the damage is
+ * only accumulated and encoded from a fresh snapshot once that frame
+ * went out, so a slow peer coalesces updates instead of queueing them
+ * up or holding back the compositor and the other peers. */
+static void
+rdp_peer_encode(RdpPeerContext *context, pixman_region32_t *region)
+{
+	struct rdp_encoder *encoder = &context->rdpCompositor->encoder;
+	pixman_image_t *image = context->rdpCompositor->output->shadow_surface;
+	uint32_t *data = pixman_image_get_data(image);
+	int stride = pixman_image_get_stride(image) / sizeof(uint32_t);
+	struct rdp_encode_frame *frame;
+	struct rdp_encode_band *band;
+	pixman_region32_t clip;
+	pixman_box32_t *extents, *rects;
+	int band_height, width, height, nrects, y, i;
+
+	if (context->encoding) {
+		pixman_region32_union(&context->pending, &context->pending,
+				      region);
+		return;
+	}
 
-	ptr = pixman_image_get_data(image) + damage->extents.x1 +
-				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
+	frame = zalloc(sizeof *frame);
+	if (!frame)
+		return;
+	frame->peer = context;
+	frame->nsc = !context->item.peer->settings->RemoteFxCodec;
+	wl_list_init(&frame->link);
+	pixman_region32_init_rect(&frame->damage, 0, 0,
+				  pixman_image_get_width(image),
+				  pixman_image_get_height(image));
+	pixman_region32_intersect(&frame->damage, &frame->damage, region);
+	if (!pixman_region32_not_empty(&frame->damage)) {
+		rdp_encode_frame_destroy(frame);
+		return;
+	}
+
+	/* One band per thread, in whole RemoteFX tiles so that splitting
+	 * does not add tiles to encode. */
+	extents = pixman_region32_extents(&frame->damage);
+	band_height = (extents->y2 - extents->y1 + encoder->thread_count - 1) /
+		encoder->thread_count;
+	band_height = (band_height + RDP_TILE_SIZE - 1) /
+		RDP_TILE_SIZE * RDP_TILE_SIZE;
+
+	pixman_region32_init(&clip);
+	for (y = extents->y1; y < extents->y2; y += band_height) {
+		pixman_region32_intersect_rect(&clip, &frame->damage,
+					       extents->x1, y,
+					       extents->x2 - extents->x1,
+					       band_height);
+		if (!pixman_region32_not_empty(&clip))
+			continue;
+
+		band = &frame->bands[frame->nbands];
+		band->frame = frame;
+		band->index = frame->nbands;
+		band->extents = *pixman_region32_extents(&clip);
+		if (rdp_peer_band_contexts(context, band->index, frame->nsc) < 0)
+			goto err;
+
+		width = band->extents.x2 - band->extents.x1;
+		height = band->extents.y2 - band->extents.y1;
+		band->stride = width * sizeof(uint32_t);
+		band->pixels = malloc(band->stride * height);
+		if (!band->pixels)
+			goto err;
+		for (i = 0; i < height; i++)
+			memcpy(band->pixels + i * width,
+			       data + (band->extents.y1 + i) * stride +
+			       band->extents.x1, band->stride);
+
+		if (!frame->nsc) {
+			rects = pixman_region32_rectangles(&clip, &nrects);
+			band->rfx_rects = malloc(nrects * sizeof *band->rfx_rects);
+			if (!band->rfx_rects)
+				goto err;
+			for (i = 0; i < nrects; i++) {
+				band->rfx_rects[i].x = rects[i].x1 - band->extents.x1;
+				band->rfx_rects[i].y = rects[i].y1 - band->extents.y1;
+				band->rfx_rects[i].width = rects[i].x2 - rects[i].x1;
+				band->rfx_rects[i].height = rects[i].y2 - rects[i].y1;
+			}
+			band->nrects = nrects;
+		}
+
+		frame->nbands++;
+	}
+	pixman_region32_fini(&clip);
+
+	context->encoding = frame;
+
+	pthread_mutex_lock(&encoder->mutex);
+	for (i = 0; i < frame->nbands; i++)
+		wl_list_insert(encoder->jobs.prev, &frame->bands[i].link);
+	pthread_cond_broadcast(&encoder->job_cond);
+	pthread_mutex_unlock(&encoder->mutex);
+	return;
 
-	rects = pixman_region32_rectangles(damage, &nrects);
-	context->rfx_rects = realloc(context->rfx_rects, nrects * sizeof *rfxRect);
+err:
+	weston_log("failed to prepare RDP frame for encoding\n");
+	pixman_region32_fini(&clip);
+	rdp_encode_frame_destroy(frame);
+}
 
-	for (i = 0; i < nrects; i++) {
-		region = &rects[i];
-		rfxRect = &context->rfx_rects[i];
+static void
+rdp_peer_encode_pending(RdpPeerContext *context)
+{
+	pixman_region32_t region;
 
-		rfxRect->x = (region->x1 - damage->extents.x1);
-		rfxRect->y = (region->y1 - damage->extents.y1);
-		rfxRect->width = (region->x2 - region->x1);
-		rfxRect->height = (region->y2 - region->y1);
+	if (context->encoding ||
+	    !pixman_region32_not_empty(&context->pending))
+		return;
+
+	pixman_region32_init(&region);
+	pixman_region32_copy(&region, &context->pending);
+	pixman_region32_clear(&context->pending);
+	rdp_peer_encode(context, &region);
+	pixman_region32_fini(&region);
+}
+
+/* Takes the peer's frame back from the encoder threads without sending
+ * it; its damage goes back to pending. */
+static void
+rdp_peer_encode_cancel(RdpPeerContext *context)
+{
+	struct rdp_encode_frame *frame = context->encoding;
+	struct rdp_encoder *encoder;
+	struct rdp_encode_band *band;
+	int i;
+
+	if (!frame)
+		return;
+	encoder = &context->rdpCompositor->encoder;
+
+	pthread_mutex_lock(&encoder->mutex);
+	for (i = 0; i < frame->nbands; i++) {
+		band = &frame->bands[i];
+		if (!wl_list_empty(&band->link)) {
+			wl_list_remove(&band->link);
+			wl_list_init(&band->link);
+			frame->bands_done++;
+		}
 	}
+	while (frame->bands_done < frame->nbands)
+		pthread_cond_wait(&encoder->done_cond, &encoder->mutex);
+	wl_list_remove(&frame->link);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	pixman_region32_union(&context->pending, &context->pending,
+			      &frame->damage);
+	rdp_encode_frame_destroy(frame);
+	context->encoding = NULL;
+}
 
-	rfx_compose_message(context->rfx_context, context->encode_stream, context->rfx_rects, nrects,
-			(BYTE *)ptr, width, height,
-			pixman_image_get_stride(image)
-	);
+static void *
+rdp_encoder_thread_function(void *data)
+{
+	struct rdp_encoder *encoder = data;
+	struct rdp_encode_band *band;
+	struct rdp_encode_frame *frame;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&encoder->mutex);
+	while (!encoder->quit) {
+		if (wl_list_empty(&encoder->jobs)) {
+			pthread_cond_wait(&encoder->job_cond, &encoder->mutex);
+			continue;
+		}
+
+		band = container_of(encoder->jobs.next,
+				    struct rdp_encode_band, link);
+		wl_list_remove(&band->link);
+		wl_list_init(&band->link);
+		pthread_mutex_unlock(&encoder->mutex);
 
-	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd->bitmapData = Stream_Buffer(context->encode_stream);
+		rdp_encode_band(band);
+
+		pthread_mutex_lock(&encoder->mutex);
+		frame = band->frame;
+		if (++frame->bands_done == frame->nbands) {
+			wl_list_insert(encoder->done.prev, &frame->link);
+			pthread_cond_broadcast(&encoder->done_cond);
+
+			/* Can only fail once the counter would overflow,
+			 * with a wakeup pending anyway. */
+			if (write(encoder->done_fd, &one, sizeof one) < 0)
+				continue;
+		}
+	}
+	pthread_mutex_unlock(&encoder->mutex);
 
-	update->SurfaceBits(update->context, cmd);
+	return NULL;
 }
 
+/* Sends the frames the encoder threads finished, then starts encoding
+ * whatever damage their peers collected in the meantime. */
+static int
+rdp_encoder_done(int fd, uint32_t mask, void *data)
+{
+	struct rdp_encoder *encoder = data;
+	struct rdp_encode_frame *frame, *next;
+	RdpPeerContext *context;
+	struct wl_list done;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) != sizeof count)
+		return 1;
+
+	wl_list_init(&done);
+	pthread_mutex_lock(&encoder->mutex);
+	wl_list_insert_list(&done, &encoder->done);
+	wl_list_init(&encoder->done);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	wl_list_for_each_safe(frame, next, &done, link) {
+		context = frame->peer;
+		context->encoding = NULL;
+		rdp_peer_send_frame(frame);
+		rdp_encode_frame_destroy(frame);
+		rdp_peer_encode_pending(context);
+	}
+
+	return 1;
+}
 
 static void
-rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_encoder_destroy(struct rdp_encoder *encoder)
 {
-	int width, height;
-	uint32_t *ptr;
-	rdpUpdate *update = peer->update;
-	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	int i;
 
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
+	pthread_mutex_lock(&encoder->mutex);
+	encoder->quit = 1;
+	pthread_cond_broadcast(&encoder->job_cond);
+	pthread_mutex_unlock(&encoder->mutex);
 
-	width = (damage->extents.x2 - damage->extents.x1);
-	height = (damage->extents.y2 - damage->extents.y1);
+	for (i = 0; i < encoder->thread_count; i++)
+		pthread_join(encoder->threads[i], NULL);
 
-	cmd->destLeft = damage->extents.x1;
-	cmd->destTop = damage->extents.y1;
-	cmd->destRight = damage->extents.x2;
-	cmd->destBottom = damage->extents.y2;
-	cmd->bpp = 32;
-	cmd->codecID = peer->settings->NSCodecId;
-	cmd->width = width;
-	cmd->height = height;
-
-	ptr = pixman_image_get_data(image) + damage->extents.x1 +
-				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
-
-	nsc_compose_message(context->nsc_context, context->encode_stream, (BYTE *)ptr,
-			cmd->width,	cmd->height,
-			pixman_image_get_stride(image));
-	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd->bitmapData = Stream_Buffer(context->encode_stream);
-	update->SurfaceBits(update->context, cmd);
+	if (encoder->done_source)
+		wl_event_source_remove(encoder->done_source);
+	if (encoder->done_fd >= 0)
+		close(encoder->done_fd);
+
+	pthread_mutex_destroy(&encoder->mutex);
+	pthread_cond_destroy(&encoder->job_cond);
+	pthread_cond_destroy(&encoder->done_cond);
+}
+
+static int
+rdp_encoder_init(struct rdp_compositor *c, int threads)
+{
+	struct rdp_encoder *encoder = &c->encoder;
+	struct wl_event_loop *loop;
+
+	pthread_mutex_init(&encoder->mutex, NULL);
+	pthread_cond_init(&encoder->job_cond, NULL);
+	pthread_cond_init(&encoder->done_cond, NULL);
+	wl_list_init(&encoder->jobs);
+	wl_list_init(&encoder->done);
+
+	encoder->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (encoder->done_fd < 0) {
+		weston_log("rdp: eventfd failed: %m\n");
+		goto err;
+	}
+
+	loop = wl_display_get_event_loop(c->base.wl_display);
+	encoder->done_source = wl_event_loop_add_fd(loop, encoder->done_fd,
+						    WL_EVENT_READABLE,
+						    rdp_encoder_done, encoder);
+	if (!encoder->done_source)
+		goto err;
+
+	for (; encoder->thread_count < threads; encoder->thread_count++) {
+		if (pthread_create(&encoder->threads[encoder->thread_count],
+				   NULL, rdp_encoder_thread_function,
+				   encoder) != 0) {
+			weston_log("rdp: failed to start encoder thread\n");
+			goto err;
+		}
+	}
+
+	return 0;
+
+err:
+	rdp_encoder_destroy(encoder);
+	return -1;
 }
 
 static void
@@ -283,14 +660,230 @@ rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
 	struct rdp_output *output = context->rdpCompositor->output;
 	rdpSettings *settings = peer->settings;
 
-	if (settings->RemoteFxCodec)
-		rdp_peer_refresh_rfx(region, output->shadow_surface, peer);
-	else if (settings->NSCodec)
-		rdp_peer_refresh_nsc(region, output->shadow_surface, peer);
+	if (settings->RemoteFxCodec || settings->NSCodec)
+		rdp_peer_encode(context, region);
 	else
 		rdp_peer_refresh_raw(region, output->shadow_surface, peer);
 }
 
+#define TILE_HASH_PRIME 0x9e3779b97f4a7c15ULL
+
+static inline uint64_t
+tile_hash_mix(uint64_t h, uint64_t v)
+{
+	h = (h ^ v) * TILE_HASH_PRIME;
+	return h ^ (h >> 32);
+}
+
+/* A multiply and xorshift hash of the pixels of one tile, four lanes
+ * wide so that the multiplications do not wait on each other.  Never
+ * returns 0, which peers use for tiles they know nothing about. */
+static uint64_t
+tile_hash(const uint32_t *pixels, int stride, int width, int height)
+{
+	uint64_t a = 1, b = 2, c = 3, d = 4, v[4], h;
+	int x, y;
+
+	for (y = 0; y < height; y++, pixels += stride) {
+		for (x = 0; x + 8 <= width; x += 8) {
+			memcpy(v, pixels + x, sizeof v);
+			a = tile_hash_mix(a, v[0]);
+			b = tile_hash_mix(b, v[1]);
+			c = tile_hash_mix(c, v[2]);
+			d = tile_hash_mix(d, v[3]);
+		}
+		for (; x < width; x++)
+			a = tile_hash_mix(a, pixels[x]);
+	}
+
+	h = tile_hash_mix(tile_hash_mix(tile_hash_mix(a, b), c), d);
+	h = (h ^ (h >> 29)) * TILE_HASH_PRIME;
+	h ^= h >> 32;
+
+	return h ? h : 1;
+}
+
+/* The range of tiles covered by the extents of region, end exclusive. */
+static void
+tile_range(struct rdp_output *output, pixman_region32_t *region,
+	   pixman_box32_t *range)
+{
+	pixman_box32_t *extents = pixman_region32_extents(region);
+
+	range->x1 = extents->x1 > 0 ? extents->x1 / RDP_TILE_SIZE : 0;
+	range->y1 = extents->y1 > 0 ? extents->y1 / RDP_TILE_SIZE : 0;
+	range->x2 = MIN((extents->x2 + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE,
+			output->tiles_x);
+	range->y2 = MIN((extents->y2 + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE,
+			output->tiles_y);
+}
+
+static void
+rdp_output_hash_tiles(struct rdp_output *output, pixman_region32_t *damage)
+{
+	uint32_t *data = pixman_image_get_data(output->shadow_surface);
+	int width = pixman_image_get_width(output->shadow_surface);
+	int height = pixman_image_get_height(output->shadow_surface);
+	int stride = pixman_image_get_stride(output->shadow_surface) / 4;
+	pixman_box32_t box, range;
+	int tx, ty, w, h;
+
+	if (damage) {
+		tile_range(output, damage, &range);
+	} else {
+		range.x1 = range.y1 = 0;
+		range.x2 = output->tiles_x;
+		range.y2 = output->tiles_y;
+	}
+
+	for (ty = range.y1; ty < range.y2; ty++) {
+		box.y1 = ty * RDP_TILE_SIZE;
+		box.y2 = MIN(box.y1 + RDP_TILE_SIZE, height);
+		h = box.y2 - box.y1;
+
+		for (tx = range.x1; tx < range.x2; tx++) {
+			box.x1 = tx * RDP_TILE_SIZE;
+			box.x2 = MIN(box.x1 + RDP_TILE_SIZE, width);
+			w = box.x2 - box.x1;
+
+			if (damage &&
+			    pixman_region32_contains_rectangle(damage, &box) ==
+			    PIXMAN_REGION_OUT)
+				continue;
+
+			output->tile_hashes[ty * output->tiles_x + tx] =
+				tile_hash(data + box.y1 * stride + box.x1,
+					  stride, w, h);
+		}
+	}
+}
+
+/* (Re)allocates the tile grid for the current shadow surface and hashes
+ * all of it. */
+static int
+rdp_output_init_tiles(struct rdp_output *output)
+{
+	int width = pixman_image_get_width(output->shadow_surface);
+	int height = pixman_image_get_height(output->shadow_surface);
+	uint64_t *hashes;
+
+	output->tiles_x = (width + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE;
+	output->tiles_y = (height + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE;
+
+	hashes = realloc(output->tile_hashes, output->tiles_x *
+			 output->tiles_y * sizeof *hashes);
+	if (hashes == NULL) {
+		free(output->tile_hashes);
+		output->tile_hashes = NULL;
+		output->tiles_x = output->tiles_y = 0;
+		return -1;
+	}
+	output->tile_hashes = hashes;
+
+	rdp_output_hash_tiles(output, NULL);
+	return 0;
+}
+
+/* Makes the peer's tile grid match the output's; after a full refresh
+ * the peer holds exactly what the output hashes describe, otherwise
+ * every tile is marked unknown. */
+static void
+rdp_peer_reset_tiles(RdpPeerContext *context, struct rdp_output *output,
+		     int synced)
+{
+	int count = output->tiles_x * output->tiles_y;
+
+	if (context->tiles_x != output->tiles_x ||
+	    context->tiles_y != output->tiles_y) {
+		free(context->tile_hashes);
+		context->tile_hashes = calloc(count, sizeof(uint64_t));
+		context->tiles_x = context->tile_hashes ? output->tiles_x : 0;
+		context->tiles_y = context->tile_hashes ? output->tiles_y : 0;
+		if (!context->tile_hashes)
+			return;
+	}
+
+	if (synced)
+		memcpy(context->tile_hashes, output->tile_hashes,
+		       count * sizeof(uint64_t));
+	else
+		memset(context->tile_hashes, 0, count * sizeof(uint64_t));
+}
+
+static uint64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	uint64_t area = 0;
+	int i, nrects;
+
+	rects = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++)
+		area += (uint64_t) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+/* Sends the part of damage whose tiles differ from what the peer was
+ * last sent.  Repainting a window with identical contents, blinking
+ * cursors redrawn in place and the like then cost no encoding at all. */
+static void
+rdp_peer_refresh_changed(pixman_region32_t *damage, freerdp_peer *peer)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	struct rdp_output *output = context->rdpCompositor->output;
+	pixman_box32_t box, range;
+	pixman_region32_t changed;
+	uint64_t *hash;
+	int tx, ty;
+
+	if (context->tiles_x != output->tiles_x ||
+	    context->tiles_y != output->tiles_y)
+		rdp_peer_reset_tiles(context, output, 0);
+	if (!context->tile_hashes || !output->tile_hashes) {
+		rdp_peer_refresh_region(damage, peer);
+		return;
+	}
+
+	tile_range(output, damage, &range);
+
+	pixman_region32_init(&changed);
+	for (ty = range.y1; ty < range.y2; ty++) {
+		box.y1 = ty * RDP_TILE_SIZE;
+		box.y2 = box.y1 + RDP_TILE_SIZE;
+
+		for (tx = range.x1; tx < range.x2; tx++) {
+			box.x1 = tx * RDP_TILE_SIZE;
+			box.x2 = box.x1 + RDP_TILE_SIZE;
+
+			if (pixman_region32_contains_rectangle(damage, &box) ==
+			    PIXMAN_REGION_OUT)
+				continue;
+
+			hash = &context->tile_hashes[ty * output->tiles_x + tx];
+			if (*hash == output->tile_hashes[ty * output->tiles_x + tx]) {
+				context->tiles_skipped++;
+				continue;
+			}
+
+			*hash = output->tile_hashes[ty * output->tiles_x + tx];
+			context->tiles_sent++;
+			pixman_region32_union_rect(&changed, &changed,
+						   box.x1, box.y1,
+						   RDP_TILE_SIZE, RDP_TILE_SIZE);
+		}
+	}
+
+	pixman_region32_intersect(&changed, &changed, damage);
+	context->bytes_saved += 4 * (region_area(damage) - region_area(&changed));
+
+	if (pixman_region32_not_empty(&changed))
+		rdp_peer_refresh_region(&changed, peer);
+
+	pixman_region32_fini(&changed);
+}
+
 static void
 rdp_output_start_repaint_loop(struct weston_output *output)
 {
@@ -311,12 +904,14 @@ rdp_output_repaint(struct weston_output *output_base, pixman_region32_t *damage)
 
 	pixman_renderer_output_set_buffer(output_base, output->shadow_surface);
 	ec->renderer->repaint_output(&output->base, damage);
+	if (output->tile_hashes)
+		rdp_output_hash_tiles(output, damage);
 
 	wl_list_for_each(outputPeer, &output->peers, link) {
 		if ((outputPeer->flags & RDP_PEER_ACTIVATED) &&
 				(outputPeer->flags & RDP_PEER_OUTPUT_ENABLED))
 		{
-			rdp_peer_refresh_region(damage, outputPeer->peer);
+			rdp_peer_refresh_changed(damage, outputPeer->peer);
 		}
 	}
 
@@ -333,6 +928,7 @@ rdp_output_destroy(struct weston_output *output_base)
 	struct rdp_output *output = (struct rdp_output *)output_base;
 
 	wl_event_source_remove(output->finish_frame_timer);
+	free(output->tile_hashes);
 	free(output);
 }
 
@@ -380,6 +976,7 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode) {
 
 	pixman_renderer_output_destroy(output);
 	pixman_renderer_output_create(output);
+	pixman_renderer_output_set_direct(output, 1);
 
 	new_shadow_buffer = pixman_image_create_bits(PIXMAN_x8r8g8b8, target_mode->width,
 			target_mode->height, 0, target_mode->width * 4);
@@ -387,6 +984,8 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode) {
 			0, 0, 0, 0, 0, 0, target_mode->width, target_mode->height);
 	pixman_image_unref(rdpOutput->shadow_surface);
 	rdpOutput->shadow_surface = new_shadow_buffer;
+	if (rdp_output_init_tiles(rdpOutput) < 0)
+		weston_log("failed to allocate RDP tile hashes\n");
 
 	wl_list_for_each(rdpPeer, &rdpOutput->peers, link) {
 		settings = rdpPeer->peer->settings;
@@ -483,8 +1082,12 @@ rdp_compositor_create_output(struct rdp_compositor *c, int width, int height,
 		goto out_output;
 	}
 
+	if (rdp_output_init_tiles(output) < 0)
+		goto out_shadow_surface;
+
 	if (pixman_renderer_output_create(&output->base) < 0)
 		goto out_shadow_surface;
+	pixman_renderer_output_set_direct(&output->base, 1);
 
 	weston_output_move(&output->base, 0, 0);
 
@@ -504,6 +1107,7 @@ rdp_compositor_create_output(struct rdp_compositor *c, int width, int height,
 	return 0;
 
 out_shadow_surface:
+	free(output->tile_hashes);
 	pixman_image_unref(output->shadow_surface);
 out_output:
 	weston_output_destroy(&output->base);
@@ -523,6 +1127,9 @@ rdp_restore(struct weston_compositor *ec)
 static void
 rdp_destroy(struct weston_compositor *ec)
 {
+	struct rdp_compositor *c = (struct rdp_compositor *) ec;
+
+	rdp_encoder_destroy(&c->encoder);
 	ec->renderer->destroy(ec);
 	weston_compositor_shutdown(ec);
 
@@ -574,16 +1181,7 @@ rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
 	context->item.peer = client;
 	context->item.flags = RDP_PEER_OUTPUT_ENABLED;
 
-	context->rfx_context = rfx_context_new();
-	context->rfx_context->mode = RLGR3;
-	context->rfx_context->width = client->settings->DesktopWidth;
-	context->rfx_context->height = client->settings->DesktopHeight;
-	rfx_context_set_pixel_format(context->rfx_context, RDP_PIXEL_FORMAT_B8G8R8A8);
-
-	context->nsc_context = nsc_context_new();
-	nsc_context_set_pixel_format(context->nsc_context, RDP_PIXEL_FORMAT_B8G8R8A8);
-
-	context->encode_stream = Stream_New(NULL, 65536);
+	pixman_region32_init(&context->pending);
 }
 
 static void
@@ -601,10 +1199,27 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 
 	if(context->item.flags & RDP_PEER_ACTIVATED)
 		weston_seat_release(&context->item.seat);
-	Stream_Free(context->encode_stream, TRUE);
-	nsc_context_free(context->nsc_context);
-	rfx_context_free(context->rfx_context);
-	free(context->rfx_rects);
+
+	rdp_peer_encode_cancel(context);
+	pixman_region32_fini(&context->pending);
+
+	if (context->tiles_sent || context->tiles_skipped)
+		weston_log("RDP peer %p: %llu of %llu damaged tiles unchanged, "
+			   "%llu KiB of pixels not encoded\n", client,
+			   (unsigned long long) context->tiles_skipped,
+			   (unsigned long long) (context->tiles_sent +
+						 context->tiles_skipped),
+			   (unsigned long long) context->bytes_saved / 1024);
+	free(context->tile_hashes);
+
+	for (i = 0; i < RDP_MAX_ENCODER_THREADS; i++) {
+		if (context->encode_streams[i])
+			Stream_Free(context->encode_streams[i], TRUE);
+		if (context->nsc_contexts[i])
+			nsc_context_free(context->nsc_contexts[i]);
+		if (context->rfx_contexts[i])
+			rfx_context_free(context->rfx_contexts[i]);
+	}
 }
 
 
@@ -744,6 +1359,7 @@ xf_peer_post_connect(freerdp_peer* client)
 	pixman_region32_init_with_extents(&damage, &box);
 
 	rdp_peer_refresh_region(&damage, client);
+	rdp_peer_reset_tiles(peerCtx, output, 1);
 
 	pixman_region32_fini(&damage);
 
@@ -754,7 +1370,22 @@ static BOOL
 xf_peer_activate(freerdp_peer *client)
 {
 	RdpPeerContext *context = (RdpPeerContext *)client->context;
-	rfx_context_reset(context->rfx_context);
+	rdpSettings *settings = client->settings;
+	RFX_CONTEXT *rfx;
+	int i;
+
+	/* Nothing encoded against the old codec state may go out, and
+	 * every band starts over with the RemoteFX headers. */
+	rdp_peer_encode_cancel(context);
+	for (i = 0; i < RDP_MAX_ENCODER_THREADS; i++) {
+		rfx = context->rfx_contexts[i];
+		if (!rfx)
+			continue;
+		rfx->width = settings->DesktopWidth;
+		rfx->height = settings->DesktopHeight;
+		rfx_context_reset(rfx);
+	}
+	rdp_peer_encode_pending(context);
 	return TRUE;
 }
 
@@ -838,6 +1469,7 @@ xf_input_synchronize_event(rdpInput *input, UINT32 flags)
 	pixman_region32_init_with_extents(&damage, &box);
 
 	rdp_peer_refresh_region(&damage, client);
+	rdp_peer_reset_tiles(peerCtx, output, 1);
 
 	pixman_region32_fini(&damage);
 }
@@ -992,7 +1624,7 @@ rdp_compositor_create(struct wl_display *display,
 {
 	struct rdp_compositor *c;
 	char *fd_str;
-	int fd;
+	int fd, threads;
 
 	c = zalloc(sizeof *c);
 	if (c == NULL)
@@ -1018,8 +1650,19 @@ rdp_compositor_create(struct wl_display *display,
 	if (pixman_renderer_init(&c->base) < 0)
 		goto err_compositor;
 
-	if (rdp_compositor_create_output(c, config->width, config->height, config->extra_modes) < 0)
+	threads = config->encoder_threads;
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > RDP_MAX_ENCODER_THREADS)
+		threads = RDP_MAX_ENCODER_THREADS;
+	if (threads < 1)
+		threads = 1;
+	if (rdp_encoder_init(c, threads) < 0)
 		goto err_compositor;
+	weston_log("RDP encoding with %d threads\n", threads);
+
+	if (rdp_compositor_create_output(c, config->width, config->height, config->extra_modes) < 0)
+		goto err_encoder;
 
 	if(!config->env_socket) {
 		c->listener = freerdp_listener_new();
@@ -1031,7 +1674,7 @@ rdp_compositor_create(struct wl_display *display,
 		}
 
 		if (rdp_implant_listener(c, c->listener) < 0)
-			goto err_compositor;
+			goto err_encoder;
 	} else {
 		/* get the socket from RDP_FD var */
 		fd_str = getenv("RDP_FD");
@@ -1051,6 +1694,8 @@ err_listener:
 	freerdp_listener_free(c->listener);
 err_output:
 	weston_output_destroy(&c->output->base);
+err_encoder:
+	rdp_encoder_destroy(&c->encoder);
 err_compositor:
 	weston_compositor_shutdown(&c->base);
 err_free_strings:
@@ -1086,7 +1731,8 @@ backend_init(struct wl_display *display, int *argc, char *argv[],
 		{ WESTON_OPTION_INTEGER, "port", 0, &config.port },
 		{ WESTON_OPTION_STRING,  "rdp4-key", 0, &config.rdp_key },
 		{ WESTON_OPTION_STRING,  "rdp-tls-cert", 0, &config.server_cert },
-		{ WESTON_OPTION_STRING,  "rdp-tls-key", 0, &config.server_key }
+		{ WESTON_OPTION_STRING,  "rdp-tls-key", 0, &config.server_key },
+		{ WESTON_OPTION_INTEGER, "encoder-threads", 0, &config.encoder_threads }
 	};
 
 	parse_options(rdp_options, ARRAY_LENGTH(rdp_options), argc, argv);
@@ -908,6 +908,8 @@ x11_compositor_create_output(struct x11_compositor *c, int x, int y,
 			x11_output_deinit_shm(c, output);
 			return NULL;
 		}
+		/* the shm image is copied out synchronously on repaint */
+		pixman_renderer_output_set_direct(&output->base, 1);
 	} else {
 		if (gl_renderer_output_create(&output->base, (EGLNativeWindowType)output->window) < 0)
 			return NULL;
@@ -53,6 +53,8 @@
 #endif
 
 #include "compositor.h"
+#include "repaint-stats.h"
+#include "trace.h"
 #include "subsurface-server-protocol.h"
 #include "../shared/os-compatibility.h"
 #include "git-version.h"
@@ -362,6 +364,8 @@ weston_surface_create(struct weston_compositor *compositor)
 
 	wl_list_init(&surface->link);
 	wl_list_init(&surface->layer_link);
+	wl_list_init(&surface->transform.dirty_link);
+	wl_list_init(&surface->pick_link);
 
 	surface->compositor = compositor;
 	surface->alpha = 1.0;
@@ -386,6 +390,8 @@ weston_surface_create(struct weston_compositor *compositor)
 	region_init_infinite(&surface->input);
 	pixman_region32_init(&surface->transform.opaque);
 	wl_list_init(&surface->frame_callback_list);
+	wl_list_init(&surface->frame_pending_link);
+	surface->visibility = WESTON_SURFACE_VISIBLE;
 
 	wl_list_init(&surface->geometry.transformation_list);
 	wl_list_insert(&surface->geometry.transformation_list,
@@ -646,6 +652,13 @@ weston_surface_assign_output(struct weston_surface *es)
 	}
 	pixman_region32_fini(&region);
 
+	wl_list_for_each(output, &ec->output_list, link) {
+		if ((es->output_mask ^ mask) & (1 << output->id) ||
+		    (es->output != new_output &&
+		     (output == es->output || output == new_output)))
+			output->surface_view_dirty = 1;
+	}
+
 	es->output = new_output;
 	weston_surface_update_output_mask(es, mask);
 }
@@ -775,6 +788,8 @@ weston_surface_update_transform(struct weston_surface *surface)
 		weston_surface_update_transform(parent);
 
 	surface->transform.dirty = 0;
+	wl_list_remove(&surface->transform.dirty_link);
+	wl_list_init(&surface->transform.dirty_link);
 
 	weston_surface_damage_below(surface);
 
@@ -797,6 +812,7 @@ weston_surface_update_transform(struct weston_surface *surface)
 	weston_surface_damage_below(surface);
 
 	weston_surface_assign_output(surface);
+	weston_pick_index_surface_moved(surface);
 
 	wl_signal_emit(&surface->compositor->transform_signal, surface);
 }
@@ -817,6 +833,9 @@ weston_surface_geometry_dirty(struct weston_surface *surface)
 		return;
 
 	surface->transform.dirty = 1;
+	wl_list_insert(&surface->compositor->transform_dirty_list,
+		       &surface->transform.dirty_link);
+	weston_pick_index_surface_moved(surface);
 
 	wl_list_for_each(child, &surface->geometry.child_list,
 			 geometry.parent_link)
@@ -1019,25 +1038,6 @@ weston_compositor_get_time(void)
        return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
-WL_EXPORT struct weston_surface *
-weston_compositor_pick_surface(struct weston_compositor *compositor,
-			       wl_fixed_t x, wl_fixed_t y,
-			       wl_fixed_t *sx, wl_fixed_t *sy)
-{
-	struct weston_surface *surface;
-
-	wl_list_for_each(surface, &compositor->surface_list, link) {
-		weston_surface_from_global_fixed(surface, x, y, sx, sy);
-		if (pixman_region32_contains_point(&surface->input,
-						   wl_fixed_to_int(*sx),
-						   wl_fixed_to_int(*sy),
-						   NULL))
-			return surface;
-	}
-
-	return NULL;
-}
-
 static void
 weston_compositor_repick(struct weston_compositor *compositor)
 {
@@ -1058,9 +1058,11 @@ weston_surface_unmap(struct weston_surface *surface)
 	weston_surface_damage_below(surface);
 	surface->output = NULL;
 	surface->plane = NULL;
-	wl_list_remove(&surface->layer_link);
+	weston_layer_entry_remove(surface);
 	wl_list_remove(&surface->link);
 	wl_list_init(&surface->link);
+	surface->compositor->surface_list_dirty = 1;
+	surface->compositor->pick_index.dirty = 1;
 
 	wl_list_for_each(seat, &surface->compositor->seat_list, link) {
 		if (seat->keyboard && seat->keyboard->focus == surface)
@@ -1124,8 +1126,18 @@ weston_surface_destroy(struct weston_surface *surface)
 
 	wl_list_for_each_safe(cb, next, &surface->frame_callback_list, link)
 		wl_resource_destroy(cb->resource);
+	wl_list_remove(&surface->frame_pending_link);
 
+	if (!wl_list_empty(&surface->link)) {
+		wl_list_remove(&surface->link);
+		compositor->surface_list_dirty = 1;
+		compositor->pick_index.dirty = 1;
+	}
+
+	/* This dirties the geometry, so unlink from the dirty list after. */
 	weston_surface_set_transform_parent(surface, NULL);
+	wl_list_remove(&surface->transform.dirty_link);
+	wl_list_remove(&surface->pick_link);
 
 	free(surface);
 }
@@ -1148,7 +1160,7 @@ weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 	free(buffer);
 }
 
-struct weston_buffer *
+WL_EXPORT struct weston_buffer *
 weston_buffer_from_resource(struct wl_resource *resource)
 {
 	struct weston_buffer *buffer;
@@ -1194,6 +1206,8 @@ weston_buffer_reference(struct weston_buffer_reference *ref,
 		ref->buffer->busy_count--;
 		if (ref->buffer->busy_count == 0) {
 			assert(wl_resource_get_client(ref->buffer->resource));
+			weston_trace_instant("buffer-release",
+					     weston_trace_id(ref->buffer), 0);
 			wl_resource_queue_event(ref->buffer->resource,
 						WL_BUFFER_RELEASE);
 		}
@@ -1224,11 +1238,22 @@ weston_surface_attach(struct weston_surface *surface,
 	surface->compositor->renderer->attach(surface, buffer);
 }
 
+/* Drop the core and renderer references to the surface contents,
+ * without unmapping it.  Used by shells to free the memory of surfaces
+ * that are not displayed; nothing is drawn for the surface until the
+ * client attaches a new buffer. */
+WL_EXPORT void
+weston_surface_release_buffer(struct weston_surface *surface)
+{
+	weston_buffer_reference(&surface->buffer_ref, NULL);
+	surface->compositor->renderer->attach(surface, NULL);
+}
+
 WL_EXPORT void
 weston_surface_restack(struct weston_surface *surface, struct wl_list *below)
 {
-	wl_list_remove(&surface->layer_link);
-	wl_list_insert(below, &surface->layer_link);
+	weston_layer_entry_remove(surface);
+	weston_layer_entry_insert(below, surface);
 	weston_surface_damage_below(surface);
 	weston_surface_damage(surface);
 }
@@ -1353,20 +1378,211 @@ surface_list_add(struct weston_compositor *compositor,
 	}
 }
 
+static int
+weston_compositor_update_layer_order(struct weston_compositor *compositor)
+{
+	struct weston_layer *layer, **order;
+	size_t count = 0;
+	int changed = 0;
+
+	order = compositor->layer_order.data;
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		if ((count + 1) * sizeof *order > compositor->layer_order.size ||
+		    order[count] != layer)
+			changed = 1;
+		count++;
+	}
+
+	if (!changed && count * sizeof *order == compositor->layer_order.size)
+		return 0;
+
+	/* On allocation failure the comparison fails again next time
+	 * and we simply keep rebuilding. */
+	compositor->layer_order.size = 0;
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		order = wl_array_add(&compositor->layer_order, sizeof *order);
+		if (order == NULL)
+			break;
+		*order = layer;
+	}
+
+	return 1;
+}
+
+/*
+ * compositor->surface_list is only rebuilt when something marked it
+ * dirty: a layer entry insert or remove, a restack, unmap, subsurface
+ * reorder, or a change to the layer list itself. Otherwise only the
+ * surfaces with pending geometry changes get their transform updated.
+ */
 static void
 weston_compositor_build_surface_list(struct weston_compositor *compositor)
 {
 	struct weston_surface *surface;
 	struct weston_layer *layer;
+	struct weston_output *output;
 
-	wl_list_init(&compositor->surface_list);
-	wl_list_for_each(layer, &compositor->layer_list, link) {
-		wl_list_for_each(surface, &layer->surface_list, layer_link) {
-			surface_list_add(compositor, surface);
+	if (weston_compositor_update_layer_order(compositor))
+		compositor->surface_list_dirty = 1;
+
+	if (compositor->surface_list_dirty) {
+		/* Surfaces that drop out must not keep stale links. */
+		wl_list_for_each_safe(surface, next,
+				      &compositor->surface_list, link)
+			wl_list_init(&surface->link);
+
+		wl_list_init(&compositor->surface_list);
+		wl_list_for_each(layer, &compositor->layer_list, link) {
+			wl_list_for_each(surface, &layer->surface_list,
+					 layer_link) {
+				surface_list_add(compositor, surface);
+			}
 		}
+
+		compositor->surface_list_dirty = 0;
+		compositor->pick_index.dirty = 1;
+		wl_list_for_each(output, &compositor->output_list, link)
+			output->surface_view_dirty = 1;
+	}
+
+	/* Updating a surface also updates its parents, which unlinks
+	 * them from anywhere in the list, so always take the head. */
+	while (!wl_list_empty(&compositor->transform_dirty_list)) {
+		surface = container_of(compositor->transform_dirty_list.next,
+				       struct weston_surface,
+				       transform.dirty_link);
+		wl_list_remove(&surface->transform.dirty_link);
+		wl_list_init(&surface->transform.dirty_link);
+
+		/* Surfaces outside the list are updated when added. */
+		if (!wl_list_empty(&surface->link))
+			weston_surface_update_transform(surface);
 	}
 }
 
+static void
+weston_output_update_surface_view(struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_surface *es, **entry;
+
+	if (!output->surface_view_dirty)
+		return;
+
+	output->surface_view.size = 0;
+	wl_list_for_each(es, &ec->surface_list, link) {
+		if (!(es->output_mask & (1 << output->id)) &&
+		    es->output != output)
+			continue;
+
+		entry = wl_array_add(&output->surface_view, sizeof *entry);
+		if (entry == NULL) {
+			weston_log("out of memory building surface view\n");
+			return;
+		}
+		*entry = es;
+	}
+
+	output->surface_view_dirty = 0;
+}
+
+WL_EXPORT enum weston_surface_visibility
+weston_surface_get_visibility(struct weston_surface *surface)
+{
+	if (wl_list_empty(&surface->link))
+		return WESTON_SURFACE_HIDDEN;
+
+	return surface->visibility;
+}
+
+static void
+weston_surface_update_visibility(struct weston_surface *surface)
+{
+	pixman_region32_t uncovered;
+
+	/* surface->clip is the opaque region stacked above us, as
+	 * computed by compositor_accumulate_damage(). */
+	pixman_region32_init(&uncovered);
+	pixman_region32_subtract(&uncovered, &surface->transform.boundingbox,
+				 &surface->clip);
+
+	if (pixman_region32_not_empty(&uncovered))
+		surface->visibility = WESTON_SURFACE_VISIBLE;
+	else
+		surface->visibility = WESTON_SURFACE_OCCLUDED;
+
+	pixman_region32_fini(&uncovered);
+}
+
+static void
+weston_surface_queue_frame(struct weston_surface *surface)
+{
+	struct weston_compositor *ec = surface->compositor;
+
+	if (!ec->frame_throttle.enabled ||
+	    wl_list_empty(&surface->frame_callback_list) ||
+	    !wl_list_empty(&surface->frame_pending_link))
+		return;
+
+	/* The timer runs exactly while the pending list is non-empty. */
+	if (wl_list_empty(&ec->frame_throttle.pending_list) &&
+	    ec->frame_throttle.period > 0)
+		wl_event_source_timer_update(ec->frame_throttle.timer,
+					     ec->frame_throttle.period);
+
+	surface->frame_pending_time = weston_compositor_get_time();
+	wl_list_insert(ec->frame_throttle.pending_list.prev,
+		       &surface->frame_pending_link);
+}
+
+static int
+frame_throttle_handler(void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_surface *es, *next;
+	struct weston_frame_callback *cb, *cnext;
+	uint32_t now = weston_compositor_get_time();
+
+	wl_list_for_each_safe(es, next, &ec->frame_throttle.pending_list,
+			      frame_pending_link) {
+		/* Visible surfaces get their callbacks on repaint. */
+		if (weston_surface_get_visibility(es) ==
+		    WESTON_SURFACE_VISIBLE)
+			continue;
+
+		if (now - es->frame_pending_time < ec->frame_throttle.period)
+			continue;
+
+		weston_trace_instant("frame-done-throttled",
+				     weston_trace_id(es), 0);
+
+		wl_list_for_each_safe(cb, cnext,
+				      &es->frame_callback_list, link) {
+			wl_callback_send_done(cb->resource, now);
+			wl_resource_destroy(cb->resource);
+		}
+
+		wl_list_remove(&es->frame_pending_link);
+		wl_list_init(&es->frame_pending_link);
+	}
+
+	if (!wl_list_empty(&ec->frame_throttle.pending_list))
+		wl_event_source_timer_update(ec->frame_throttle.timer,
+					     ec->frame_throttle.period);
+
+	return 1;
+}
+
+/* Closes a phase of weston_output_repaint() and opens the next. */
+static void
+repaint_phase_done(struct weston_output *output, enum repaint_phase phase)
+{
+	repaint_stats_mark(output->repaint_stats, phase);
+	weston_trace_end(repaint_phase_names[phase], output->id);
+	if (phase + 1 < REPAINT_PHASE_TOTAL)
+		weston_trace_begin(repaint_phase_names[phase + 1], output->id);
+}
+
 static int
 weston_output_repaint(struct weston_output *output, uint32_t msecs)
 {
@@ -1375,28 +1591,54 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 	struct weston_animation *animation, *next;
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
+	struct weston_surface **view;
 	pixman_region32_t output_damage;
+	size_t i, count;
 	int r;
 
-	/* Rebuild the surface list and update surface transforms up front. */
+	repaint_stats_begin(output->repaint_stats);
+	weston_trace_begin("repaint", output->id);
+	weston_trace_begin(repaint_phase_names[0], output->id);
+
+	/* Bring the surface list and surface transforms up to date. */
 	weston_compositor_build_surface_list(ec);
+	weston_output_update_surface_view(output);
+	repaint_phase_done(output, REPAINT_PHASE_SURFACE_LIST);
 
 	if (output->assign_planes && !output->disable_planes)
 		output->assign_planes(output);
 	else
 		wl_list_for_each(es, &ec->surface_list, link)
 			weston_surface_move_to_plane(es, &ec->primary_plane);
+	repaint_phase_done(output, REPAINT_PHASE_ASSIGN_PLANES);
+
+	compositor_accumulate_damage(ec);
 
 	wl_list_init(&frame_callback_list);
-	wl_list_for_each(es, &ec->surface_list, link) {
-		if (es->output == output) {
-			wl_list_insert_list(&frame_callback_list,
-					    &es->frame_callback_list);
-			wl_list_init(&es->frame_callback_list);
-		}
-	}
+	view = output->surface_view.data;
+	count = output->surface_view.size / sizeof *view;
+	for (i = 0; i < count; i++) {
+		es = view[i];
+		weston_surface_update_visibility(es);
 
-	compositor_accumulate_damage(ec);
+		if (es->output != output)
+			continue;
+
+		/* Fully covered surfaces are left to the throttle timer. */
+		if (ec->frame_throttle.enabled &&
+		    es->visibility == WESTON_SURFACE_OCCLUDED)
+			continue;
+
+		if (!wl_list_empty(&es->frame_callback_list))
+			weston_trace_instant("frame-done", weston_trace_id(es),
+					     output->id);
+		wl_list_insert_list(&frame_callback_list,
+				    &es->frame_callback_list);
+		wl_list_init(&es->frame_callback_list);
+		wl_list_remove(&es->frame_pending_link);
+		wl_list_init(&es->frame_pending_link);
+	}
+	repaint_phase_done(output, REPAINT_PHASE_DAMAGE);
 
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
@@ -1412,19 +1654,25 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 	pixman_region32_fini(&output_damage);
 
 	output->repaint_needed = 0;
+	repaint_phase_done(output, REPAINT_PHASE_RENDER);
 
 	weston_compositor_repick(ec);
 	wl_event_loop_dispatch(ec->input_loop, 0);
+	repaint_phase_done(output, REPAINT_PHASE_INPUT);
 
 	wl_list_for_each_safe(cb, cnext, &frame_callback_list, link) {
 		wl_callback_send_done(cb->resource, msecs);
 		wl_resource_destroy(cb->resource);
 	}
+	repaint_phase_done(output, REPAINT_PHASE_FRAME_CALLBACKS);
 
 	wl_list_for_each_safe(animation, next, &output->animation_list, link) {
 		animation->frame_counter++;
 		animation->frame(animation, output, msecs);
 	}
+	repaint_phase_done(output, REPAINT_PHASE_ANIMATIONS);
+	repaint_stats_end(output->repaint_stats);
+	weston_trace_end("repaint", output->id);
 
 	return r;
 }
@@ -1447,6 +1695,8 @@ weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
 		wl_display_get_event_loop(compositor->wl_display);
 	int fd, r;
 
+	weston_trace_instant("finish-frame", output->id, msecs);
+
 	output->frame_time = msecs;
 
 	if (output->repaint_needed &&
@@ -1483,6 +1733,24 @@ weston_layer_init(struct weston_layer *layer, struct wl_list *below)
 		wl_list_insert(below, &layer->link);
 }
 
+/* Layer entries must be inserted and removed through these, so that
+ * the compositor knows to rebuild its surface list. The layer list
+ * itself is checked for changes on every repaint. */
+WL_EXPORT void
+weston_layer_entry_insert(struct wl_list *pos, struct weston_surface *surface)
+{
+	wl_list_insert(pos, &surface->layer_link);
+	surface->compositor->surface_list_dirty = 1;
+}
+
+WL_EXPORT void
+weston_layer_entry_remove(struct weston_surface *surface)
+{
+	wl_list_remove(&surface->layer_link);
+	wl_list_init(&surface->layer_link);
+	surface->compositor->surface_list_dirty = 1;
+}
+
 WL_EXPORT void
 weston_output_schedule_repaint(struct weston_output *output)
 {
@@ -1530,6 +1798,10 @@ surface_attach(struct wl_client *client,
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
 	struct weston_buffer *buffer = NULL;
 
+	weston_trace_instant("attach", weston_trace_id(surface),
+			     buffer_resource ?
+			     wl_resource_get_id(buffer_resource) : 0);
+
 	if (buffer_resource) {
 		buffer = weston_buffer_from_resource(buffer_resource);
 		if (buffer == NULL) {
@@ -1636,11 +1908,38 @@ surface_set_input_region(struct wl_client *client,
 	}
 }
 
+static int
+weston_surface_subsurface_order_changed(struct weston_surface *surface)
+{
+	struct wl_list *cur = surface->subsurface_list.next;
+	struct wl_list *pending = surface->subsurface_list_pending.next;
+
+	while (cur != &surface->subsurface_list &&
+	       pending != &surface->subsurface_list_pending) {
+		if (container_of(cur, struct weston_subsurface,
+				 parent_link) !=
+		    container_of(pending, struct weston_subsurface,
+				 parent_link_pending))
+			return 1;
+
+		cur = cur->next;
+		pending = pending->next;
+	}
+
+	return cur != &surface->subsurface_list ||
+	       pending != &surface->subsurface_list_pending;
+}
+
 static void
 weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
 
+	if (!weston_surface_subsurface_order_changed(surface))
+		return;
+
+	surface->compositor->surface_list_dirty = 1;
+
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
@@ -1651,10 +1950,12 @@ weston_surface_commit_subsurface_order(struct weston_surface *surface)
 static void
 weston_surface_commit(struct weston_surface *surface)
 {
-	pixman_region32_t opaque;
+	pixman_region32_t opaque, input;
 	int surface_width = 0;
 	int surface_height = 0;
 
+	weston_trace_begin("commit", weston_trace_id(surface));
+
 	/* wl_surface.set_buffer_transform */
 	surface->buffer_transform = surface->pending.buffer_transform;
 
@@ -1706,21 +2007,29 @@ weston_surface_commit(struct weston_surface *surface)
 	pixman_region32_fini(&opaque);
 
 	/* wl_surface.set_input_region */
-	pixman_region32_fini(&surface->input);
-	pixman_region32_init_rect(&surface->input, 0, 0,
+	pixman_region32_init_rect(&input, 0, 0,
 				  surface->geometry.width,
 				  surface->geometry.height);
-	pixman_region32_intersect(&surface->input,
-				  &surface->input, &surface->pending.input);
+	pixman_region32_intersect(&input, &input, &surface->pending.input);
+
+	if (!pixman_region32_equal(&input, &surface->input)) {
+		pixman_region32_copy(&surface->input, &input);
+		weston_pick_index_surface_moved(surface);
+	}
+
+	pixman_region32_fini(&input);
 
 	/* wl_surface.frame */
 	wl_list_insert_list(&surface->frame_callback_list,
 			    &surface->pending.frame_callback_list);
 	wl_list_init(&surface->pending.frame_callback_list);
+	weston_surface_queue_frame(surface);
 
 	weston_surface_commit_subsurface_order(surface);
 
 	weston_surface_schedule_repaint(surface);
+
+	weston_trace_end("commit", weston_trace_id(surface));
 }
 
 static void
@@ -1736,6 +2045,8 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
 	struct weston_subsurface *sub = weston_surface_to_subsurface(surface);
 
+	weston_trace_instant("client-commit", weston_trace_id(surface), 0);
+
 	if (sub) {
 		weston_subsurface_commit(sub);
 		return;
@@ -1882,7 +2193,7 @@ static void
 weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 {
 	struct weston_surface *surface = sub->surface;
-	pixman_region32_t opaque;
+	pixman_region32_t opaque, input;
 	int surface_width = 0;
 	int surface_height = 0;
 
@@ -1933,17 +2244,23 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 	pixman_region32_fini(&opaque);
 
 	/* wl_surface.set_input_region */
-	pixman_region32_fini(&surface->input);
-	pixman_region32_init_rect(&surface->input, 0, 0,
+	pixman_region32_init_rect(&input, 0, 0,
 				  surface->geometry.width,
 				  surface->geometry.height);
-	pixman_region32_intersect(&surface->input,
-				  &surface->input, &sub->cached.input);
+	pixman_region32_intersect(&input, &input, &sub->cached.input);
+
+	if (!pixman_region32_equal(&input, &surface->input)) {
+		pixman_region32_copy(&surface->input, &input);
+		weston_pick_index_surface_moved(surface);
+	}
+
+	pixman_region32_fini(&input);
 
 	/* wl_surface.frame */
 	wl_list_insert_list(&surface->frame_callback_list,
 			    &sub->cached.frame_callback_list);
 	wl_list_init(&sub->cached.frame_callback_list);
+	weston_surface_queue_frame(surface);
 
 	weston_surface_commit_subsurface_order(surface);
 
@@ -2102,6 +2419,7 @@ subsurface_configure(struct weston_surface *surface, int32_t dx, int32_t dy,
 		assert(!wl_list_empty(&compositor->output_list));
 		surface->output = container_of(compositor->output_list.next,
 					       struct weston_output, link);
+		compositor->surface_list_dirty = 1;
 	}
 }
 
@@ -2277,6 +2595,7 @@ weston_subsurface_cache_fini(struct weston_subsurface *sub)
 static void
 weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 {
+	sub->parent->compositor->surface_list_dirty = 1;
 	wl_list_remove(&sub->parent_link);
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
@@ -2343,6 +2662,7 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	parent->compositor->surface_list_dirty = 1;
 }
 
 static void
@@ -2379,6 +2699,7 @@ weston_subsurface_destroy(struct weston_subsurface *sub)
 		assert(sub->parent_destroy_listener.notify == NULL);
 		wl_list_remove(&sub->parent_link);
 		wl_list_remove(&sub->parent_link_pending);
+		sub->surface->compositor->surface_list_dirty = 1;
 	}
 
 	wl_list_remove(&sub->surface_destroy_listener.link);
@@ -2441,6 +2762,7 @@ weston_subsurface_create_for_parent(struct weston_surface *parent)
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	parent->compositor->surface_list_dirty = 1;
 
 	return sub;
 }
@@ -2707,6 +3029,10 @@ weston_output_destroy(struct weston_output *output)
 {
 	wl_signal_emit(&output->destroy_signal, output);
 
+	output->compositor->surface_list_dirty = 1;
+	output->compositor->pick_index.dirty = 1;
+	wl_array_release(&output->surface_view);
+	free(output->repaint_stats);
 	free(output->name);
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
@@ -2846,6 +3172,7 @@ weston_output_move(struct weston_output *output, int x, int y)
 	pixman_region32_init_rect(&output->region, x, y,
 				  output->width,
 				  output->height);
+	output->compositor->pick_index.dirty = 1;
 }
 
 WL_EXPORT void
@@ -2875,6 +3202,11 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	wl_signal_init(&output->destroy_signal);
 	wl_list_init(&output->animation_list);
 	wl_list_init(&output->resource_list);
+	wl_array_init(&output->surface_view);
+	output->surface_view_dirty = 1;
+#ifdef ENABLE_REPAINT_STATS
+	output->repaint_stats = zalloc(sizeof *output->repaint_stats);
+#endif
 
 	output->id = ffs(~output->compositor->output_id_pool) - 1;
 	output->compositor->output_id_pool |= 1 << output->id;
@@ -2988,6 +3320,67 @@ weston_environment_get_fd(const char *env)
 	return fd;
 }
 
+#ifdef ENABLE_REPAINT_STATS
+static void
+repaint_stats_write_file(struct weston_compositor *ec)
+{
+	struct weston_output *output;
+	char name[16];
+	FILE *fp;
+
+	if (!ec->repaint_stats_file)
+		return;
+
+	fp = fopen(ec->repaint_stats_file, "w");
+	if (!fp) {
+		weston_log("failed to open %s: %m\n", ec->repaint_stats_file);
+		return;
+	}
+
+	fprintf(fp, "# output\tphase\tframes\tmean\tp50\tp99\tmax\n");
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (!output->repaint_stats)
+			continue;
+		snprintf(name, sizeof name, "%d", output->id);
+		repaint_stats_print(output->repaint_stats, fp,
+				    output->name ? output->name : name);
+	}
+
+	fclose(fp);
+}
+
+/* Logs the repaint timings of every output, writes them to the stats
+ * file if one is configured, and starts over. */
+static void
+repaint_stats_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		      void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_output *output;
+	const struct repaint_histogram *h;
+	int i;
+
+	repaint_stats_write_file(ec);
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (!output->repaint_stats)
+			continue;
+		weston_log("repaint timings, output %d (us):\n", output->id);
+		for (i = 0; i < REPAINT_PHASE_COUNT; i++) {
+			h = &output->repaint_stats->phase[i];
+			weston_log_continue(STAMP_SPACE
+					    "%-16s frames %u p50 %u p99 %u "
+					    "max %u\n",
+					    repaint_phase_names[i], h->count,
+					    repaint_histogram_percentile(h, 50),
+					    repaint_histogram_percentile(h, 99),
+					    h->max);
+		}
+		repaint_stats_reset(output->repaint_stats);
+	}
+}
+#endif
+
 WL_EXPORT int
 weston_compositor_init(struct weston_compositor *ec,
 		       struct wl_display *display,
@@ -2997,6 +3390,7 @@ weston_compositor_init(struct weston_compositor *ec,
 	struct wl_event_loop *loop;
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
+	uint32_t frame_rate;
 
 	ec->config = config;
 	ec->wl_display = display;
@@ -3034,6 +3428,10 @@ weston_compositor_init(struct weston_compositor *ec,
 	wl_list_init(&ec->touch_binding_list);
 	wl_list_init(&ec->axis_binding_list);
 	wl_list_init(&ec->debug_binding_list);
+	wl_list_init(&ec->frame_throttle.pending_list);
+	wl_list_init(&ec->transform_dirty_list);
+	wl_array_init(&ec->layer_order);
+	weston_pick_index_init(ec);
 
 	weston_plane_init(&ec->primary_plane, ec, 0, 0);
 	weston_compositor_stack_plane(ec, &ec->primary_plane, NULL);
@@ -3053,6 +3451,24 @@ weston_compositor_init(struct weston_compositor *ec,
 	if (weston_compositor_xkb_init(ec, &xkb_names) < 0)
 		return -1;
 
+	s = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(s, "frame-throttle",
+				       &ec->frame_throttle.enabled, 1);
+	weston_config_section_get_uint(s, "background-frame-rate",
+				       &frame_rate, 1);
+	if (frame_rate > 1000)
+		frame_rate = 1000;
+	ec->frame_throttle.period = frame_rate > 0 ? 1000 / frame_rate : 0;
+	weston_config_section_get_string(s, "repaint-stats-file",
+					 &ec->repaint_stats_file, NULL);
+#ifdef ENABLE_TRACE
+	weston_trace_init(ec);
+#endif
+#ifdef ENABLE_REPAINT_STATS
+	weston_compositor_add_debug_binding(ec, KEY_T,
+					    repaint_stats_binding, ec);
+#endif
+
 	ec->ping_handler = NULL;
 
 	screenshooter_create(ec);
@@ -3066,6 +3482,8 @@ weston_compositor_init(struct weston_compositor *ec,
 	loop = wl_display_get_event_loop(ec->wl_display);
 	ec->idle_source = wl_event_loop_add_timer(loop, idle_handler, ec);
 	wl_event_source_timer_update(ec->idle_source, ec->idle_time * 1000);
+	ec->frame_throttle.timer =
+		wl_event_loop_add_timer(loop, frame_throttle_handler, ec);
 
 	ec->input_loop = wl_event_loop_create();
 
@@ -3083,9 +3501,14 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	struct weston_output *output, *next;
 
 	wl_event_source_remove(ec->idle_source);
+	wl_event_source_remove(ec->frame_throttle.timer);
 	if (ec->input_loop_source)
 		wl_event_source_remove(ec->input_loop_source);
 
+#ifdef ENABLE_REPAINT_STATS
+	repaint_stats_write_file(ec);
+#endif
+
 	/* Destroy all outputs associated with this compositor */
 	wl_list_for_each_safe(output, next, &ec->output_list, link)
 		output->destroy(output);
@@ -3099,6 +3522,12 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	weston_plane_release(&ec->primary_plane);
 
 	wl_event_loop_destroy(ec->input_loop);
+	wl_array_release(&ec->layer_order);
+	weston_pick_index_release(ec);
+	free(ec->repaint_stats_file);
+#ifdef ENABLE_TRACE
+	weston_trace_release(ec);
+#endif
 
 	weston_config_destroy(ec->config);
 }
@@ -3393,6 +3822,20 @@ usage(int error_code)
 		"  --output-count=COUNT\tCreate multiple outputs\n"
 		"  --no-input\t\tDont create input devices\n\n");
 
+	fprintf(stderr,
+		"Options for headless-backend.so:\n\n"
+		"  --width=WIDTH\t\tWidth of memory surface\n"
+		"  --height=HEIGHT\tHeight of memory surface\n"
+		"  --scale=SCALE\t\tScale factor of output\n"
+		"  --transform=TR\tThe output transformation, TR is one of:\n"
+		"\tnormal 90 180 270 flipped flipped-90 flipped-180 flipped-270\n"
+		"  --output-count=COUNT\tCreate multiple outputs\n"
+		"  --use-pixman\t\tUse the pixman (CPU) renderer\n"
+		"  --record=FILE\t\tRecord the first output to FILE (pixman)\n"
+		"  --repaint=MODE\tFrame pacing, MODE is one of:\n"
+		"\ttimer uncapped virtual\n"
+		"  --frame-step=MS\tFrame period of timer and virtual modes\n\n");
+
 	fprintf(stderr,
 		"Options for wayland-backend.so:\n\n"
 		"  --width=WIDTH\t\tWidth of Wayland surface\n"
@@ -3421,6 +3864,8 @@ usage(int error_code)
        "  --rdp4-key=FILE\tThe file containing the key for RDP4 encryption\n"
        "  --rdp-tls-cert=FILE\tThe file containing the certificate for TLS encryption\n"
        "  --rdp-tls-key=FILE\tThe file containing the private key for TLS encryption\n"
+       "  --encoder-threads=N\tThreads encoding RemoteFX and NSCodec updates,\n"
+       "\t\t\t0 for one per online CPU (the default)\n"
        "\n");
 #endif
 
@@ -59,6 +59,7 @@ struct weston_buffer;
 struct shell_surface;
 struct weston_seat;
 struct weston_output;
+struct repaint_stats;
 struct input_method;
 
 enum weston_keyboard_modifier {
@@ -206,6 +207,15 @@ struct weston_output {
 	uint32_t frame_time;
 	int disable_planes;
 
+	/* Surfaces of compositor->surface_list on this output, top to
+	 * bottom, as struct weston_surface pointers. Only valid during
+	 * weston_output_repaint(). */
+	struct wl_array surface_view;
+	int surface_view_dirty;
+
+	/* Per-phase repaint timings, NULL if compiled out. */
+	struct repaint_stats *repaint_stats;
+
 	char *make, *model, *serial_number;
 	uint32_t subpixel;
 	uint32_t transform;
@@ -591,8 +601,35 @@ struct weston_compositor {
 	uint32_t idle_inhibit;
 	int idle_time;			/* timeout, s */
 
+	/* Frame callbacks of surfaces that are not visible are not tied
+	 * to output repaints, but released at a low rate by a timer.
+	 */
+	struct {
+		int enabled;
+		uint32_t period;	/* ms, 0 to never release */
+		struct wl_list pending_list;	/* weston_surface::frame_pending_link */
+		struct wl_event_source *timer;
+	} frame_throttle;
+
+	char *repaint_stats_file;	/* written by the timing binding */
+
 	/* Repaint state. */
+	int surface_list_dirty;		/* rebuild surface_list on repaint */
+	struct wl_array layer_order;	/* layer_list as of the last rebuild */
+	struct wl_list transform_dirty_list;
 	struct weston_plane primary_plane;
+
+	/* Grid over the output area for picking, see pick-index.c. */
+	struct {
+		int dirty;		/* rebuild on the next pick */
+		int32_t x, y;		/* grid origin */
+		int32_t cols, rows;
+		struct wl_array *cells;	/* cols * rows, indices into surfaces */
+		struct wl_array surfaces;	/* surface_list snapshot */
+		struct wl_array boxes;	/* cells covered, per surface */
+		struct wl_array unbounded;	/* indices into surfaces */
+		struct wl_list moved;	/* weston_surface::pick_link */
+	} pick_index;
 	uint32_t capabilities; /* combination of enum weston_capability */
 
 	uint32_t focus;
@@ -723,6 +760,12 @@ struct weston_subsurface {
  *    Mparent * Mn * ... * M2 * M1
  */
 
+enum weston_surface_visibility {
+	WESTON_SURFACE_VISIBLE,		/* in surface_list, partly uncovered */
+	WESTON_SURFACE_OCCLUDED,	/* in surface_list, covered by opaque */
+	WESTON_SURFACE_HIDDEN		/* not in surface_list */
+};
+
 struct weston_surface {
 	struct wl_resource *resource;
 	struct wl_signal destroy_signal;
@@ -762,6 +805,7 @@ struct weston_surface {
 	 */
 	struct {
 		int dirty;
+		struct wl_list dirty_link; /* compositor transform_dirty_list */
 
 		pixman_region32_t boundingbox;
 		pixman_region32_t opaque;
@@ -776,6 +820,11 @@ struct weston_surface {
 		struct weston_transform position; /* matrix from x, y */
 	} transform;
 
+	/* Slot in the compositor pick_index, and the link in its moved
+	 * list while the surface's cells there are out of date. */
+	uint32_t pick_slot;
+	struct wl_list pick_link;
+
 	/*
 	 * Which output to vsync this surface to.
 	 * Used to determine, whether to send or queue frame events.
@@ -791,6 +840,11 @@ struct weston_surface {
 
 	struct wl_list frame_callback_list;
 
+	/* Frame callback throttling, see weston_surface_get_visibility(). */
+	enum weston_surface_visibility visibility;
+	struct wl_list frame_pending_link;
+	uint32_t frame_pending_time;
+
 	struct weston_buffer_reference buffer_ref;
 	uint32_t buffer_transform;
 	int32_t buffer_scale;
@@ -935,6 +989,12 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 void
 weston_layer_init(struct weston_layer *layer, struct wl_list *below);
 
+void
+weston_layer_entry_insert(struct wl_list *pos, struct weston_surface *surface);
+
+void
+weston_layer_entry_remove(struct weston_surface *surface);
+
 void
 weston_plane_init(struct weston_plane *plane,
 			struct weston_compositor *ec,
@@ -971,6 +1031,16 @@ struct weston_surface *
 weston_compositor_pick_surface(struct weston_compositor *compositor,
 			       wl_fixed_t x, wl_fixed_t y,
 			       wl_fixed_t *sx, wl_fixed_t *sy);
+struct weston_surface *
+weston_compositor_pick_surface_linear(struct weston_compositor *compositor,
+				      wl_fixed_t x, wl_fixed_t y,
+				      wl_fixed_t *sx, wl_fixed_t *sy);
+void
+weston_pick_index_init(struct weston_compositor *ec);
+void
+weston_pick_index_release(struct weston_compositor *ec);
+void
+weston_pick_index_surface_moved(struct weston_surface *surface);
 
 
 struct weston_binding;
@@ -1089,6 +1159,12 @@ weston_surface_move_to_plane(struct weston_surface *surface,
 void
 weston_surface_unmap(struct weston_surface *surface);
 
+void
+weston_surface_release_buffer(struct weston_surface *surface);
+
+enum weston_surface_visibility
+weston_surface_get_visibility(struct weston_surface *surface);
+
 struct weston_surface *
 weston_surface_get_main_surface(struct weston_surface *surface);
 
@@ -1192,6 +1268,12 @@ tty_activate_vt(struct tty *tty, int vt);
 void
 screenshooter_create(struct weston_compositor *ec);
 
+struct weston_recorder *
+weston_recorder_start(struct weston_output *output, const char *filename);
+
+void
+weston_recorder_stop(struct weston_recorder *recorder);
+
 struct clipboard *
 clipboard_create(struct weston_seat *seat);
 
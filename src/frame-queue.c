@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "frame-queue.h"
+
+void
+frame_queue_init(struct frame_queue *queue, int length)
+{
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	queue->length = length;
+	queue->head = 0;
+	queue->count = 0;
+	queue->quit = 0;
+}
+
+void
+frame_queue_release(struct frame_queue *queue)
+{
+	pthread_cond_destroy(&queue->cond);
+	pthread_mutex_destroy(&queue->mutex);
+}
+
+/* The slot the producer fills next, or -1 if all of them are queued.
+ * *queued is set to the number of frames waiting either way. */
+int
+frame_queue_tail(struct frame_queue *queue, int *queued)
+{
+	int slot = -1;
+
+	pthread_mutex_lock(&queue->mutex);
+	*queued = queue->count;
+	if (queue->count < queue->length)
+		slot = (queue->head + queue->count) % queue->length;
+	pthread_mutex_unlock(&queue->mutex);
+
+	return slot;
+}
+
+void
+frame_queue_push(struct frame_queue *queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+	queue->count++;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+/* Blocks until a frame is queued and returns its slot, which stays the
+ * consumer's until frame_queue_pop().  Returns -1 once the queue has
+ * been told to quit and is drained. */
+int
+frame_queue_wait(struct frame_queue *queue)
+{
+	int slot = -1;
+
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == 0 && !queue->quit)
+		pthread_cond_wait(&queue->cond, &queue->mutex);
+	if (queue->count > 0)
+		slot = queue->head;
+	pthread_mutex_unlock(&queue->mutex);
+
+	return slot;
+}
+
+void
+frame_queue_pop(struct frame_queue *queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+	queue->head = (queue->head + 1) % queue->length;
+	queue->count--;
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+void
+frame_queue_quit(struct frame_queue *queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+	queue->quit = 1;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+}
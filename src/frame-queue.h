@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_FRAME_QUEUE_H
+#define _WESTON_FRAME_QUEUE_H
+
+#include <pthread.h>
+
+/* A bounded queue between one producer and one consumer thread.
+ *
+ * The frames themselves live in an array owned by the user; the queue
+ * only hands out indices into it.  The producer fills the slot returned
+ * by frame_queue_tail() and publishes it with frame_queue_push().  The
+ * consumer gets the oldest slot from frame_queue_wait() and gives it
+ * back with frame_queue_pop().  Head and count are only ever read
+ * together under the mutex, so a slot handed to one side is never the
+ * one the other side is working on.
+ */
+
+struct frame_queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int length;
+	int head, count;
+	int quit;
+};
+
+void
+frame_queue_init(struct frame_queue *queue, int length);
+
+void
+frame_queue_release(struct frame_queue *queue);
+
+int
+frame_queue_tail(struct frame_queue *queue, int *queued);
+
+void
+frame_queue_push(struct frame_queue *queue);
+
+int
+frame_queue_wait(struct frame_queue *queue);
+
+void
+frame_queue_pop(struct frame_queue *queue);
+
+void
+frame_queue_quit(struct frame_queue *queue);
+
+#endif
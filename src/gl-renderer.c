@@ -563,11 +563,13 @@ static void
 repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
-	struct weston_surface *surface;
+	struct weston_surface **view = output->surface_view.data;
+	size_t i = output->surface_view.size / sizeof *view;
 
-	wl_list_for_each_reverse(surface, &compositor->surface_list, link)
-		if (surface->plane == &compositor->primary_plane)
-			draw_surface(surface, output, damage);
+	/* Bottom to top, only the surfaces on this output. */
+	while (i-- > 0)
+		if (view[i]->plane == &compositor->primary_plane)
+			draw_surface(view[i], output, damage);
 }
 
 
@@ -32,6 +32,7 @@
 
 #include "../shared/os-compatibility.h"
 #include "compositor.h"
+#include "trace.h"
 
 static void
 empty_region(pixman_region32_t *region)
@@ -729,6 +730,8 @@ notify_motion(struct weston_seat *seat,
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
 
+	weston_trace_instant("notify-motion", time, 0);
+
 	weston_compositor_wake(ec);
 
 	move_pointer(seat, pointer->x + dx, pointer->y + dy);
@@ -744,6 +747,8 @@ notify_motion_absolute(struct weston_seat *seat,
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
 
+	weston_trace_instant("notify-motion", time, 0);
+
 	weston_compositor_wake(ec);
 
 	move_pointer(seat, x, y);
@@ -776,6 +781,8 @@ notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
 		(struct weston_surface *) pointer->focus;
 	uint32_t serial = wl_display_next_serial(compositor->wl_display);
 
+	weston_trace_instant("notify-button", time, button);
+
 	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
 		if (compositor->ping_handler && focus)
 			compositor->ping_handler(focus, serial);
@@ -814,6 +821,8 @@ notify_axis(struct weston_seat *seat, uint32_t time, uint32_t axis,
 	struct wl_resource *resource;
 	struct wl_list *resource_list;
 
+	weston_trace_instant("notify-axis", time, axis);
+
 	if (compositor->ping_handler && focus)
 		compositor->ping_handler(focus, serial);
 
@@ -948,6 +957,8 @@ notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
 	uint32_t serial = wl_display_next_serial(compositor->wl_display);
 	uint32_t *k, *end;
 
+	weston_trace_instant("notify-key", time, key);
+
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
 		if (compositor->ping_handler && focus)
 			compositor->ping_handler(focus, serial);
@@ -1122,6 +1133,8 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 	struct weston_surface *es;
 	wl_fixed_t sx, sy;
 
+	weston_trace_instant("notify-touch", time, touch_id);
+
 	/* Update grab's global coordinates. */
 	if (touch_id == touch->grab_touch_id && touch_type != WL_TOUCH_UP) {
 		touch->grab_x = x;
@@ -1207,8 +1220,8 @@ pointer_cursor_surface_configure(struct weston_surface *es,
 	empty_region(&es->pending.input);
 
 	if (!weston_surface_is_mapped(es)) {
-		wl_list_insert(&es->compositor->cursor_layer.surface_list,
-			       &es->layer_link);
+		weston_layer_entry_insert(&es->compositor->cursor_layer.surface_list,
+					  es);
 		weston_surface_update_transform(es);
 	}
 }
@@ -0,0 +1,433 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "compositor.h"
+
+/*
+ * Uniform grid over the output area, used to pick surfaces without
+ * transforming the pointer into every surface on the list.
+ *
+ * Each cell lists, in stacking order, the surfaces whose transformed
+ * input region bounding box touches it. Surfaces with an unbounded
+ * input region (the default before the first commit) are kept in a
+ * separate list that is merged into every lookup. The index is rebuilt
+ * lazily on the first pick after the surface list or the outputs
+ * changed. A surface whose transform or input region changed is only
+ * moved from the cells of its old box to those of its new one, so
+ * dragging a window does not cost a rebuild. Points outside the grid
+ * fall back to the linear walk.
+ */
+
+#define PICK_CELL_SHIFT 6
+#define PICK_CELL_SIZE (1 << PICK_CELL_SHIFT)
+
+/* Input extents larger than this are treated as unbounded. */
+#define PICK_MAX_EXTENT (1 << 16)
+
+enum pick_box {
+	PICK_BOX_EMPTY,
+	PICK_BOX_BOUNDED,
+	PICK_BOX_UNBOUNDED
+};
+
+struct pick_index_box {
+	enum pick_box type;
+	int32_t x1, y1, x2, y2;		/* cells, inclusive */
+};
+
+WL_EXPORT void
+weston_pick_index_init(struct weston_compositor *ec)
+{
+	memset(&ec->pick_index, 0, sizeof ec->pick_index);
+	wl_array_init(&ec->pick_index.surfaces);
+	wl_array_init(&ec->pick_index.boxes);
+	wl_array_init(&ec->pick_index.unbounded);
+	wl_list_init(&ec->pick_index.moved);
+	ec->pick_index.dirty = 1;
+}
+
+static void
+pick_index_clear(struct weston_compositor *ec)
+{
+	struct weston_surface *surface;
+	int32_t i;
+
+	for (i = 0; i < ec->pick_index.cols * ec->pick_index.rows; i++)
+		wl_array_release(&ec->pick_index.cells[i]);
+	free(ec->pick_index.cells);
+	ec->pick_index.cells = NULL;
+	ec->pick_index.cols = 0;
+	ec->pick_index.rows = 0;
+	ec->pick_index.surfaces.size = 0;
+	ec->pick_index.boxes.size = 0;
+	ec->pick_index.unbounded.size = 0;
+
+	while (!wl_list_empty(&ec->pick_index.moved)) {
+		surface = container_of(ec->pick_index.moved.next,
+				       struct weston_surface, pick_link);
+		wl_list_remove(&surface->pick_link);
+		wl_list_init(&surface->pick_link);
+	}
+}
+
+WL_EXPORT void
+weston_pick_index_release(struct weston_compositor *ec)
+{
+	pick_index_clear(ec);
+	wl_array_release(&ec->pick_index.surfaces);
+	wl_array_release(&ec->pick_index.boxes);
+	wl_array_release(&ec->pick_index.unbounded);
+}
+
+WL_EXPORT void
+weston_pick_index_surface_moved(struct weston_surface *surface)
+{
+	struct weston_compositor *ec = surface->compositor;
+
+	if (wl_list_empty(&surface->pick_link))
+		wl_list_insert(&ec->pick_index.moved, &surface->pick_link);
+}
+
+static void
+pick_index_surface_box(struct weston_compositor *ec,
+		       struct weston_surface *surface,
+		       struct pick_index_box *box)
+{
+	pixman_box32_t *e = pixman_region32_extents(&surface->input);
+	float min_x = HUGE_VALF, min_y = HUGE_VALF;
+	float max_x = -HUGE_VALF, max_y = -HUGE_VALF;
+	float x, y;
+	int32_t x1, y1, x2, y2;
+	int i;
+
+	memset(box, 0, sizeof *box);
+
+	if (e->x1 >= e->x2 || e->y1 >= e->y2) {
+		box->type = PICK_BOX_EMPTY;
+		return;
+	}
+
+	if ((int64_t) e->x2 - e->x1 > PICK_MAX_EXTENT ||
+	    (int64_t) e->y2 - e->y1 > PICK_MAX_EXTENT) {
+		box->type = PICK_BOX_UNBOUNDED;
+		return;
+	}
+
+	/* The picker truncates surface coordinates towards zero, so a
+	 * point up to one surface unit left of or above the region still
+	 * hits it. Grow the extents by one unit before transforming. */
+	for (i = 0; i < 4; i++) {
+		weston_surface_to_global_float(surface,
+					       i & 1 ? e->x2 + 1 : e->x1 - 1,
+					       i & 2 ? e->y2 + 1 : e->y1 - 1,
+					       &x, &y);
+		if (x < min_x)
+			min_x = x;
+		if (x > max_x)
+			max_x = x;
+		if (y < min_y)
+			min_y = y;
+		if (y > max_y)
+			max_y = y;
+	}
+
+	/* One more pixel against rounding in the inverse transform. */
+	x1 = floorf(min_x) - 1 - ec->pick_index.x;
+	y1 = floorf(min_y) - 1 - ec->pick_index.y;
+	x2 = ceilf(max_x) + 1 - ec->pick_index.x;
+	y2 = ceilf(max_y) + 1 - ec->pick_index.y;
+
+	if (x2 < 0 || y2 < 0 ||
+	    x1 >= ec->pick_index.cols * PICK_CELL_SIZE ||
+	    y1 >= ec->pick_index.rows * PICK_CELL_SIZE) {
+		box->type = PICK_BOX_EMPTY;
+		return;
+	}
+
+	box->type = PICK_BOX_BOUNDED;
+	box->x1 = x1 < 0 ? 0 : x1 >> PICK_CELL_SHIFT;
+	box->y1 = y1 < 0 ? 0 : y1 >> PICK_CELL_SHIFT;
+	box->x2 = x2 >> PICK_CELL_SHIFT;
+	box->y2 = y2 >> PICK_CELL_SHIFT;
+	if (box->x2 >= ec->pick_index.cols)
+		box->x2 = ec->pick_index.cols - 1;
+	if (box->y2 >= ec->pick_index.rows)
+		box->y2 = ec->pick_index.rows - 1;
+}
+
+/* Where slot goes in a list sorted in stacking order. */
+static uint32_t
+slot_list_find(struct wl_array *list, uint32_t slot)
+{
+	uint32_t *slots = list->data;
+	uint32_t lo = 0, hi = list->size / sizeof *slots, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (slots[mid] < slot)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int
+slot_list_insert(struct wl_array *list, uint32_t slot)
+{
+	uint32_t i, n, *slots;
+
+	i = slot_list_find(list, slot);
+	if (wl_array_add(list, sizeof slot) == NULL)
+		return -1;
+
+	slots = list->data;
+	n = list->size / sizeof *slots;
+	memmove(&slots[i + 1], &slots[i], (n - 1 - i) * sizeof *slots);
+	slots[i] = slot;
+
+	return 0;
+}
+
+static void
+slot_list_remove(struct wl_array *list, uint32_t slot)
+{
+	uint32_t i, n, *slots = list->data;
+
+	i = slot_list_find(list, slot);
+	n = list->size / sizeof *slots;
+	if (i == n || slots[i] != slot)
+		return;
+
+	memmove(&slots[i], &slots[i + 1], (n - 1 - i) * sizeof *slots);
+	list->size -= sizeof *slots;
+}
+
+/* Adds slot to, or removes it from, the cells its box covers. */
+static int
+pick_index_bin(struct weston_compositor *ec, uint32_t slot,
+	       struct pick_index_box *box, int insert)
+{
+	struct wl_array *cell;
+	int32_t cx, cy;
+
+	switch (box->type) {
+	case PICK_BOX_EMPTY:
+		return 0;
+	case PICK_BOX_UNBOUNDED:
+		if (!insert) {
+			slot_list_remove(&ec->pick_index.unbounded, slot);
+			return 0;
+		}
+		return slot_list_insert(&ec->pick_index.unbounded, slot);
+	case PICK_BOX_BOUNDED:
+		break;
+	}
+
+	for (cy = box->y1; cy <= box->y2; cy++) {
+		for (cx = box->x1; cx <= box->x2; cx++) {
+			cell = &ec->pick_index.cells[cy * ec->pick_index.cols +
+						     cx];
+			if (!insert)
+				slot_list_remove(cell, slot);
+			else if (slot_list_insert(cell, slot) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+pick_index_build(struct weston_compositor *ec)
+{
+	struct weston_surface *surface, **s;
+	struct weston_output *output;
+	struct pick_index_box *box;
+	pixman_region32_t area;
+	pixman_box32_t *e;
+	uint32_t n = 0, ncells;
+
+	pick_index_clear(ec);
+
+	pixman_region32_init(&area);
+	wl_list_for_each(output, &ec->output_list, link)
+		pixman_region32_union(&area, &area, &output->region);
+	e = pixman_region32_extents(&area);
+	ec->pick_index.x = e->x1;
+	ec->pick_index.y = e->y1;
+	ncells = ((e->x2 - e->x1 + PICK_CELL_SIZE - 1) >> PICK_CELL_SHIFT) *
+		((e->y2 - e->y1 + PICK_CELL_SIZE - 1) >> PICK_CELL_SHIFT);
+	pixman_region32_fini(&area);
+
+	if (ncells == 0)
+		goto err;
+
+	ec->pick_index.cells = calloc(ncells, sizeof *ec->pick_index.cells);
+	if (ec->pick_index.cells == NULL)
+		goto err;
+	ec->pick_index.cols = (e->x2 - e->x1 + PICK_CELL_SIZE - 1) >>
+		PICK_CELL_SHIFT;
+	ec->pick_index.rows = (e->y2 - e->y1 + PICK_CELL_SIZE - 1) >>
+		PICK_CELL_SHIFT;
+
+	/* Slots go in stacking order, so each insert is an append. */
+	wl_list_for_each(surface, &ec->surface_list, link) {
+		s = wl_array_add(&ec->pick_index.surfaces, sizeof *s);
+		box = wl_array_add(&ec->pick_index.boxes, sizeof *box);
+		if (s == NULL || box == NULL)
+			goto err;
+		*s = surface;
+		surface->pick_slot = n;
+
+		pick_index_surface_box(ec, surface, box);
+		if (pick_index_bin(ec, n, box, 1) < 0)
+			goto err;
+		n++;
+	}
+
+	ec->pick_index.dirty = 0;
+
+	return 0;
+
+err:
+	pick_index_clear(ec);
+
+	return -1;
+}
+
+/* Moves the surfaces on the moved list to the cells they cover now. */
+static int
+pick_index_update(struct weston_compositor *ec)
+{
+	struct weston_surface *surface, **surfaces;
+	struct pick_index_box *boxes, box;
+	uint32_t slot, n;
+
+	surfaces = ec->pick_index.surfaces.data;
+	boxes = ec->pick_index.boxes.data;
+	n = ec->pick_index.surfaces.size / sizeof *surfaces;
+
+	while (!wl_list_empty(&ec->pick_index.moved)) {
+		surface = container_of(ec->pick_index.moved.next,
+				       struct weston_surface, pick_link);
+		wl_list_remove(&surface->pick_link);
+		wl_list_init(&surface->pick_link);
+
+		/* Not in the index; it gets in with the next rebuild. */
+		slot = surface->pick_slot;
+		if (slot >= n || surfaces[slot] != surface)
+			continue;
+
+		pick_index_surface_box(ec, surface, &box);
+		if (memcmp(&box, &boxes[slot], sizeof box) == 0)
+			continue;
+
+		pick_index_bin(ec, slot, &boxes[slot], 0);
+		boxes[slot] = box;
+		if (pick_index_bin(ec, slot, &box, 1) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+pick_index_test(struct weston_surface *surface, wl_fixed_t x, wl_fixed_t y,
+		wl_fixed_t *sx, wl_fixed_t *sy)
+{
+	weston_surface_from_global_fixed(surface, x, y, sx, sy);
+
+	return pixman_region32_contains_point(&surface->input,
+					      wl_fixed_to_int(*sx),
+					      wl_fixed_to_int(*sy),
+					      NULL);
+}
+
+WL_EXPORT struct weston_surface *
+weston_compositor_pick_surface_linear(struct weston_compositor *compositor,
+				      wl_fixed_t x, wl_fixed_t y,
+				      wl_fixed_t *sx, wl_fixed_t *sy)
+{
+	struct weston_surface *surface;
+
+	wl_list_for_each(surface, &compositor->surface_list, link) {
+		if (pick_index_test(surface, x, y, sx, sy))
+			return surface;
+	}
+
+	return NULL;
+}
+
+WL_EXPORT struct weston_surface *
+weston_compositor_pick_surface(struct weston_compositor *compositor,
+			       wl_fixed_t x, wl_fixed_t y,
+			       wl_fixed_t *sx, wl_fixed_t *sy)
+{
+	struct weston_surface **surfaces;
+	uint32_t *cell, *unbounded, ncell, nunbounded, i, j, k;
+	int32_t px, py;
+
+	if (!compositor->pick_index.dirty &&
+	    pick_index_update(compositor) < 0)
+		compositor->pick_index.dirty = 1;
+	if (compositor->pick_index.dirty && pick_index_build(compositor) < 0)
+		return weston_compositor_pick_surface_linear(compositor,
+							     x, y, sx, sy);
+
+	px = (int32_t) floor(wl_fixed_to_double(x)) - compositor->pick_index.x;
+	py = (int32_t) floor(wl_fixed_to_double(y)) - compositor->pick_index.y;
+	if (px < 0 || py < 0 ||
+	    px >= compositor->pick_index.cols * PICK_CELL_SIZE ||
+	    py >= compositor->pick_index.rows * PICK_CELL_SIZE)
+		return weston_compositor_pick_surface_linear(compositor,
+							     x, y, sx, sy);
+
+	k = (py >> PICK_CELL_SHIFT) * compositor->pick_index.cols +
+		(px >> PICK_CELL_SHIFT);
+	cell = compositor->pick_index.cells[k].data;
+	ncell = compositor->pick_index.cells[k].size / sizeof *cell;
+	unbounded = compositor->pick_index.unbounded.data;
+	nunbounded = compositor->pick_index.unbounded.size / sizeof *unbounded;
+	surfaces = compositor->pick_index.surfaces.data;
+
+	/* Both lists are in stacking order, merge them. */
+	i = j = 0;
+	while (i < ncell || j < nunbounded) {
+		if (j == nunbounded || (i < ncell && cell[i] < unbounded[j]))
+			k = cell[i++];
+		else
+			k = unbounded[j++];
+
+		if (pick_index_test(surfaces[k], x, y, sx, sy))
+			return surfaces[k];
+	}
+
+	return NULL;
+}
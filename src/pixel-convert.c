@@ -0,0 +1,292 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pixel-convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__) || __GNUC__ > 4 || \
+	(__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+#endif
+
+#if (defined(__ARM_NEON__) || defined(__ARM_NEON)) && \
+	__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+/* Pixels converted at a time when flipping in place. */
+#define PIXEL_CONVERT_CHUNK 256
+
+typedef void (*convert_row_func_t)(uint32_t *dst, const uint32_t *src,
+				   int n, int swap, uint32_t alpha);
+
+struct pixel_convert_impl {
+	const char *name;
+	int (*supported)(void);
+	convert_row_func_t convert_row;
+};
+
+static void
+convert_row_c(uint32_t *dst, const uint32_t *src, int n,
+	      int swap, uint32_t alpha)
+{
+	uint32_t v;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		v = src[i];
+		if (swap)
+			v = (v & 0xff00ff00) |
+				((v >> 16) & 0xff) | ((v & 0xff) << 16);
+		dst[i] = v | alpha;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+
+static int
+have_sse2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2")))
+static void
+convert_row_sse2(uint32_t *dst, const uint32_t *src, int n,
+		 int swap, uint32_t alpha)
+{
+	const __m128i ag = _mm_set1_epi32(0xff00ff00);
+	const __m128i r = _mm_set1_epi32(0x000000ff);
+	const __m128i b = _mm_set1_epi32(0x00ff0000);
+	const __m128i a = _mm_set1_epi32(alpha);
+	__m128i v;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((const __m128i *) (src + i));
+		if (swap)
+			v = _mm_or_si128(_mm_and_si128(v, ag),
+				_mm_or_si128(
+					_mm_and_si128(_mm_srli_epi32(v, 16), r),
+					_mm_and_si128(_mm_slli_epi32(v, 16), b)));
+		v = _mm_or_si128(v, a);
+		_mm_storeu_si128((__m128i *) (dst + i), v);
+	}
+
+	convert_row_c(dst + i, src + i, n - i, swap, alpha);
+}
+
+static int
+have_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void
+convert_row_avx2(uint32_t *dst, const uint32_t *src, int n,
+		 int swap, uint32_t alpha)
+{
+	const __m256i ag = _mm256_set1_epi32(0xff00ff00);
+	const __m256i r = _mm256_set1_epi32(0x000000ff);
+	const __m256i b = _mm256_set1_epi32(0x00ff0000);
+	const __m256i a = _mm256_set1_epi32(alpha);
+	__m256i v;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *) (src + i));
+		if (swap)
+			v = _mm256_or_si256(_mm256_and_si256(v, ag),
+				_mm256_or_si256(
+					_mm256_and_si256(_mm256_srli_epi32(v, 16), r),
+					_mm256_and_si256(_mm256_slli_epi32(v, 16), b)));
+		v = _mm256_or_si256(v, a);
+		_mm256_storeu_si256((__m256i *) (dst + i), v);
+	}
+
+	convert_row_c(dst + i, src + i, n - i, swap, alpha);
+}
+
+#endif
+
+#ifdef HAVE_NEON
+
+static int
+have_neon(void)
+{
+	return 1;
+}
+
+static void
+convert_row_neon(uint32_t *dst, const uint32_t *src, int n,
+		 int swap, uint32_t alpha)
+{
+	uint8x16x4_t v;
+	uint8x16_t t;
+	int i;
+
+	/* Deinterleaved into B, G, R and A planes on little endian. */
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = vld4q_u8((const uint8_t *) (src + i));
+		if (swap) {
+			t = v.val[0];
+			v.val[0] = v.val[2];
+			v.val[2] = t;
+		}
+		if (alpha)
+			v.val[3] = vdupq_n_u8(0xff);
+		vst4q_u8((uint8_t *) (dst + i), v);
+	}
+
+	convert_row_c(dst + i, src + i, n - i, swap, alpha);
+}
+
+#endif
+
+/* Best first. */
+static const struct pixel_convert_impl impls[] = {
+#ifdef HAVE_X86_SIMD
+	{ "avx2", have_avx2, convert_row_avx2 },
+	{ "sse2", have_sse2, convert_row_sse2 },
+#endif
+#ifdef HAVE_NEON
+	{ "neon", have_neon, convert_row_neon },
+#endif
+	{ "c", NULL, convert_row_c },
+};
+
+static const struct pixel_convert_impl *selected;
+
+int
+pixel_convert_select(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof impls / sizeof impls[0]; i++) {
+		if (name && strcmp(name, impls[i].name) != 0)
+			continue;
+		if (impls[i].supported && !impls[i].supported())
+			continue;
+
+		selected = &impls[i];
+		return 0;
+	}
+
+	return -1;
+}
+
+const char *
+pixel_convert_selected(void)
+{
+	if (!selected)
+		pixel_convert_select(NULL);
+
+	return selected->name;
+}
+
+static inline void
+convert_row(uint32_t *dst, const uint32_t *src, int n,
+	    int swap, uint32_t alpha)
+{
+	if (swap || alpha)
+		selected->convert_row(dst, src, n, swap, alpha);
+	else if (dst != src)
+		memcpy(dst, src, n * 4);
+}
+
+/* Swaps the rows pairwise, a chunk at a time, through a buffer on the
+ * stack. */
+static void
+convert_yflip_in_place(uint8_t *pixels, int stride, int width, int height,
+		       int swap, uint32_t alpha)
+{
+	uint32_t tmp[PIXEL_CONVERT_CHUNK];
+	uint32_t *top, *bottom;
+	int y, x, n;
+
+	for (y = 0; y < height / 2; y++) {
+		top = (uint32_t *) (pixels + y * stride);
+		bottom = (uint32_t *) (pixels + (height - 1 - y) * stride);
+
+		for (x = 0; x < width; x += n) {
+			n = width - x;
+			if (n > PIXEL_CONVERT_CHUNK)
+				n = PIXEL_CONVERT_CHUNK;
+
+			convert_row(tmp, top + x, n, swap, alpha);
+			convert_row(top + x, bottom + x, n, swap, alpha);
+			memcpy(bottom + x, tmp, n * 4);
+		}
+	}
+
+	if (height % 2) {
+		top = (uint32_t *) (pixels + (height / 2) * stride);
+		convert_row(top, top, width, swap, alpha);
+	}
+}
+
+void
+pixel_convert(void *dst, int dst_stride, const void *src, int src_stride,
+	      int width, int height, uint32_t flags)
+{
+	int swap = flags & PIXEL_CONVERT_SWAP_RB;
+	uint32_t alpha = flags & PIXEL_CONVERT_OPAQUE ? 0xff000000 : 0;
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	int y;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	if (!selected)
+		pixel_convert_select(NULL);
+
+	if (dst == src && (flags & PIXEL_CONVERT_YFLIP)) {
+		convert_yflip_in_place(d, dst_stride, width, height,
+				       swap, alpha);
+		return;
+	}
+
+	if (flags & PIXEL_CONVERT_YFLIP) {
+		s += (height - 1) * src_stride;
+		src_stride = -src_stride;
+	}
+
+	for (y = 0; y < height; y++) {
+		convert_row((uint32_t *) d, (const uint32_t *) s, width,
+			    swap, alpha);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
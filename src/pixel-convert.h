@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef _WESTON_PIXEL_CONVERT_H
+#define _WESTON_PIXEL_CONVERT_H
+
+#include <stdint.h>
+
+/* Conversion of 32 bpp pixel rectangles for screen capture.
+ *
+ * Renderers read pixels back as a8r8g8b8 or a8b8g8r8, bottom-up when
+ * the compositor has WESTON_CAP_CAPTURE_YFLIP.  pixel_convert() copies
+ * such a rectangle between buffers of any stride, optionally swapping
+ * the red and blue channels, forcing the alpha byte to 0xff and
+ * reversing the row order.  Source and destination may be the same
+ * buffer with the same stride, which lets a screenshot be converted in
+ * the client's buffer it was read into.
+ *
+ * The rows are converted with SSE2, AVX2 or NEON where the CPU has
+ * them, picked at the first call, and in plain C otherwise.
+ */
+
+#define PIXEL_CONVERT_SWAP_RB	(1 << 0)	/* ARGB <-> ABGR */
+#define PIXEL_CONVERT_OPAQUE	(1 << 1)	/* XRGB -> ARGB */
+#define PIXEL_CONVERT_YFLIP	(1 << 2)	/* last row first */
+
+void
+pixel_convert(void *dst, int dst_stride, const void *src, int src_stride,
+	      int width, int height, uint32_t flags);
+
+/* Restricts pixel_convert() to one implementation: "c", "sse2", "avx2"
+ * or "neon", or the best one for NULL.  Returns -1 if the CPU or the
+ * build lacks it.  Meant for tests and benchmarks. */
+int
+pixel_convert_select(const char *name);
+
+const char *
+pixel_convert_selected(void);
+
+#endif
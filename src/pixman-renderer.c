@@ -25,26 +25,97 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "pixman-renderer.h"
+#include "trace.h"
 
 #include <linux/input.h>
 
+#define PIXMAN_MAX_THREADS 64
+#define PIXMAN_MIN_BAND_HEIGHT 16
+#define PIXMAN_DAMAGE_HISTORY 4
+#define PIXMAN_SETTLE_MSECS 150
+
+/* A composite recorded for the worker threads.  Pixman images carry
+ * their clip, transform and filter, so the workers never touch the
+ * surface or output images; each band builds its own from this. */
+struct pixman_draw_op {
+	pixman_op_t op;
+	int copy;			/* shadow to hw_buffer, no source */
+	uint32_t *bits;			/* NULL for a solid fill */
+	pixman_format_code_t format;
+	int width, height, stride;
+	pixman_color_t color;
+	pixman_transform_t transform;
+	pixman_filter_t filter;
+	int src_x, src_y;
+	pixman_region32_t region;	/* output coordinates */
+};
+
 struct pixman_output_state {
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
+	pixman_image_t *target;		/* shadow_image or hw_buffer */
+	int direct;			/* hw_buffer may be rendered to */
+	int shadow_valid;		/* shadow_image holds the last frame */
+	int hw_age;			/* frames since hw_buffer was current */
+	pixman_region32_t damage_history[PIXMAN_DAMAGE_HISTORY];
+	struct wl_array ops;		/* struct pixman_draw_op */
+};
+
+/* What a resampled surface image depends on.  The transform maps
+ * pixels of the resampled image to buffer pixels, so it stays the same
+ * when the surface moves by whole output pixels. */
+struct pixman_cache_key {
+	pixman_transform_t transform;
+	int width, height;
+	uint32_t generation;
 };
 
 struct pixman_surface_state {
+	struct weston_surface *surface;
 	pixman_image_t *image;
+	pixman_color_t color;		/* when image is a solid fill */
 	struct weston_buffer_reference buffer_ref;
+	uint32_t generation;		/* bumped when the contents change */
+
+	/* Resampled image of a rotated or scaled surface. */
+	pixman_image_t *cache_image;
+	struct pixman_cache_key cache_key;
+	struct pixman_cache_key last_key;	/* of the last draw */
+	int settling;			/* transform changed recently */
+	struct wl_event_source *settle_timer;
+};
+
+/* The worker pool splits the output into horizontal bands.  The
+ * repainting thread renders bands as well and returns once all bands
+ * of the output are done. */
+struct pixman_worker_pool {
+	pthread_t threads[PIXMAN_MAX_THREADS];
+	int thread_count;
+	pthread_mutex_t mutex;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	int quit;
+
+	/* The current job, under mutex. */
+	uint32_t generation;
+	struct weston_output *output;
+	int band_height;
+	int band_count;
+	int next_band;
+	int bands_done;
 };
 
 struct pixman_renderer {
 	struct weston_renderer base;
 	int repaint_debug;
 	pixman_image_t *debug_color;
+	struct pixman_worker_pool *pool;
 };
 
 static inline struct pixman_output_state *
@@ -222,6 +293,181 @@ region_global_to_output(struct weston_output *output, pixman_region32_t *region)
 
 #define D2F(v) pixman_double_to_fixed((double)v)
 
+static struct pixman_draw_op *
+add_draw_op(struct weston_output *output, pixman_op_t pixman_op,
+	    pixman_region32_t *region)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_draw_op *op;
+
+	op = wl_array_add(&po->ops, sizeof *op);
+	if (op == NULL)
+		return NULL;
+
+	memset(op, 0, sizeof *op);
+	op->op = pixman_op;
+	pixman_region32_init(&op->region);
+	pixman_region32_copy(&op->region, region);
+
+	return op;
+}
+
+static void
+record_draw_op(struct weston_output *output, struct pixman_surface_state *ps,
+	       pixman_image_t *src, pixman_op_t pixman_op,
+	       pixman_transform_t *transform, pixman_filter_t filter,
+	       int src_x, int src_y, pixman_region32_t *region)
+{
+	struct pixman_draw_op *op;
+
+	if (!pixman_region32_not_empty(region))
+		return;
+
+	op = add_draw_op(output, pixman_op, region);
+	if (op == NULL)
+		return;
+
+	op->bits = pixman_image_get_data(src);
+	if (op->bits) {
+		op->format = pixman_image_get_format(src);
+		op->width = pixman_image_get_width(src);
+		op->height = pixman_image_get_height(src);
+		op->stride = pixman_image_get_stride(src);
+	} else {
+		op->color = ps->color;
+	}
+	op->transform = *transform;
+	op->filter = filter;
+	op->src_x = src_x;
+	op->src_y = src_y;
+}
+
+static int
+settle_timer_handler(void *data)
+{
+	struct pixman_surface_state *ps = data;
+
+	/* Redraw the surface with the proper filter. */
+	ps->settling = 0;
+	weston_surface_damage_below(ps->surface);
+	weston_surface_schedule_repaint(ps->surface);
+
+	return 1;
+}
+
+/* Resampling a rotated or scaled surface on every repaint is slow, so
+ * the resampled image is kept, in output pixels, while neither the
+ * contents nor the transform of the surface change, and only blitted
+ * from then on.  While the transform keeps changing, as in animations,
+ * the surface is drawn with the NEAREST filter instead, and drawn again
+ * properly once it has been still for PIXMAN_SETTLE_MSECS.
+ *
+ * Returns the image to draw from, with the source offset in src_x and
+ * src_y, or NULL to resample ps->image with *filter. */
+static pixman_image_t *
+lookup_cached_image(struct weston_surface *es, struct weston_output *output,
+		    pixman_transform_t *transform, pixman_filter_t *filter,
+		    int *src_x, int *src_y)
+{
+	struct pixman_surface_state *ps = get_surface_state(es);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_cache_key key;
+	pixman_transform_t offset;
+	pixman_region32_t box_region;
+	pixman_box32_t *box;
+	struct wl_event_loop *loop;
+	int moved, changed;
+
+	/* Solid fills are cheap, and a surface on several outputs would
+	 * keep evicting its own cache. */
+	if (!pixman_image_get_data(ps->image) ||
+	    (es->output_mask & (es->output_mask - 1)))
+		return NULL;
+
+	pixman_region32_init(&box_region);
+	pixman_region32_copy(&box_region, &es->transform.boundingbox);
+	region_global_to_output(output, &box_region);
+	pixman_region32_intersect_rect(&box_region, &box_region, 0, 0,
+				       pixman_image_get_width(po->target),
+				       pixman_image_get_height(po->target));
+	box = pixman_region32_extents(&box_region);
+
+	memset(&key, 0, sizeof key);
+	key.width = box->x2 - box->x1;
+	key.height = box->y2 - box->y1;
+	key.generation = ps->generation;
+	pixman_transform_init_translate(&offset,
+					pixman_int_to_fixed(box->x1),
+					pixman_int_to_fixed(box->y1));
+	pixman_transform_multiply(&key.transform, transform, &offset);
+	*src_x = -box->x1;
+	*src_y = -box->y1;
+	pixman_region32_fini(&box_region);
+
+	if (key.width <= 0 || key.height <= 0)
+		return NULL;
+
+	if (ps->cache_image &&
+	    memcmp(&key, &ps->cache_key, sizeof key) == 0)
+		return ps->cache_image;
+
+	moved = ps->last_key.width != 0 &&
+		(memcmp(&key.transform, &ps->last_key.transform,
+			sizeof key.transform) != 0 ||
+		 key.width != ps->last_key.width ||
+		 key.height != ps->last_key.height);
+	changed = key.generation != ps->last_key.generation;
+	ps->last_key = key;
+
+	if (moved) {
+		if (!ps->settle_timer) {
+			loop = wl_display_get_event_loop(es->compositor->wl_display);
+			ps->settle_timer =
+				wl_event_loop_add_timer(loop,
+							settle_timer_handler,
+							ps);
+		}
+		if (ps->settle_timer) {
+			wl_event_source_timer_update(ps->settle_timer,
+						     PIXMAN_SETTLE_MSECS);
+			ps->settling = 1;
+		}
+	}
+
+	if (ps->settling) {
+		*filter = PIXMAN_FILTER_NEAREST;
+		return NULL;
+	}
+
+	/* Contents that change every frame are not worth caching. */
+	if (changed)
+		return NULL;
+
+	if (!ps->cache_image ||
+	    pixman_image_get_width(ps->cache_image) != key.width ||
+	    pixman_image_get_height(ps->cache_image) != key.height) {
+		if (ps->cache_image)
+			pixman_image_unref(ps->cache_image);
+		ps->cache_image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+							   key.width,
+							   key.height,
+							   NULL, 0);
+		if (!ps->cache_image)
+			return NULL;
+	}
+
+	weston_trace_begin("pixman-resample", weston_trace_id(es));
+	pixman_image_set_transform(ps->image, &key.transform);
+	pixman_image_set_filter(ps->image, *filter, NULL, 0);
+	pixman_image_composite32(PIXMAN_OP_SRC, ps->image, NULL,
+				 ps->cache_image,
+				 0, 0, 0, 0, 0, 0, key.width, key.height);
+	weston_trace_end("pixman-resample", weston_trace_id(es));
+	ps->cache_key = key;
+
+	return ps->cache_image;
+}
+
 static void
 repaint_region(struct weston_surface *es, struct weston_output *output,
 	       pixman_region32_t *region, pixman_region32_t *surf_region,
@@ -234,7 +480,10 @@ repaint_region(struct weston_surface *es, struct weston_output *output,
 	pixman_region32_t final_region;
 	float surface_x, surface_y;
 	pixman_transform_t transform;
+	pixman_filter_t filter;
 	pixman_fixed_t fw, fh;
+	pixman_image_t *src;
+	int src_x, src_y;
 
 	/* The final region to be painted is the intersection of
 	 * 'region' and 'surf_region'. However, 'region' is in the global
@@ -263,9 +512,6 @@ repaint_region(struct weston_surface *es, struct weston_output *output,
 	/* Convert from global to output coord */
 	region_global_to_output(output, &final_region);
 
-	/* And clip to it */
-	pixman_image_set_clip_region32 (po->shadow_image, &final_region);
-
 	/* Set up the source transformation based on the surface
 	   position, the output position/transform/scale and the client
 	   specified buffer transform/scale */
@@ -383,35 +629,58 @@ repaint_region(struct weston_surface *es, struct weston_output *output,
 			       pixman_double_to_fixed ((double)es->buffer_scale),
 			       pixman_double_to_fixed ((double)es->buffer_scale));
 
-	pixman_image_set_transform(ps->image, &transform);
-
 	if (es->transform.enabled || output->current_scale != es->buffer_scale)
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
+		filter = PIXMAN_FILTER_BILINEAR;
 	else
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+		filter = PIXMAN_FILTER_NEAREST;
+
+	src = NULL;
+	if (filter == PIXMAN_FILTER_BILINEAR)
+		src = lookup_cached_image(es, output, &transform, &filter,
+					  &src_x, &src_y);
+	if (src) {
+		pixman_transform_init_identity(&transform);
+		filter = PIXMAN_FILTER_NEAREST;
+	} else {
+		src = ps->image;
+		src_x = src_y = 0;
+	}
+
+	if (pr->pool) {
+		record_draw_op(output, ps, src, pixman_op, &transform, filter,
+			       src_x, src_y, &final_region);
+		pixman_region32_fini(&final_region);
+		return;
+	}
+
+	/* And clip to it */
+	pixman_image_set_clip_region32 (po->target, &final_region);
+
+	pixman_image_set_transform(src, &transform);
+	pixman_image_set_filter(src, filter, NULL, 0);
 
 	pixman_image_composite32(pixman_op,
-				 ps->image, /* src */
+				 src, /* src */
 				 NULL /* mask */,
-				 po->shadow_image, /* dest */
-				 0, 0, /* src_x, src_y */
+				 po->target, /* dest */
+				 src_x, src_y, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->shadow_image), /* width */
-				 pixman_image_get_height (po->shadow_image) /* height */);
+				 pixman_image_get_width (po->target), /* width */
+				 pixman_image_get_height (po->target) /* height */);
 
 	if (pr->repaint_debug)
 		pixman_image_composite32(PIXMAN_OP_OVER,
 					 pr->debug_color, /* src */
 					 NULL /* mask */,
-					 po->shadow_image, /* dest */
+					 po->target, /* dest */
 					 0, 0, /* src_x, src_y */
 					 0, 0, /* mask_x, mask_y */
 					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+					 pixman_image_get_width (po->target), /* width */
+					 pixman_image_get_height (po->target) /* height */);
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+	pixman_image_set_clip_region32 (po->target, NULL);
 
 	pixman_region32_fini(&final_region);
 }
@@ -471,11 +740,72 @@ static void
 repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
-	struct weston_surface *surface;
+	struct weston_surface **view = output->surface_view.data;
+	size_t i = output->surface_view.size / sizeof *view;
+
+	/* Bottom to top, only the surfaces on this output. */
+	while (i-- > 0)
+		if (view[i]->plane == &compositor->primary_plane)
+			draw_surface(view[i], output, damage);
+}
+
+/* Whether hw_buffer has the layout of the shadow image, so that it can
+ * be rendered to, or copied to row by row. */
+static int
+hw_buffer_matches_shadow(struct pixman_output_state *po)
+{
+	return pixman_image_get_format(po->hw_buffer) == PIXMAN_x8r8g8b8 &&
+		pixman_image_get_width(po->hw_buffer) ==
+		pixman_image_get_width(po->shadow_image) &&
+		pixman_image_get_height(po->hw_buffer) ==
+		pixman_image_get_height(po->shadow_image);
+}
+
+/* Copies region, in output coordinates, from shadow into hw, images
+ * of the shadow buffer and of hw_buffer.  Matching layouts take a
+ * memcpy per damaged row, others a conversion limited to the damage
+ * extents. */
+static void
+copy_region_to_hw(struct pixman_output_state *po, pixman_image_t *shadow,
+		  pixman_image_t *hw, pixman_region32_t *region)
+{
+	pixman_box32_t *rects, *extents;
+	uint8_t *src, *dst;
+	int src_stride, dst_stride, nrects, i, y;
+	size_t len;
+
+	if (!pixman_region32_not_empty(region))
+		return;
+
+	if (hw_buffer_matches_shadow(po)) {
+		src = (uint8_t *) pixman_image_get_data(shadow);
+		src_stride = pixman_image_get_stride(shadow);
+		dst = (uint8_t *) pixman_image_get_data(hw);
+		dst_stride = pixman_image_get_stride(hw);
+
+		rects = pixman_region32_rectangles(region, &nrects);
+		for (i = 0; i < nrects; i++) {
+			len = (rects[i].x2 - rects[i].x1) * 4;
+			for (y = rects[i].y1; y < rects[i].y2; y++)
+				memcpy(dst + y * dst_stride + rects[i].x1 * 4,
+				       src + y * src_stride + rects[i].x1 * 4,
+				       len);
+		}
+		return;
+	}
 
-	wl_list_for_each_reverse(surface, &compositor->surface_list, link)
-		if (surface->plane == &compositor->primary_plane)
-			draw_surface(surface, output, damage);
+	extents = pixman_region32_extents(region);
+	pixman_image_set_clip_region32 (hw, region);
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 shadow, /* src */
+				 NULL /* mask */,
+				 hw, /* dest */
+				 extents->x1, extents->y1, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 extents->x1, extents->y1, /* dest_x, dest_y */
+				 extents->x2 - extents->x1, /* width */
+				 extents->y2 - extents->y1 /* height */);
+	pixman_image_set_clip_region32 (hw, NULL);
 }
 
 static void
@@ -488,20 +818,186 @@ copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 	pixman_region32_copy(&output_region, region);
 
 	region_global_to_output(output, &output_region);
+	pixman_region32_intersect_rect(&output_region, &output_region, 0, 0,
+				       pixman_image_get_width(po->hw_buffer),
+				       pixman_image_get_height(po->hw_buffer));
 
-	pixman_image_set_clip_region32 (po->hw_buffer, &output_region);
+	copy_region_to_hw(po, po->shadow_image, po->hw_buffer, &output_region);
 
-	pixman_image_composite32(PIXMAN_OP_SRC,
-				 po->shadow_image, /* src */
-				 NULL /* mask */,
-				 po->hw_buffer, /* dest */
-				 0, 0, /* src_x, src_y */
-				 0, 0, /* mask_x, mask_y */
-				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->hw_buffer), /* width */
-				 pixman_image_get_height (po->hw_buffer) /* height */);
+	pixman_region32_fini(&output_region);
+}
+
+static void
+render_band(struct pixman_renderer *pr, struct weston_output *output,
+	    int band, int band_height)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_draw_op *op;
+	pixman_image_t *target, *hw, *src, *debug = NULL;
+	pixman_region32_t clip;
+	int w = pixman_image_get_width(po->target);
+	int h = pixman_image_get_height(po->target);
+	int y1 = band * band_height;
+	int y2 = y1 + band_height < h ? y1 + band_height : h;
+
+	weston_trace_begin("pixman-band", band);
+
+	target = pixman_image_create_bits(PIXMAN_x8r8g8b8, w, h,
+					  pixman_image_get_data(po->target),
+					  pixman_image_get_stride(po->target));
+	hw = pixman_image_create_bits(pixman_image_get_format(po->hw_buffer),
+				      pixman_image_get_width(po->hw_buffer),
+				      pixman_image_get_height(po->hw_buffer),
+				      pixman_image_get_data(po->hw_buffer),
+				      pixman_image_get_stride(po->hw_buffer));
+	if (pr->repaint_debug) {
+		pixman_color_t red = { 0x3fff, 0x0000, 0x0000, 0x3fff };
+
+		debug = pixman_image_create_solid_fill(&red);
+	}
+
+	pixman_region32_init(&clip);
+	wl_array_for_each(op, &po->ops) {
+		pixman_region32_intersect_rect(&clip, &op->region,
+					       0, y1, w, y2 - y1);
+		if (!pixman_region32_not_empty(&clip))
+			continue;
+
+		if (op->copy) {
+			copy_region_to_hw(po, target, hw, &clip);
+			continue;
+		}
+
+		if (op->bits)
+			src = pixman_image_create_bits(op->format,
+						       op->width, op->height,
+						       op->bits, op->stride);
+		else
+			src = pixman_image_create_solid_fill(&op->color);
+		pixman_image_set_transform(src, &op->transform);
+		pixman_image_set_filter(src, op->filter, NULL, 0);
+
+		pixman_image_set_clip_region32(target, &clip);
+		pixman_image_composite32(op->op, src, NULL, target,
+					 op->src_x, op->src_y, 0, 0, 0, 0,
+					 w, h);
+		if (debug)
+			pixman_image_composite32(PIXMAN_OP_OVER,
+						 debug, NULL, target,
+						 0, 0, 0, 0, 0, 0, w, h);
+
+		pixman_image_unref(src);
+	}
+	pixman_region32_fini(&clip);
+
+	if (debug)
+		pixman_image_unref(debug);
+	pixman_image_unref(hw);
+	pixman_image_unref(target);
+
+	weston_trace_end("pixman-band", band);
+}
+
+/* Called with the pool mutex held. */
+static void
+worker_pool_run_bands(struct pixman_renderer *pr)
+{
+	struct pixman_worker_pool *pool = pr->pool;
+	struct weston_output *output = pool->output;
+	int band, band_height = pool->band_height;
+
+	while (pool->next_band < pool->band_count) {
+		band = pool->next_band++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		render_band(pr, output, band, band_height);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (++pool->bands_done == pool->band_count)
+			pthread_cond_signal(&pool->done_cond);
+	}
+}
+
+static void *
+worker_thread_function(void *data)
+{
+	struct pixman_renderer *pr = data;
+	struct pixman_worker_pool *pool = pr->pool;
+	uint32_t generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (!pool->quit) {
+		if (generation == pool->generation) {
+			pthread_cond_wait(&pool->start_cond, &pool->mutex);
+			continue;
+		}
+
+		generation = pool->generation;
+		worker_pool_run_bands(pr);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+static void
+worker_pool_render(struct pixman_renderer *pr, struct weston_output *output)
+{
+	struct pixman_worker_pool *pool = pr->pool;
+	struct pixman_output_state *po = get_output_state(output);
+	int h = pixman_image_get_height(po->target);
+	int bands, band_height;
+
+	/* Twice as many bands as threads evens out uneven damage. */
+	bands = 2 * (pool->thread_count + 1);
+	band_height = (h + bands - 1) / bands;
+	if (band_height < PIXMAN_MIN_BAND_HEIGHT)
+		band_height = PIXMAN_MIN_BAND_HEIGHT;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->output = output;
+	pool->band_height = band_height;
+	pool->band_count = (h + band_height - 1) / band_height;
+	pool->next_band = 0;
+	pool->bands_done = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start_cond);
+
+	worker_pool_run_bands(pr);
+	while (pool->bands_done < pool->band_count)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pool->output = NULL;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/* copy_damage is NULL when rendering into hw_buffer. */
+static void
+repaint_output_threaded(struct weston_output *output,
+			pixman_region32_t *render_damage,
+			pixman_region32_t *copy_damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_draw_op *op;
+	pixman_region32_t region;
+
+	repaint_surfaces(output, render_damage);
+
+	if (copy_damage) {
+		pixman_region32_init(&region);
+		pixman_region32_copy(&region, copy_damage);
+		region_global_to_output(output, &region);
+		op = add_draw_op(output, PIXMAN_OP_SRC, &region);
+		if (op)
+			op->copy = 1;
+		pixman_region32_fini(&region);
+	}
+
+	worker_pool_render(pr, output);
 
-	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
+	wl_array_for_each(op, &po->ops)
+		pixman_region32_fini(&op->region);
+	po->ops.size = 0;
 }
 
 static void
@@ -509,12 +1005,54 @@ pixman_renderer_repaint_output(struct weston_output *output,
 			     pixman_region32_t *output_damage)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	pixman_region32_t hw_damage, *render_damage;
+	int direct, i;
 
 	if (!po->hw_buffer)
 		return;
 
-	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
+	/* hw_buffer needs everything damaged since it was current. */
+	pixman_region32_init(&hw_damage);
+	if (po->hw_age >= 1 && po->hw_age <= PIXMAN_DAMAGE_HISTORY + 1) {
+		pixman_region32_copy(&hw_damage, output_damage);
+		for (i = 0; i < po->hw_age - 1; i++)
+			pixman_region32_union(&hw_damage, &hw_damage,
+					      &po->damage_history[i]);
+	} else {
+		pixman_region32_copy(&hw_damage, &output->region);
+	}
+
+	/* Render straight into hw_buffer when it is ordinary memory laid
+	 * out like the shadow.  Otherwise render the new damage into the
+	 * shadow, repainted in full if it is stale, and copy over what
+	 * hw_buffer lacks. */
+	direct = po->direct && hw_buffer_matches_shadow(po);
+	if (direct) {
+		po->target = po->hw_buffer;
+		render_damage = &hw_damage;
+	} else {
+		po->target = po->shadow_image;
+		render_damage = po->shadow_valid ?
+			output_damage : &output->region;
+	}
+
+	if (get_renderer(output->compositor)->pool) {
+		repaint_output_threaded(output, render_damage,
+					direct ? NULL : &hw_damage);
+	} else {
+		repaint_surfaces(output, render_damage);
+		if (!direct)
+			copy_to_hw_buffer(output, &hw_damage);
+	}
+
+	po->shadow_valid = !direct;
+	po->hw_age = 1;
+	pixman_region32_fini(&hw_damage);
+
+	for (i = PIXMAN_DAMAGE_HISTORY - 1; i > 0; i--)
+		pixman_region32_copy(&po->damage_history[i],
+				     &po->damage_history[i - 1]);
+	pixman_region32_copy(&po->damage_history[0], output_damage);
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
@@ -525,7 +1063,11 @@ pixman_renderer_repaint_output(struct weston_output *output,
 static void
 pixman_renderer_flush_damage(struct weston_surface *surface)
 {
-	/* No-op for pixman renderer */
+	struct pixman_surface_state *ps = get_surface_state(surface);
+
+	/* SHM contents are read in place; only resampled copies go stale. */
+	if (pixman_region32_not_empty(&surface->damage))
+		ps->generation++;
 }
 
 static void
@@ -536,14 +1078,20 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	pixman_format_code_t pixman_format;
 
 	weston_buffer_reference(&ps->buffer_ref, buffer);
+	ps->generation++;
 
 	if (ps->image) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
 
-	if (!buffer)
+	if (!buffer) {
+		if (ps->cache_image) {
+			pixman_image_unref(ps->cache_image);
+			ps->cache_image = NULL;
+		}
 		return;
+	}
 	
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
 
@@ -589,6 +1137,7 @@ pixman_renderer_create_surface(struct weston_surface *surface)
 	if (!ps)
 		return -1;
 
+	ps->surface = surface;
 	surface->renderer_state = ps;
 
 	return 0;
@@ -605,6 +1154,7 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	color.green = green * 0xffff;
 	color.blue = blue * 0xffff;
 	color.alpha = alpha * 0xffff;
+	ps->color = color;
 	
 	if (ps->image) {
 		pixman_image_unref(ps->image);
@@ -623,13 +1173,70 @@ pixman_renderer_destroy_surface(struct weston_surface *surface)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	if (ps->cache_image)
+		pixman_image_unref(ps->cache_image);
+	if (ps->settle_timer)
+		wl_event_source_remove(ps->settle_timer);
 	weston_buffer_reference(&ps->buffer_ref, NULL);
 	free(ps);
 }
 
+static void
+worker_pool_destroy(struct pixman_renderer *pr)
+{
+	struct pixman_worker_pool *pool = pr->pool;
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->thread_count; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->start_cond);
+	pthread_cond_destroy(&pool->done_cond);
+	free(pool);
+	pr->pool = NULL;
+}
+
+/* threads counts the repainting thread too, so 1 means no pool. */
+static int
+worker_pool_create(struct pixman_renderer *pr, int threads)
+{
+	struct pixman_worker_pool *pool;
+
+	pool = calloc(1, sizeof *pool);
+	if (pool == NULL)
+		return -1;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	pr->pool = pool;
+
+	for (; pool->thread_count < threads - 1; pool->thread_count++) {
+		if (pthread_create(&pool->threads[pool->thread_count], NULL,
+				   worker_thread_function, pr) != 0) {
+			weston_log("pixman: failed to start worker thread\n");
+			worker_pool_destroy(pr);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 static void
 pixman_renderer_destroy(struct weston_compositor *ec)
 {
+	struct pixman_renderer *pr = get_renderer(ec);
+
+	if (pr->pool)
+		worker_pool_destroy(pr);
+
 	free(ec->renderer);
 	ec->renderer = NULL;
 }
@@ -659,6 +1266,8 @@ WL_EXPORT int
 pixman_renderer_init(struct weston_compositor *ec)
 {
 	struct pixman_renderer *renderer;
+	struct weston_config_section *section;
+	int threads;
 
 	renderer = malloc(sizeof *renderer);
 	if (renderer == NULL)
@@ -666,6 +1275,16 @@ pixman_renderer_init(struct weston_compositor *ec)
 
 	renderer->repaint_debug = 0;
 	renderer->debug_color = NULL;
+	renderer->pool = NULL;
+
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_int(section, "pixman-threads", &threads, 1);
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > PIXMAN_MAX_THREADS)
+		threads = PIXMAN_MAX_THREADS;
+	if (threads > 1 && worker_pool_create(renderer, threads) == 0)
+		weston_log("pixman renderer using %d threads\n", threads);
 	renderer->base.read_pixels = pixman_renderer_read_pixels;
 	renderer->base.repaint_output = pixman_renderer_repaint_output;
 	renderer->base.flush_damage = pixman_renderer_flush_damage;
@@ -693,6 +1312,8 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
+	if (buffer != po->hw_buffer)
+		po->hw_age = 0;
 	po->hw_buffer = buffer;
 
 	if (po->hw_buffer) {
@@ -701,11 +1322,27 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 	}
 }
 
+WL_EXPORT void
+pixman_renderer_output_set_buffer_age(struct weston_output *output, int age)
+{
+	struct pixman_output_state *po = get_output_state(output);
+
+	po->hw_age = age;
+}
+
+WL_EXPORT void
+pixman_renderer_output_set_direct(struct weston_output *output, int direct)
+{
+	struct pixman_output_state *po = get_output_state(output);
+
+	po->direct = direct;
+}
+
 WL_EXPORT int
 pixman_renderer_output_create(struct weston_output *output)
 {
 	struct pixman_output_state *po = calloc(1, sizeof *po);
-	int w, h;
+	int w, h, i;
 
 	if (!po)
 		return -1;
@@ -731,6 +1368,11 @@ pixman_renderer_output_create(struct weston_output *output)
 		return -1;
 	}
 
+	wl_array_init(&po->ops);
+	po->target = po->shadow_image;
+	po->shadow_valid = 1;
+	for (i = 0; i < PIXMAN_DAMAGE_HISTORY; i++)
+		pixman_region32_init(&po->damage_history[i]);
 	output->renderer_state = po;
 
 	return 0;
@@ -740,6 +1382,7 @@ WL_EXPORT void
 pixman_renderer_output_destroy(struct weston_output *output)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	int i;
 
 	pixman_image_unref(po->shadow_image);
 
@@ -749,5 +1392,8 @@ pixman_renderer_output_destroy(struct weston_output *output)
 	po->shadow_image = NULL;
 	po->hw_buffer = NULL;
 
+	for (i = 0; i < PIXMAN_DAMAGE_HISTORY; i++)
+		pixman_region32_fini(&po->damage_history[i]);
+	wl_array_release(&po->ops);
 	free(po);
 }
@@ -33,5 +33,19 @@ pixman_renderer_output_create(struct weston_output *output);
 void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer);
 
+/* The buffer set on the output is ordinary memory and is the same from
+ * frame to frame: render into it without a shadow copy if it is laid
+ * out like the shadow. */
+void
+pixman_renderer_output_set_direct(struct weston_output *output, int direct);
+
+/* Call after pixman_renderer_output_set_buffer() when flipping between
+ * buffers: age is the number of frames since the buffer was last
+ * rendered to, 1 for the previous frame, or 0 if its contents are
+ * unknown.  Only the damage of the frames it missed is then redrawn.
+ * Setting a new buffer without an age assumes unknown contents. */
+void
+pixman_renderer_output_set_buffer_age(struct weston_output *output, int age);
+
 void
 pixman_renderer_output_destroy(struct weston_output *output);
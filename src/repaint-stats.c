@@ -0,0 +1,144 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include <inttypes.h>
+
+#include "repaint-stats.h"
+
+const char * const repaint_phase_names[REPAINT_PHASE_COUNT] = {
+	[REPAINT_PHASE_SURFACE_LIST] = "surface-list",
+	[REPAINT_PHASE_ASSIGN_PLANES] = "assign-planes",
+	[REPAINT_PHASE_DAMAGE] = "damage",
+	[REPAINT_PHASE_RENDER] = "render",
+	[REPAINT_PHASE_INPUT] = "input",
+	[REPAINT_PHASE_FRAME_CALLBACKS] = "frame-callbacks",
+	[REPAINT_PHASE_ANIMATIONS] = "animations",
+	[REPAINT_PHASE_TOTAL] = "total",
+};
+
+static int
+bucket_index(uint32_t us)
+{
+	int e;
+
+	if (us < REPAINT_HISTOGRAM_LINEAR)
+		return us;
+
+	e = 31 - __builtin_clz(us);
+
+	return REPAINT_HISTOGRAM_LINEAR +
+		((e - 4) << REPAINT_HISTOGRAM_SUB_BITS) +
+		((us >> (e - REPAINT_HISTOGRAM_SUB_BITS)) &
+		 ((1 << REPAINT_HISTOGRAM_SUB_BITS) - 1));
+}
+
+/* The largest value that falls into bucket i. */
+static uint32_t
+bucket_upper(int i)
+{
+	int e, sub;
+	uint64_t lower;
+
+	if (i < REPAINT_HISTOGRAM_LINEAR)
+		return i;
+
+	i -= REPAINT_HISTOGRAM_LINEAR;
+	e = (i >> REPAINT_HISTOGRAM_SUB_BITS) + 4;
+	sub = i & ((1 << REPAINT_HISTOGRAM_SUB_BITS) - 1);
+	lower = (uint64_t) ((1 << REPAINT_HISTOGRAM_SUB_BITS) + sub) <<
+		(e - REPAINT_HISTOGRAM_SUB_BITS);
+
+	return lower + (1ull << (e - REPAINT_HISTOGRAM_SUB_BITS)) - 1;
+}
+
+void
+repaint_histogram_reset(struct repaint_histogram *histogram)
+{
+	memset(histogram, 0, sizeof *histogram);
+}
+
+void
+repaint_histogram_add(struct repaint_histogram *histogram, uint32_t us)
+{
+	histogram->buckets[bucket_index(us)]++;
+	histogram->count++;
+	histogram->sum += us;
+	if (us > histogram->max)
+		histogram->max = us;
+}
+
+uint32_t
+repaint_histogram_percentile(const struct repaint_histogram *histogram,
+			     double percent)
+{
+	uint64_t rank, seen = 0;
+	uint32_t upper;
+	int i;
+
+	if (histogram->count == 0)
+		return 0;
+
+	/* The smallest bucket holding at least percent of the samples. */
+	rank = (uint64_t) (histogram->count * percent / 100.0 + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < REPAINT_HISTOGRAM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	upper = bucket_upper(i);
+
+	return upper < histogram->max ? upper : histogram->max;
+}
+
+void
+repaint_stats_reset(struct repaint_stats *stats)
+{
+	int i;
+
+	for (i = 0; i < REPAINT_PHASE_COUNT; i++)
+		repaint_histogram_reset(&stats->phase[i]);
+}
+
+/* One line per phase: output, phase, frames, mean, p50, p99 and max,
+ * all times in microseconds and separated by tabs. */
+void
+repaint_stats_print(const struct repaint_stats *stats, FILE *fp,
+		    const char *output_name)
+{
+	const struct repaint_histogram *h;
+	int i;
+
+	for (i = 0; i < REPAINT_PHASE_COUNT; i++) {
+		h = &stats->phase[i];
+		fprintf(fp, "%s\t%s\t%u\t%" PRIu64 "\t%u\t%u\t%u\n",
+			output_name, repaint_phase_names[i], h->count,
+			h->count ? h->sum / h->count : 0,
+			repaint_histogram_percentile(h, 50),
+			repaint_histogram_percentile(h, 99),
+			h->max);
+	}
+}
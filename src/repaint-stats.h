@@ -0,0 +1,155 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_REPAINT_STATS_H
+#define _WESTON_REPAINT_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Per-output repaint timing.
+ *
+ * weston_output_repaint() is split into phases, each timed with
+ * CLOCK_MONOTONIC and accumulated into a latency histogram.  Buckets
+ * are exact below 16 us and then split every power of two into eight,
+ * so a reported percentile is at most 12.5% above the true value.
+ *
+ * Configuring with --disable-repaint-stats leaves ENABLE_REPAINT_STATS
+ * undefined, and the timing helpers below compile to nothing.
+ */
+
+enum repaint_phase {
+	REPAINT_PHASE_SURFACE_LIST,	/* surface list and output view */
+	REPAINT_PHASE_ASSIGN_PLANES,
+	REPAINT_PHASE_DAMAGE,		/* damage and visibility */
+	REPAINT_PHASE_RENDER,		/* output->repaint */
+	REPAINT_PHASE_INPUT,		/* repick and queued input */
+	REPAINT_PHASE_FRAME_CALLBACKS,
+	REPAINT_PHASE_ANIMATIONS,
+	REPAINT_PHASE_TOTAL,
+	REPAINT_PHASE_COUNT
+};
+
+#define REPAINT_HISTOGRAM_LINEAR 16
+#define REPAINT_HISTOGRAM_SUB_BITS 3
+#define REPAINT_HISTOGRAM_BUCKETS \
+	(REPAINT_HISTOGRAM_LINEAR + (32 - 4) * (1 << REPAINT_HISTOGRAM_SUB_BITS))
+
+struct repaint_histogram {
+	uint32_t buckets[REPAINT_HISTOGRAM_BUCKETS];
+	uint32_t count;
+	uint32_t max;			/* us */
+	uint64_t sum;			/* us */
+};
+
+struct repaint_stats {
+	struct repaint_histogram phase[REPAINT_PHASE_COUNT];
+	struct timespec start;
+	struct timespec mark;
+};
+
+extern const char * const repaint_phase_names[REPAINT_PHASE_COUNT];
+
+void
+repaint_histogram_reset(struct repaint_histogram *histogram);
+
+void
+repaint_histogram_add(struct repaint_histogram *histogram, uint32_t us);
+
+uint32_t
+repaint_histogram_percentile(const struct repaint_histogram *histogram,
+			     double percent);
+
+void
+repaint_stats_reset(struct repaint_stats *stats);
+
+void
+repaint_stats_print(const struct repaint_stats *stats, FILE *fp,
+		    const char *output_name);
+
+#ifdef ENABLE_REPAINT_STATS
+
+static inline uint32_t
+repaint_stats_elapsed_us(const struct timespec *from,
+			 const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000 +
+		(to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+static inline void
+repaint_stats_begin(struct repaint_stats *stats)
+{
+	if (!stats)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &stats->start);
+	stats->mark = stats->start;
+}
+
+/* Accounts the time since the previous mark to phase. */
+static inline void
+repaint_stats_mark(struct repaint_stats *stats, enum repaint_phase phase)
+{
+	struct timespec now;
+
+	if (!stats)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	repaint_histogram_add(&stats->phase[phase],
+			      repaint_stats_elapsed_us(&stats->mark, &now));
+	stats->mark = now;
+}
+
+static inline void
+repaint_stats_end(struct repaint_stats *stats)
+{
+	if (!stats)
+		return;
+
+	repaint_histogram_add(&stats->phase[REPAINT_PHASE_TOTAL],
+			      repaint_stats_elapsed_us(&stats->start,
+						       &stats->mark));
+}
+
+#else
+
+static inline void
+repaint_stats_begin(struct repaint_stats *stats)
+{
+}
+
+static inline void
+repaint_stats_mark(struct repaint_stats *stats, enum repaint_phase phase)
+{
+}
+
+static inline void
+repaint_stats_end(struct repaint_stats *stats)
+{
+}
+
+#endif
+
+#endif
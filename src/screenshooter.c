@@ -28,12 +28,21 @@
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/uio.h>
 
 #include "compositor.h"
 #include "screenshooter-server-protocol.h"
+#include "pixel-convert.h"
+#include "wcap-encode.h"
+#include "frame-queue.h"
 
 #include "../wcap/wcap-decode.h"
+#include "../wcap/wcap-compress.h"
+
+#define SCREENCAST_MAX_BUFFERS 8
+#define SCREENCAST_MAX_RECTS 64
 
 struct screenshooter {
 	struct weston_compositor *ec;
@@ -41,131 +50,585 @@ struct screenshooter {
 	struct wl_client *client;
 	struct weston_process process;
 	struct wl_listener destroy_listener;
+
+	/* [screencast] path, the other client allowed to bind. */
+	char *screencast_path;
+	struct wl_client *screencast_client;
+	struct weston_process screencast_process;
+
+	/* The largest read back buffer of a finished shot, reused by
+	 * the next part that cannot read into the client buffer. */
+	uint8_t *spare_pixels;
+	size_t spare_size;
+};
+
+struct screencast_stream {
+	struct wl_resource *resource;
+	struct weston_output *output;
+	struct wl_listener frame_listener;
+	struct wl_listener output_destroy_listener;
+	struct wl_list buffer_list;	/* struct screencast_buffer */
+	int buffer_count;
+	int32_t width, height;		/* framebuffer */
+	pixman_region32_t damage;	/* not delivered yet */
+	uint32_t frames;		/* output frames in damage */
+	uint32_t *pixels;		/* read back, one rectangle */
 };
 
-struct screenshooter_frame_listener {
-	struct wl_listener listener;
+struct screencast_buffer {
+	struct screencast_stream *stream;
 	struct weston_buffer *buffer;
+	struct wl_listener destroy_listener;
+	struct wl_list link;
+};
+
+/* A screenshot request.  It is split into one part per output it
+ * covers; each part reads its rectangle back after the next repaint of
+ * its output, and once all are read the pixels are written to the
+ * client's buffer from an idle callback, outside of the repaint.  A
+ * lone part that needs no transform and matches the client buffer's
+ * row layout reads straight into that buffer instead, and is only
+ * converted in place there. */
+struct screenshooter_shot {
+	struct screenshooter *shooter;
+	struct weston_compositor *compositor;
 	struct wl_resource *resource;
+	struct wl_listener resource_destroy_listener;
+	struct weston_buffer *buffer;
+	struct wl_listener buffer_destroy_listener;
+	struct wl_list part_list;
+	int pending;
+};
+
+struct screenshooter_part {
+	struct screenshooter_shot *shot;
+	struct weston_output *output;
+	struct wl_listener frame_listener;
+	struct wl_listener output_destroy_listener;
+	struct wl_list link;
+
+	int raw;			/* framebuffer as is, for shoot */
+	pixman_box32_t rect;		/* global coordinates */
+	pixman_box32_t fb;		/* framebuffer pixels */
+	int32_t dst_x, dst_y;		/* rect in the client buffer */
+	int planes_disabled;
+	int direct;			/* read into the client buffer */
+	uint8_t *pixels;		/* fb, as read back */
+	size_t size;			/* allocated for pixels */
 };
 
+/* Appends the mapping from output-local coordinates to framebuffer
+ * pixels to t, like transform_rect() below. */
 static void
-copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+output_local_to_fb(struct weston_output *output, pixman_transform_t *t)
 {
-	uint8_t *end;
+	pixman_fixed_t fw, fh;
 
-	end = dst + height * stride;
-	while (dst < end) {
-		memcpy(dst, src, stride);
-		dst += stride;
-		src -= stride;
+	fw = pixman_double_to_fixed((double) output->current_mode->width /
+				    output->current_scale);
+	fh = pixman_double_to_fixed((double) output->current_mode->height /
+				    output->current_scale);
+
+	switch (output->transform) {
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		pixman_transform_scale(t, NULL, pixman_int_to_fixed(-1),
+				       pixman_int_to_fixed(1));
+		pixman_transform_translate(t, NULL,
+					   pixman_int_to_fixed(output->width),
+					   0);
+		break;
+	default:
+		break;
 	}
+
+	switch (output->transform) {
+	default:
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+		break;
+	case WL_OUTPUT_TRANSFORM_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+		pixman_transform_rotate(t, NULL, 0, pixman_fixed_1);
+		pixman_transform_translate(t, NULL, fw, 0);
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		pixman_transform_rotate(t, NULL, -pixman_fixed_1, 0);
+		pixman_transform_translate(t, NULL, fw, fh);
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		pixman_transform_rotate(t, NULL, 0, -pixman_fixed_1);
+		pixman_transform_translate(t, NULL, 0, fh);
+		break;
+	}
+
+	pixman_transform_scale(t, NULL,
+			       pixman_int_to_fixed(output->current_scale),
+			       pixman_int_to_fixed(output->current_scale));
 }
 
-static void
-copy_bgra(uint8_t *dst, uint8_t *src, int height, int stride)
+static int
+output_is_untransformed(struct weston_output *output)
 {
-	/* TODO: optimize this out */
-	memcpy(dst, src, height * stride);
+	return output->transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+		output->current_scale == 1;
 }
 
-static void
-copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
+/* Whether a surface that the renderer does not draw overlaps the part,
+ * so that it can only be captured with planes disabled. */
+static int
+part_needs_primary_plane(struct screenshooter_part *part)
 {
-	uint32_t *dst = vdst;
-	uint32_t *src = vsrc;
-	uint32_t *end = dst + bytes / 4;
+	struct weston_output *output = part->output;
+	struct weston_surface **view = output->surface_view.data;
+	size_t i, count = output->surface_view.size / sizeof *view;
+
+	for (i = 0; i < count; i++) {
+		if (view[i]->plane == &output->compositor->primary_plane)
+			continue;
+
+		if (pixman_region32_contains_rectangle(
+			    &view[i]->transform.boundingbox,
+			    &part->rect) != PIXMAN_REGION_OUT)
+			return 1;
+	}
 
-	while (dst < end) {
-		uint32_t v = *src++;
-		/*                    A R G B */
-		uint32_t tmp = v & 0xff00ff00;
-		tmp |= (v >> 16) & 0x000000ff;
-		tmp |= (v << 16) & 0x00ff0000;
-		*dst++ = tmp;
+	return 0;
+}
+
+/* The pixel_convert() flags from the read format to the client's
+ * xrgb8888, or -1 if pixel_convert() cannot do it. */
+static uint32_t
+screenshooter_convert_flags(struct weston_compositor *compositor)
+{
+	uint32_t flags = 0;
+
+	switch (compositor->read_format) {
+	case PIXMAN_a8r8g8b8:
+	case PIXMAN_x8r8g8b8:
+		break;
+	case PIXMAN_x8b8g8r8:
+	case PIXMAN_a8b8g8r8:
+		flags |= PIXEL_CONVERT_SWAP_RB;
+		break;
+	default:
+		return -1;
 	}
+
+	if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
+		flags |= PIXEL_CONVERT_YFLIP;
+
+	return flags;
 }
 
-static void
-copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+/* Whether the part can be read straight into the client's buffer and
+ * converted in place: renderers write rows of exactly the part's
+ * width, so those must be whole rows of the buffer.  With more than
+ * one part, another one could read over rows this one has not
+ * converted yet. */
+static int
+screenshooter_part_can_read_direct(struct screenshooter_part *part)
 {
-	uint8_t *end;
+	struct screenshooter_shot *shot = part->shot;
+	struct weston_buffer *buffer = shot->buffer;
+	int32_t width = part->fb.x2 - part->fb.x1;
+
+	if (buffer == NULL ||
+	    shot->part_list.next != shot->part_list.prev ||
+	    screenshooter_convert_flags(shot->compositor) == (uint32_t) -1)
+		return 0;
 
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src -= stride;
+	if (!part->raw && !output_is_untransformed(part->output))
+		return 0;
+
+	return part->dst_x == 0 &&
+		wl_shm_buffer_get_stride(buffer->shm_buffer) == width * 4;
+}
+
+static uint8_t *
+screenshooter_get_pixels(struct screenshooter *shooter, size_t size,
+			 size_t *allocated)
+{
+	uint8_t *pixels;
+
+	if (shooter->spare_pixels && shooter->spare_size >= size) {
+		pixels = shooter->spare_pixels;
+		*allocated = shooter->spare_size;
+		shooter->spare_pixels = NULL;
+		shooter->spare_size = 0;
+		return pixels;
 	}
+
+	pixels = malloc(size);
+	*allocated = pixels ? size : 0;
+
+	return pixels;
 }
 
 static void
-copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
+screenshooter_put_pixels(struct screenshooter *shooter, uint8_t *pixels,
+			 size_t size)
 {
-	uint8_t *end;
+	if (size <= shooter->spare_size) {
+		free(pixels);
+		return;
+	}
 
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src += stride;
+	free(shooter->spare_pixels);
+	shooter->spare_pixels = pixels;
+	shooter->spare_size = size;
+}
+
+static void
+screenshooter_shot_finish(void *data);
+
+static void
+screenshooter_part_done(struct screenshooter_part *part)
+{
+	struct screenshooter_shot *shot = part->shot;
+	struct wl_event_loop *loop;
+
+	if (part->output) {
+		if (part->planes_disabled)
+			part->output->disable_planes--;
+		wl_list_remove(&part->frame_listener.link);
+		wl_list_remove(&part->output_destroy_listener.link);
+	}
+
+	if (--shot->pending == 0) {
+		loop = wl_display_get_event_loop(shot->compositor->wl_display);
+		wl_event_loop_add_idle(loop, screenshooter_shot_finish, shot);
 	}
 }
 
 static void
 screenshooter_frame_notify(struct wl_listener *listener, void *data)
 {
-	struct screenshooter_frame_listener *l =
-		container_of(listener,
-			     struct screenshooter_frame_listener, listener);
+	struct screenshooter_part *part =
+		container_of(listener, struct screenshooter_part,
+			     frame_listener);
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
-	int32_t stride;
-	uint8_t *pixels, *d, *s;
+	struct weston_buffer *buffer = part->shot->buffer;
+	int32_t width = part->fb.x2 - part->fb.x1;
+	int32_t height = part->fb.y2 - part->fb.y1;
+	int32_t stride, y;
+	uint8_t *d;
+
+	/* Sprites and cursors are not in the renderer's framebuffer.
+	 * Have them composited for one more frame if they are in the
+	 * way, rather than for every screenshot. */
+	if (!part->planes_disabled && part_needs_primary_plane(part)) {
+		part->planes_disabled = 1;
+		output->disable_planes++;
+		weston_output_schedule_repaint(output);
+		return;
+	}
+
+	if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
+		y = output->current_mode->height - part->fb.y2;
+	else
+		y = part->fb.y1;
+
+	if (screenshooter_part_can_read_direct(part)) {
+		stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+		d = wl_shm_buffer_get_data(buffer->shm_buffer);
+		compositor->renderer->read_pixels(output,
+				compositor->read_format,
+				d + part->dst_y * stride,
+				part->fb.x1, y, width, height);
+		part->direct = 1;
+	} else {
+		part->pixels = screenshooter_get_pixels(part->shot->shooter,
+				width * height *
+				(PIXMAN_FORMAT_BPP(compositor->read_format) / 8),
+				&part->size);
+		if (part->pixels)
+			compositor->renderer->read_pixels(output,
+					compositor->read_format, part->pixels,
+					part->fb.x1, y, width, height);
+	}
+
+	screenshooter_part_done(part);
+}
 
-	output->disable_planes--;
-	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
+static void
+screenshooter_output_destroyed(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_part *part =
+		container_of(listener, struct screenshooter_part,
+			     output_destroy_listener);
+
+	wl_list_remove(&part->frame_listener.link);
+	wl_list_remove(&part->output_destroy_listener.link);
+	part->output = NULL;
+	screenshooter_part_done(part);
+}
 
-	if (pixels == NULL) {
-		wl_resource_post_no_memory(l->resource);
-		free(l);
+/* Converts with pixman what pixel_convert() cannot: rotated, flipped
+ * or scaled outputs, and unusual read formats. */
+static void
+screenshooter_part_composite(struct screenshooter_part *part,
+			     pixman_image_t *dst, int width, int height)
+{
+	struct weston_compositor *compositor = part->shot->compositor;
+	int32_t fb_width = part->fb.x2 - part->fb.x1;
+	int32_t fb_height = part->fb.y2 - part->fb.y1;
+	int bpp = PIXMAN_FORMAT_BPP(compositor->read_format);
+	struct weston_output *output = part->output;
+	pixman_transform_t transform;
+	pixman_image_t *src;
+
+	src = pixman_image_create_bits(compositor->read_format,
+				       fb_width, fb_height,
+				       (uint32_t *) part->pixels,
+				       fb_width * bpp / 8);
+	if (!src)
 		return;
+
+	/* From client buffer to read back pixels. */
+	pixman_transform_init_identity(&transform);
+	if (!part->raw) {
+		pixman_transform_translate(&transform, NULL,
+			pixman_int_to_fixed(part->rect.x1 - part->dst_x -
+					    output->x),
+			pixman_int_to_fixed(part->rect.y1 - part->dst_y -
+					    output->y));
+		output_local_to_fb(output, &transform);
+	}
+	pixman_transform_translate(&transform, NULL,
+				   pixman_int_to_fixed(-part->fb.x1),
+				   pixman_int_to_fixed(-part->fb.y1));
+	if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP) {
+		pixman_transform_scale(&transform, NULL,
+				       pixman_int_to_fixed(1),
+				       pixman_int_to_fixed(-1));
+		pixman_transform_translate(&transform, NULL, 0,
+					   pixman_int_to_fixed(fb_height));
 	}
 
-	compositor->renderer->read_pixels(output,
-			     compositor->read_format, pixels,
-			     0, 0, output->current_mode->width,
-			     output->current_mode->height);
+	pixman_image_set_transform(src, &transform);
+	pixman_image_set_filter(src, PIXMAN_FILTER_NEAREST, NULL, 0);
+	pixman_image_composite32(PIXMAN_OP_SRC, src, NULL, dst,
+				 part->dst_x, part->dst_y, 0, 0,
+				 part->dst_x, part->dst_y, width, height);
+	pixman_image_unref(src);
+}
 
-	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
+static void
+screenshooter_part_copy(struct screenshooter_part *part)
+{
+	struct weston_buffer *buffer = part->shot->buffer;
+	struct weston_compositor *compositor = part->shot->compositor;
+	int32_t stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	uint8_t *d = wl_shm_buffer_get_data(buffer->shm_buffer);
+	int32_t width, height;
+	uint32_t flags;
+	pixman_image_t *dst;
+
+	if (part->raw) {
+		width = part->fb.x2 - part->fb.x1;
+		height = part->fb.y2 - part->fb.y1;
+	} else {
+		width = part->rect.x2 - part->rect.x1;
+		height = part->rect.y2 - part->rect.y1;
+	}
 
-	d = wl_shm_buffer_get_data(l->buffer->shm_buffer);
-	s = pixels + stride * (l->buffer->height - 1);
+	flags = screenshooter_convert_flags(compositor);
 
-	switch (compositor->read_format) {
-	case PIXMAN_a8r8g8b8:
-	case PIXMAN_x8r8g8b8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_bgra_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_bgra(d, pixels, output->current_mode->height, stride);
-		break;
-	case PIXMAN_x8b8g8r8:
-	case PIXMAN_a8b8g8r8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_rgba_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_rgba(d, pixels, output->current_mode->height, stride);
-		break;
-	default:
-		break;
+	if (part->direct) {
+		d += part->dst_y * stride;
+		pixel_convert(d, stride, d, stride, width, height, flags);
+		return;
+	}
+
+	if (flags != (uint32_t) -1 &&
+	    (part->raw || output_is_untransformed(part->output))) {
+		pixel_convert(d + part->dst_y * stride + part->dst_x * 4,
+			      stride, part->pixels, width * 4,
+			      width, height, flags);
+		return;
 	}
 
-	screenshooter_send_done(l->resource);
-	free(pixels);
-	free(l);
+	dst = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+				       buffer->width, buffer->height,
+				       (uint32_t *) d, stride);
+	if (dst) {
+		screenshooter_part_composite(part, dst, width, height);
+		pixman_image_unref(dst);
+	}
+}
+
+static void
+screenshooter_shot_finish(void *data)
+{
+	struct screenshooter_shot *shot = data;
+	struct screenshooter_part *part, *next;
+
+	wl_list_for_each_safe(part, next, &shot->part_list, link) {
+		if (shot->buffer && part->output &&
+		    (part->pixels || part->direct))
+			screenshooter_part_copy(part);
+		if (part->pixels)
+			screenshooter_put_pixels(shot->shooter, part->pixels,
+						 part->size);
+		free(part);
+	}
+
+	if (shot->buffer)
+		wl_list_remove(&shot->buffer_destroy_listener.link);
+	if (shot->resource) {
+		screenshooter_send_done(shot->resource);
+		wl_list_remove(&shot->resource_destroy_listener.link);
+	}
+	free(shot);
+}
+
+static void
+screenshooter_shot_buffer_destroyed(struct wl_listener *listener,
+				    void *data)
+{
+	struct screenshooter_shot *shot =
+		container_of(listener, struct screenshooter_shot,
+			     buffer_destroy_listener);
+
+	shot->buffer = NULL;
+}
+
+static void
+screenshooter_shot_resource_destroyed(struct wl_listener *listener,
+				      void *data)
+{
+	struct screenshooter_shot *shot =
+		container_of(listener, struct screenshooter_shot,
+			     resource_destroy_listener);
+
+	shot->resource = NULL;
+}
+
+static struct screenshooter_shot *
+screenshooter_shot_create(struct screenshooter *shooter,
+			  struct wl_resource *resource,
+			  struct wl_resource *buffer_resource,
+			  int32_t width, int32_t height)
+{
+	struct weston_buffer *buffer =
+		weston_buffer_from_resource(buffer_resource);
+	struct screenshooter_shot *shot;
+
+	if (buffer == NULL) {
+		wl_resource_post_no_memory(resource);
+		return NULL;
+	}
+	if (!wl_shm_buffer_get(buffer->resource))
+		return NULL;
+
+	buffer->shm_buffer = wl_shm_buffer_get(buffer->resource);
+	buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
+	buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
+
+	if (buffer->width < width || buffer->height < height)
+		return NULL;
+
+	shot = zalloc(sizeof *shot);
+	if (shot == NULL) {
+		wl_resource_post_no_memory(resource);
+		return NULL;
+	}
+
+	shot->shooter = shooter;
+	shot->compositor = shooter->ec;
+	shot->resource = resource;
+	shot->resource_destroy_listener.notify =
+		screenshooter_shot_resource_destroyed;
+	wl_resource_add_destroy_listener(resource,
+					 &shot->resource_destroy_listener);
+	shot->buffer = buffer;
+	shot->buffer_destroy_listener.notify =
+		screenshooter_shot_buffer_destroyed;
+	wl_signal_add(&buffer->destroy_signal, &shot->buffer_destroy_listener);
+	wl_list_init(&shot->part_list);
+
+	return shot;
+}
+
+static void
+box_from_corners(pixman_box32_t *box, int x1, int y1, int x2, int y2)
+{
+	box->x1 = MIN(x1, x2);
+	box->y1 = MIN(y1, y2);
+	box->x2 = x1 < x2 ? x2 : x1;
+	box->y2 = y1 < y2 ? y2 : y1;
+}
+
+static int
+screenshooter_shot_add_part(struct screenshooter_shot *shot,
+			    struct weston_output *output,
+			    pixman_box32_t *rect, int raw)
+{
+	struct screenshooter_part *part;
+	pixman_transform_t transform;
+	struct pixman_vector v1, v2;
+
+	part = zalloc(sizeof *part);
+	if (part == NULL)
+		return -1;
+
+	part->shot = shot;
+	part->output = output;
+	part->raw = raw;
+	part->rect = *rect;
+
+	if (raw) {
+		part->fb.x2 = output->current_mode->width;
+		part->fb.y2 = output->current_mode->height;
+	} else {
+		pixman_transform_init_identity(&transform);
+		output_local_to_fb(output, &transform);
+		v1.vector[0] = pixman_int_to_fixed(rect->x1 - output->x);
+		v1.vector[1] = pixman_int_to_fixed(rect->y1 - output->y);
+		v1.vector[2] = pixman_fixed_1;
+		v2.vector[0] = pixman_int_to_fixed(rect->x2 - output->x);
+		v2.vector[1] = pixman_int_to_fixed(rect->y2 - output->y);
+		v2.vector[2] = pixman_fixed_1;
+		pixman_transform_point(&transform, &v1);
+		pixman_transform_point(&transform, &v2);
+
+		box_from_corners(&part->fb,
+				 pixman_fixed_to_int(v1.vector[0]),
+				 pixman_fixed_to_int(v1.vector[1]),
+				 pixman_fixed_to_int(v2.vector[0]),
+				 pixman_fixed_to_int(v2.vector[1]));
+	}
+
+	part->frame_listener.notify = screenshooter_frame_notify;
+	wl_signal_add(&output->frame_signal, &part->frame_listener);
+	part->output_destroy_listener.notify = screenshooter_output_destroyed;
+	wl_signal_add(&output->destroy_signal,
+		      &part->output_destroy_listener);
+	wl_list_insert(shot->part_list.prev, &part->link);
+	shot->pending++;
+
+	weston_output_schedule_repaint(output);
+
+	return 0;
+}
+
+/* Finishes right away a shot that has no outputs to wait for. */
+static void
+screenshooter_shot_start(struct screenshooter_shot *shot)
+{
+	struct wl_event_loop *loop;
+
+	if (shot->pending > 0)
+		return;
+
+	loop = wl_display_get_event_loop(shot->compositor->wl_display);
+	wl_event_loop_add_idle(loop, screenshooter_shot_finish, shot);
 }
 
 static void
@@ -174,44 +637,402 @@ screenshooter_shoot(struct wl_client *client,
 		    struct wl_resource *output_resource,
 		    struct wl_resource *buffer_resource)
 {
+	struct screenshooter *shooter = wl_resource_get_user_data(resource);
 	struct weston_output *output =
 		wl_resource_get_user_data(output_resource);
-	struct screenshooter_frame_listener *l;
-	struct weston_buffer *buffer =
-		weston_buffer_from_resource(buffer_resource);
+	struct screenshooter_shot *shot;
+	pixman_box32_t rect;
 
-	if (buffer == NULL) {
+	shot = screenshooter_shot_create(shooter, resource, buffer_resource,
+					 output->current_mode->width,
+					 output->current_mode->height);
+	if (shot == NULL)
+		return;
+
+	rect.x1 = output->x;
+	rect.y1 = output->y;
+	rect.x2 = output->x + output->width;
+	rect.y2 = output->y + output->height;
+	if (screenshooter_shot_add_part(shot, output, &rect, 1) < 0)
 		wl_resource_post_no_memory(resource);
+
+	screenshooter_shot_start(shot);
+}
+
+static void
+screenshooter_shoot_region(struct wl_client *client,
+			   struct wl_resource *resource,
+			   struct wl_resource *buffer_resource,
+			   int32_t x, int32_t y,
+			   int32_t width, int32_t height)
+{
+	struct screenshooter *shooter = wl_resource_get_user_data(resource);
+	struct weston_compositor *compositor = shooter->ec;
+	struct screenshooter_shot *shot;
+	struct screenshooter_part *part;
+	struct weston_output *output;
+	pixman_region32_t region;
+	pixman_box32_t *rect;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	shot = screenshooter_shot_create(shooter, resource, buffer_resource,
+					 width, height);
+	if (shot == NULL)
 		return;
+
+	pixman_region32_init(&region);
+	wl_list_for_each(output, &compositor->output_list, link) {
+		pixman_region32_intersect_rect(&region, &output->region,
+					       x, y, width, height);
+		if (!pixman_region32_not_empty(&region))
+			continue;
+
+		rect = pixman_region32_extents(&region);
+		if (screenshooter_shot_add_part(shot, output, rect, 0) < 0) {
+			wl_resource_post_no_memory(resource);
+			break;
+		}
+		part = container_of(shot->part_list.prev,
+				    struct screenshooter_part, link);
+		part->dst_x = rect->x1 - x;
+		part->dst_y = rect->y1 - y;
 	}
-	if (!wl_shm_buffer_get(buffer->resource))
+	pixman_region32_fini(&region);
+
+	screenshooter_shot_start(shot);
+}
+
+static void
+transform_rect(struct weston_output *output, pixman_box32_t *r);
+
+static void
+screencast_buffer_destroy(struct screencast_buffer *cb)
+{
+	cb->stream->buffer_count--;
+	wl_list_remove(&cb->destroy_listener.link);
+	wl_list_remove(&cb->link);
+	free(cb);
+}
+
+static void
+screencast_buffer_destroyed(struct wl_listener *listener, void *data)
+{
+	struct screencast_buffer *cb =
+		container_of(listener, struct screencast_buffer,
+			     destroy_listener);
+
+	screencast_buffer_destroy(cb);
+}
+
+static void
+screencast_stream_drop_buffers(struct screencast_stream *stream)
+{
+	struct screencast_buffer *cb, *next;
+
+	wl_list_for_each_safe(cb, next, &stream->buffer_list, link)
+		screencast_buffer_destroy(cb);
+}
+
+/* Starts over with the current framebuffer size, which the client
+ * learns from the format event. */
+static void
+screencast_stream_reset(struct screencast_stream *stream)
+{
+	struct weston_output *output = stream->output;
+
+	stream->width = output->current_mode->width;
+	stream->height = output->current_mode->height;
+	screencast_stream_drop_buffers(stream);
+
+	free(stream->pixels);
+	stream->pixels = malloc(stream->width * stream->height * 4);
+	if (stream->pixels == NULL)
+		wl_resource_post_no_memory(stream->resource);
+
+	pixman_region32_fini(&stream->damage);
+	pixman_region32_init_rect(&stream->damage, 0, 0,
+				  stream->width, stream->height);
+
+	screencast_stream_send_format(stream->resource,
+				      stream->width, stream->height);
+}
+
+static void
+screencast_stream_deliver(struct screencast_stream *stream)
+{
+	struct weston_output *output = stream->output;
+	struct weston_compositor *compositor = output->compositor;
+	pixman_format_code_t format = compositor->read_format;
+	struct screencast_buffer *cb;
+	struct weston_buffer *buffer;
+	pixman_box32_t *r;
+	uint32_t flags = 0;
+	int32_t stride, width, height, y;
+	uint8_t *d;
+	int i, n;
+
+	if (!pixman_region32_not_empty(&stream->damage) ||
+	    wl_list_empty(&stream->buffer_list) || !stream->pixels)
 		return;
-	
-	buffer->shm_buffer = wl_shm_buffer_get(buffer->resource);
-	buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
-	buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
 
-	if (buffer->width < output->current_mode->width ||
-	    buffer->height < output->current_mode->height)
+	switch (format) {
+	case PIXMAN_x8b8g8r8:
+	case PIXMAN_a8b8g8r8:
+		flags |= PIXEL_CONVERT_SWAP_RB;
+		break;
+	case PIXMAN_a8r8g8b8:
+	case PIXMAN_x8r8g8b8:
+		break;
+	default:
+		/* Have the renderer convert anything else. */
+		format = PIXMAN_a8r8g8b8;
+		break;
+	}
+
+	if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
+		flags |= PIXEL_CONVERT_YFLIP;
+
+	cb = container_of(stream->buffer_list.next,
+			  struct screencast_buffer, link);
+	buffer = cb->buffer;
+	stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	d = wl_shm_buffer_get_data(buffer->shm_buffer);
+
+	r = pixman_region32_rectangles(&stream->damage, &n);
+	for (i = 0; i < n; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		if (flags & PIXEL_CONVERT_YFLIP)
+			y = stream->height - r[i].y2;
+		else
+			y = r[i].y1;
+
+		compositor->renderer->read_pixels(output, format,
+						  stream->pixels,
+						  r[i].x1, y, width, height);
+		pixel_convert(d + r[i].y1 * stride + r[i].x1 * 4, stride,
+			      stream->pixels, width * 4,
+			      width, height, flags);
+
+		screencast_stream_send_damage(stream->resource,
+					      r[i].x1, r[i].y1,
+					      width, height);
+	}
+
+	screencast_stream_send_frame(stream->resource, buffer->resource,
+				     output->frame_time, stream->frames);
+
+	screencast_buffer_destroy(cb);
+	pixman_region32_fini(&stream->damage);
+	pixman_region32_init(&stream->damage);
+	stream->frames = 0;
+}
+
+static void
+screencast_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct screencast_stream *stream =
+		container_of(listener, struct screencast_stream,
+			     frame_listener);
+	struct weston_output *output = data;
+	pixman_region32_t damage;
+	pixman_box32_t *r, box;
+	int i, n;
+
+	if (output->current_mode->width != stream->width ||
+	    output->current_mode->height != stream->height)
+		screencast_stream_reset(stream);
+
+	pixman_region32_init(&damage);
+	pixman_region32_intersect(&damage, &output->region,
+				  &output->previous_damage);
+	pixman_region32_translate(&damage, -output->x, -output->y);
+	r = pixman_region32_rectangles(&damage, &n);
+	for (i = 0; i < n; i++) {
+		box = r[i];
+		transform_rect(output, &box);
+		pixman_region32_union_rect(&stream->damage, &stream->damage,
+					   box.x1, box.y1,
+					   box.x2 - box.x1, box.y2 - box.y1);
+	}
+	pixman_region32_fini(&damage);
+
+	/* Damage is written straight into the client's buffer. */
+	pixman_region32_intersect_rect(&stream->damage, &stream->damage,
+				       0, 0, stream->width, stream->height);
+
+	/* A client that falls behind gets its damage merged, in a
+	 * bounded number of rectangles. */
+	if (pixman_region32_n_rects(&stream->damage) > SCREENCAST_MAX_RECTS) {
+		box = *pixman_region32_extents(&stream->damage);
+		pixman_region32_reset(&stream->damage, &box);
+	}
+
+	if (pixman_region32_not_empty(&stream->damage))
+		stream->frames++;
+
+	screencast_stream_deliver(stream);
+}
+
+static void
+screencast_stream_detach(struct screencast_stream *stream)
+{
+	wl_list_remove(&stream->frame_listener.link);
+	wl_list_remove(&stream->output_destroy_listener.link);
+	screencast_stream_drop_buffers(stream);
+}
+
+static void
+screencast_output_destroyed(struct wl_listener *listener, void *data)
+{
+	struct screencast_stream *stream =
+		container_of(listener, struct screencast_stream,
+			     output_destroy_listener);
+
+	/* The stream stays, but no frames come anymore. */
+	screencast_stream_detach(stream);
+	stream->output = NULL;
+}
+
+static void
+screencast_stream_lend_buffer(struct wl_client *client,
+			      struct wl_resource *resource,
+			      struct wl_resource *buffer_resource)
+{
+	struct screencast_stream *stream = wl_resource_get_user_data(resource);
+	struct weston_buffer *buffer;
+	struct wl_shm_buffer *shm_buffer;
+	struct screencast_buffer *cb;
+	uint32_t format = 0;
+
+	if (stream->output == NULL)
+		return;
+
+	shm_buffer = wl_shm_buffer_get(buffer_resource);
+	if (shm_buffer)
+		format = wl_shm_buffer_get_format(shm_buffer);
+	if (!shm_buffer ||
+	    (format != WL_SHM_FORMAT_XRGB8888 &&
+	     format != WL_SHM_FORMAT_ARGB8888) ||
+	    wl_shm_buffer_get_width(shm_buffer) < stream->width ||
+	    wl_shm_buffer_get_height(shm_buffer) < stream->height) {
+		wl_resource_post_error(resource,
+				       SCREENCAST_STREAM_ERROR_INVALID_BUFFER,
+				       "buffer is not a large enough "
+				       "xrgb8888 or argb8888 shm buffer");
+		return;
+	}
+
+	if (stream->buffer_count == SCREENCAST_MAX_BUFFERS) {
+		wl_resource_post_error(resource,
+				       SCREENCAST_STREAM_ERROR_TOO_MANY_BUFFERS,
+				       "more than %d buffers lent",
+				       SCREENCAST_MAX_BUFFERS);
+		return;
+	}
+
+	buffer = weston_buffer_from_resource(buffer_resource);
+	cb = malloc(sizeof *cb);
+	if (buffer == NULL || cb == NULL) {
+		free(cb);
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	buffer->shm_buffer = shm_buffer;
+	buffer->width = wl_shm_buffer_get_width(shm_buffer);
+	buffer->height = wl_shm_buffer_get_height(shm_buffer);
+
+	cb->stream = stream;
+	cb->buffer = buffer;
+	cb->destroy_listener.notify = screencast_buffer_destroyed;
+	wl_signal_add(&buffer->destroy_signal, &cb->destroy_listener);
+	wl_list_insert(stream->buffer_list.prev, &cb->link);
+	stream->buffer_count++;
+
+	/* Damage has been waiting for a buffer; a repaint delivers it,
+	 * even if nothing else changes. */
+	if (pixman_region32_not_empty(&stream->damage))
+		weston_output_schedule_repaint(stream->output);
+}
+
+static void
+screencast_stream_destroy(struct wl_client *client,
+			  struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct screencast_stream_interface screencast_stream_implementation = {
+	screencast_stream_destroy,
+	screencast_stream_lend_buffer
+};
+
+static void
+destroy_screencast_stream(struct wl_resource *resource)
+{
+	struct screencast_stream *stream = wl_resource_get_user_data(resource);
+
+	if (stream->output) {
+		screencast_stream_detach(stream);
+		stream->output->disable_planes--;
+	}
+	pixman_region32_fini(&stream->damage);
+	free(stream->pixels);
+	free(stream);
+}
+
+static void
+screenshooter_screencast(struct wl_client *client,
+			 struct wl_resource *resource,
+			 uint32_t id, struct wl_resource *output_resource)
+{
+	struct weston_output *output =
+		wl_resource_get_user_data(output_resource);
+	struct screencast_stream *stream;
+
+	stream = zalloc(sizeof *stream);
+	if (stream == NULL) {
+		wl_resource_post_no_memory(resource);
 		return;
+	}
 
-	l = malloc(sizeof *l);
-	if (l == NULL) {
+	stream->resource = wl_resource_create(client,
+					      &screencast_stream_interface,
+					      1, id);
+	if (stream->resource == NULL) {
+		free(stream);
 		wl_resource_post_no_memory(resource);
 		return;
 	}
 
-	l->buffer = buffer;
-	l->resource = resource;
+	wl_resource_set_implementation(stream->resource,
+				       &screencast_stream_implementation,
+				       stream, destroy_screencast_stream);
+
+	stream->output = output;
+	wl_list_init(&stream->buffer_list);
+	pixman_region32_init(&stream->damage);
 
-	l->listener.notify = screenshooter_frame_notify;
-	wl_signal_add(&output->frame_signal, &l->listener);
+	stream->frame_listener.notify = screencast_frame_notify;
+	wl_signal_add(&output->frame_signal, &stream->frame_listener);
+	stream->output_destroy_listener.notify = screencast_output_destroyed;
+	wl_signal_add(&output->destroy_signal,
+		      &stream->output_destroy_listener);
+
+	/* Like the recorder, keep everything in the framebuffer. */
 	output->disable_planes++;
-	weston_output_schedule_repaint(output);
+
+	screencast_stream_reset(stream);
 }
 
 struct screenshooter_interface screenshooter_implementation = {
-	screenshooter_shoot
+	screenshooter_shoot,
+	screenshooter_shoot_region,
+	screenshooter_screencast
 };
 
 static void
@@ -221,13 +1042,15 @@ bind_shooter(struct wl_client *client,
 	struct screenshooter *shooter = data;
 	struct wl_resource *resource;
 
-	resource = wl_resource_create(client,
-				      &screenshooter_interface, 1, id);
+	resource = wl_resource_create(client, &screenshooter_interface,
+				      MIN(version, 3), id);
 
-	if (client != shooter->client) {
+	if (client != shooter->client &&
+	    client != shooter->screencast_client) {
 		wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_OBJECT,
 				       "screenshooter failed: permission denied");
 		wl_resource_destroy(resource);
+		return;
 	}
 
 	wl_resource_set_implementation(resource, &screenshooter_implementation,
@@ -256,47 +1079,52 @@ screenshooter_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 					screenshooter_exe, screenshooter_sigchld);
 }
 
+#define RECORDER_QUEUE_LENGTH 4
+
+/* A full frame at most this often, so that players can seek. */
+#define RECORDER_KEYFRAME_MSECS 10000
+
+/* Damage read back on the compositor thread, waiting to be encoded. */
+struct recorder_frame {
+	uint32_t msecs;
+	int keyframe;
+	struct wl_array rects;		/* pixman_box32_t, framebuffer */
+	uint32_t *pixels;		/* the rects, one after the other */
+};
+
+/* The compositor thread only reads back pixels into the frame queue;
+ * the delta and RLE encoding and the file writes happen on the encoder
+ * thread.  When the queue is full, the frame's damage is carried over
+ * to the next frame instead, so the file stays consistent and only
+ * loses intermediate frames. */
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
-	uint32_t *tmpbuf;
-	uint32_t total;
+	uint32_t *frame;		/* encoder thread only */
+	int32_t width, height;
 	int fd;
 	struct wl_listener frame_listener;
-	int count;
+	pixman_region32_t damage;	/* global, not queued yet */
+	uint32_t compression;		/* WCAP_COMPRESSION_* */
+	void *compressed;		/* encoder thread only */
+	size_t compressed_size;
+
+	pthread_t thread;
+	struct frame_queue queue;
+	struct recorder_frame slots[RECORDER_QUEUE_LENGTH];
+
+	/* Compositor thread */
+	int frames, coalesced, max_queued;
+	uint32_t keyframe_msecs;
+
+	/* Encoder thread, read after it is joined */
+	uint64_t total;
+	struct wl_array index;		/* struct wcap_index_entry */
+	uint64_t pixels_encoded;
+	uint64_t encoded_bytes, compressed_bytes;
+	uint64_t encode_ns, compress_ns, write_ns;
+	int compress_failures;
 };
 
-static uint32_t *
-output_run(uint32_t *p, uint32_t delta, int run)
-{
-	int i;
-
-	while (run > 0) {
-		if (run <= 0xe0) {
-			*p++ = delta | ((run - 1) << 24);
-			break;
-		}
-
-		i = 24 - __builtin_clz(run);
-		*p++ = delta | ((i + 0xe0) << 24);
-		run -= 1 << (7 + i);
-	}
-
-	return p;
-}
-
-static uint32_t
-component_delta(uint32_t next, uint32_t prev)
-{
-	unsigned char dr, dg, db;
-
-	dr = (next >> 16) - (prev >> 16);
-	dg = (next >>  8) - (prev >>  8);
-	db = (next >>  0) - (prev >>  0);
-
-	return (dr << 16) | (dg << 8) | (db << 0);
-}
-
 static void
 transform_rect(struct weston_output *output, pixman_box32_t *r)
 {
@@ -351,136 +1179,301 @@ transform_rect(struct weston_output *output, pixman_box32_t *r)
 	r->y2 *= output->current_scale;
 }
 
+static uint64_t
+elapsed_ns(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000000ULL +
+		to->tv_nsec - from->tv_nsec;
+}
+
+/* Encodes a frame into the file, on the encoder thread.  Each pixel
+ * becomes at most one word, so the runs of all rectangles are packed
+ * over the frame's own pixels, and then compressed as one block if
+ * the recording is compressed. */
 static void
-weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+recorder_encode_frame(struct weston_recorder *recorder,
+		      struct recorder_frame *frame, int do_yflip)
 {
-	struct weston_recorder *recorder =
-		container_of(listener, struct weston_recorder, frame_listener);
-	struct weston_output *output = data;
-	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = output->frame_time;
-	pixman_box32_t *r;
-	pixman_region32_t damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
+	static const uint32_t zero;
+	pixman_box32_t *r = frame->rects.data;
+	int i, n, width, height, stride, nv;
+	uint32_t *d, *s, *p;
 	struct {
 		uint32_t msecs;
 		uint32_t nrects;
 	} header;
-	struct iovec v[2];
-	int do_yflip;
-	int y_orig;
-	uint32_t *outbuf;
+	struct wcap_compressed_header compressed;
+	size_t size;
+	struct iovec v[5];
+	struct timespec start, encoded, compressed_time, written;
+	struct wcap_index_entry *entry;
+
+	n = frame->rects.size / sizeof *r;
+	header.msecs = frame->msecs;
+	header.nrects = n;
 
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
+	entry = wl_array_add(&recorder->index, sizeof *entry);
+	if (entry) {
+		entry->offset = recorder->total;
+		entry->msecs = frame->msecs;
+		entry->flags = 0;
+	}
 
-	pixman_region32_init(&damage);
-	pixman_region32_intersect(&damage, &output->region,
-				  &output->previous_damage);
+	/* Keyframes cover the whole framebuffer and are encoded against
+	 * black, so that they decode on their own. */
+	if (frame->keyframe) {
+		header.nrects |= WCAP_FRAME_KEYFRAME;
+		if (entry)
+			entry->flags = WCAP_FRAME_KEYFRAME;
+		memset(recorder->frame, 0,
+		       recorder->width * recorder->height * 4);
+	}
 
-	r = pixman_region32_rectangles(&damage, &n);
-	if (n == 0)
-		return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	s = p = frame->pixels;
+	for (i = 0; i < n; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
 
-	for (i = 0; i < n; i++)
-		transform_rect(output, &r[i]);
+		/* The rows were read bottom-up with y-flip. */
+		stride = recorder->width;
+		if (do_yflip) {
+			d = recorder->frame + stride * (r[i].y2 - 1) + r[i].x1;
+			stride = -stride;
+		} else {
+			d = recorder->frame + stride * r[i].y1 + r[i].x1;
+		}
+
+		p = wcap_encode_rect(p, s, width, height, d, stride);
+		s += width * height;
+		recorder->pixels_encoded += width * height;
+	}
+	size = (p - frame->pixels) * 4;
+	clock_gettime(CLOCK_MONOTONIC, &encoded);
 
-	header.msecs = msecs;
-	header.nrects = n;
 	v[0].iov_base = &header;
 	v[0].iov_len = sizeof header;
 	v[1].iov_base = r;
 	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
+	v[2].iov_base = frame->pixels;
+	v[2].iov_len = size;
+	nv = 3;
+
+	if (recorder->compression != WCAP_COMPRESSION_NONE) {
+		compressed.size = size;
+		compressed.compressed_size =
+			wcap_compress(recorder->compression,
+				      recorder->compressed,
+				      recorder->compressed_size,
+				      frame->pixels, size);
+		v[3].iov_base = recorder->compressed;
+
+		/* The reference frame already holds the new pixels, so a
+		 * frame that failed to compress still has to go out; and
+		 * one that does not shrink might as well.  Equal sizes mark
+		 * the runs as stored as they are. */
+		if (compressed.compressed_size == 0)
+			recorder->compress_failures++;
+		if (compressed.compressed_size == 0 ||
+		    compressed.compressed_size >= size) {
+			compressed.compressed_size = size;
+			v[3].iov_base = frame->pixels;
+		}
+
+		v[2].iov_base = &compressed;
+		v[2].iov_len = sizeof compressed;
+		v[3].iov_len = compressed.compressed_size;
+		v[4].iov_base = (void *) &zero;
+		v[4].iov_len = -compressed.compressed_size & 3;
+		nv = 5;
+		recorder->compressed_bytes += compressed.compressed_size;
+	}
+	recorder->encoded_bytes += size;
+	clock_gettime(CLOCK_MONOTONIC, &compressed_time);
+
+	recorder->total += writev(recorder->fd, v, nv);
+	clock_gettime(CLOCK_MONOTONIC, &written);
+
+	recorder->encode_ns += elapsed_ns(&start, &encoded);
+	recorder->compress_ns += elapsed_ns(&encoded, &compressed_time);
+	recorder->write_ns += elapsed_ns(&compressed_time, &written);
+}
+
+static void *
+recorder_thread_function(void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct weston_compositor *compositor = recorder->output->compositor;
+	int do_yflip;
+	int slot;
+
+	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	while ((slot = frame_queue_wait(&recorder->queue)) >= 0) {
+		recorder_encode_frame(recorder, &recorder->slots[slot],
+				      do_yflip);
+		frame_queue_pop(&recorder->queue);
+	}
+
+	return NULL;
+}
 
+static void
+weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_recorder *recorder =
+		container_of(listener, struct weston_recorder, frame_listener);
+	struct weston_output *output = data;
+	struct weston_compositor *compositor = output->compositor;
+	struct recorder_frame *frame;
+	pixman_box32_t *r, *box;
+	int i, n, width, height, queued, slot;
+	int do_yflip, keyframe;
+	int y_orig;
+	uint32_t *pixels;
+
+	/* The file has one frame size. */
+	if (output->current_mode->width != recorder->width ||
+	    output->current_mode->height != recorder->height)
+		return;
+
+	pixman_region32_union(&recorder->damage, &recorder->damage,
+			      &output->previous_damage);
+	pixman_region32_intersect(&recorder->damage, &recorder->damage,
+				  &output->region);
+	if (!pixman_region32_not_empty(&recorder->damage))
+		return;
+
+	/* The slot stays ours until we queue it. */
+	slot = frame_queue_tail(&recorder->queue, &queued);
+	if (slot < 0) {
+		recorder->coalesced++;
+		return;
+	}
+	if (queued + 1 > recorder->max_queued)
+		recorder->max_queued = queued + 1;
+
+	keyframe = recorder->frames == 0 ||
+		output->frame_time - recorder->keyframe_msecs >=
+		RECORDER_KEYFRAME_MSECS;
+	if (keyframe) {
+		pixman_region32_copy(&recorder->damage, &output->region);
+		recorder->keyframe_msecs = output->frame_time;
+	}
+
+	frame = &recorder->slots[slot];
+	frame->msecs = output->frame_time;
+	frame->keyframe = keyframe;
+	frame->rects.size = 0;
+
+	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	r = pixman_region32_rectangles(&recorder->damage, &n);
+	pixels = frame->pixels;
 	for (i = 0; i < n; i++) {
-		width = r[i].x2 - r[i].x1;
-		height = r[i].y2 - r[i].y1;
+		box = wl_array_add(&frame->rects, sizeof *box);
+		if (box == NULL)
+			return;
+		*box = r[i];
+		transform_rect(output, box);
+
+		width = box->x2 - box->x1;
+		height = box->y2 - box->y1;
 
 		if (do_yflip)
-			y_orig = output->current_mode->height - r[i].y2;
+			y_orig = output->current_mode->height - box->y2;
 		else
-			y_orig = r[i].y1;
+			y_orig = box->y1;
 
 		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
-				r[i].x1, y_orig, width, height);
-
-		s = recorder->rect;
-		p = outbuf;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				y_orig = r[i].y2 - j - 1;
-			else
-				y_orig = r[i].y1 + j;
-			d = recorder->frame + stride * y_orig + r[i].x1;
-
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
-		}
+				compositor->read_format, pixels,
+				box->x1, y_orig, width, height);
+		pixels += width * height;
+	}
 
-		p = output_run(p, prev, run);
+	frame_queue_push(&recorder->queue);
 
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
+	pixman_region32_fini(&recorder->damage);
+	pixman_region32_init(&recorder->damage);
+	recorder->frames++;
+}
 
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
-	}
+static void
+weston_recorder_destroy(struct weston_recorder *recorder)
+{
+	int i;
 
-	pixman_region32_fini(&damage);
-	recorder->count++;
+	for (i = 0; i < RECORDER_QUEUE_LENGTH; i++) {
+		wl_array_release(&recorder->slots[i].rects);
+		free(recorder->slots[i].pixels);
+	}
+	wl_array_release(&recorder->index);
+	frame_queue_release(&recorder->queue);
+	pixman_region32_fini(&recorder->damage);
+	free(recorder->compressed);
+	free(recorder->frame);
+	free(recorder);
 }
 
-static void
-weston_recorder_create(struct weston_output *output, const char *filename)
+WL_EXPORT struct weston_recorder *
+weston_recorder_start(struct weston_output *output, const char *filename)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_recorder *recorder;
-	int stride, size;
+	struct weston_config_section *section;
+	char *compression;
+	int size, i;
 	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	struct iovec v[2];
 
-	recorder = malloc(sizeof *recorder);
+	recorder = zalloc(sizeof *recorder);
+	if (recorder == NULL)
+		return NULL;
 
-	stride = output->current_mode->width;
-	size = stride * 4 * output->current_mode->height;
-	recorder->frame = zalloc(size);
-	recorder->rect = malloc(size);
-	recorder->total = 0;
-	recorder->count = 0;
 	recorder->output = output;
+	recorder->width = output->current_mode->width;
+	recorder->height = output->current_mode->height;
+	recorder->fd = -1;
+	pixman_region32_init(&recorder->damage);
+	wl_array_init(&recorder->index);
+	frame_queue_init(&recorder->queue, RECORDER_QUEUE_LENGTH);
+
+	size = recorder->width * 4 * recorder->height;
+	recorder->frame = zalloc(size);
+	if (recorder->frame == NULL)
+		goto err;
+	for (i = 0; i < RECORDER_QUEUE_LENGTH; i++) {
+		wl_array_init(&recorder->slots[i].rects);
+		recorder->slots[i].pixels = malloc(size);
+		if (recorder->slots[i].pixels == NULL)
+			goto err;
+	}
 
-	if (do_yflip)
-		recorder->tmpbuf = NULL;
-	else
-		recorder->tmpbuf = malloc(size);
+	section = weston_config_get_section(compositor->config,
+					    "recorder", NULL, NULL);
+	weston_config_section_get_string(section, "compression",
+					 &compression, "none");
+	i = wcap_compression_from_name(compression);
+	if (i < 0) {
+		weston_log("recorder compression %s not supported, "
+			   "recording uncompressed\n", compression);
+		i = WCAP_COMPRESSION_NONE;
+	}
+	free(compression);
+	recorder->compression = i;
+	if (recorder->compression != WCAP_COMPRESSION_NONE) {
+		/* The runs of a frame can be as large as the frame. */
+		recorder->compressed_size =
+			wcap_compress_bound(recorder->compression, size);
+		recorder->compressed = malloc(recorder->compressed_size);
+		if (recorder->compressed == NULL)
+			goto err;
+	}
 
-	header.magic = WCAP_HEADER_MAGIC;
+	if (recorder->compression == WCAP_COMPRESSION_NONE)
+		header.magic = WCAP_HEADER_MAGIC_V2;
+	else
+		header.magic = WCAP_HEADER_MAGIC_V3;
 
 	switch (compositor->read_format) {
 	case PIXMAN_x8r8g8b8:
@@ -492,8 +1485,7 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		break;
 	default:
 		weston_log("unknown recorder format\n");
-		free(recorder);
-		return;
+		goto err;
 	}
 
 	recorder->fd = open(filename,
@@ -501,30 +1493,85 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 
 	if (recorder->fd < 0) {
 		weston_log("problem opening output file %s: %m\n", filename);
-		free(recorder);
-		return;
+		goto err;
 	}
 
 	header.width = output->current_mode->width;
 	header.height = output->current_mode->height;
-	recorder->total += write(recorder->fd, &header, sizeof header);
+	v[0].iov_base = &header;
+	v[0].iov_len = sizeof header;
+	v[1].iov_base = &recorder->compression;
+	v[1].iov_len = sizeof recorder->compression;
+	recorder->total += writev(recorder->fd, v,
+				  header.magic == WCAP_HEADER_MAGIC_V3 ? 2 : 1);
+
+	if (pthread_create(&recorder->thread, NULL,
+			   recorder_thread_function, recorder) != 0) {
+		weston_log("failed to start recorder thread\n");
+		close(recorder->fd);
+		goto err;
+	}
 
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
 	output->disable_planes++;
 	weston_output_damage(output);
+
+	return recorder;
+
+err:
+	weston_recorder_destroy(recorder);
+	return NULL;
 }
 
-static void
-weston_recorder_destroy(struct weston_recorder *recorder)
+WL_EXPORT void
+weston_recorder_stop(struct weston_recorder *recorder)
 {
+	struct wcap_index_trailer trailer;
+	struct iovec v[2];
+	double encode_s, compress_s, write_s;
+
 	wl_list_remove(&recorder->frame_listener.link);
-	close(recorder->fd);
-	free(recorder->tmpbuf);
-	free(recorder->frame);
-	free(recorder->rect);
 	recorder->output->disable_planes--;
-	free(recorder);
+
+	/* The encoder drains the queue before it quits. */
+	frame_queue_quit(&recorder->queue);
+	pthread_join(recorder->thread, NULL);
+
+	trailer.magic = WCAP_INDEX_MAGIC;
+	trailer.count = recorder->index.size / sizeof(struct wcap_index_entry);
+	v[0].iov_base = recorder->index.data;
+	v[0].iov_len = recorder->index.size;
+	v[1].iov_base = &trailer;
+	v[1].iov_len = sizeof trailer;
+	recorder->total += writev(recorder->fd, v, 2);
+	close(recorder->fd);
+
+	encode_s = recorder->encode_ns / 1e9;
+	compress_s = recorder->compress_ns / 1e9;
+	write_s = recorder->write_ns / 1e9;
+	weston_log("stopping recorder, total file size %dM, %d frames\n",
+		   (int) (recorder->total / (1024 * 1024)), recorder->frames);
+	weston_log_continue(STAMP_SPACE "%d frames coalesced, "
+			    "up to %d of %d queued\n",
+			    recorder->coalesced, recorder->max_queued,
+			    RECORDER_QUEUE_LENGTH);
+	weston_log_continue(STAMP_SPACE "encoder %.1f Mpixel/s, "
+			    "%.1f s encoding, %.1f s writing\n",
+			    encode_s > 0 ?
+			    recorder->pixels_encoded / encode_s / 1e6 : 0.0,
+			    encode_s, write_s);
+	if (recorder->compression != WCAP_COMPRESSION_NONE)
+		weston_log_continue(STAMP_SPACE "%s compressed runs to "
+				    "%.1f%%, %.1f s compressing, "
+				    "%d failures\n",
+				    wcap_compression_name(recorder->compression),
+				    recorder->encoded_bytes ?
+				    100.0 * recorder->compressed_bytes /
+				    recorder->encoded_bytes : 0.0,
+				    compress_s, recorder->compress_failures);
+
+	weston_recorder_destroy(recorder);
 }
 
 static void
@@ -544,18 +1591,37 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *da
 	if (listener) {
 		recorder = container_of(listener, struct weston_recorder,
 					frame_listener);
-
-		weston_log(
-			"stopping recorder, total file size %dM, %d frames\n",
-			recorder->total / (1024 * 1024), recorder->count);
-
-		weston_recorder_destroy(recorder);
+		weston_recorder_stop(recorder);
 	} else {
 		weston_log("starting recorder, file %s\n", filename);
-		weston_recorder_create(output, filename);
+		weston_recorder_start(output, filename);
 	}
 }
 
+static void
+screencast_sigchld(struct weston_process *process, int status)
+{
+	struct screenshooter *shooter =
+		container_of(process, struct screenshooter,
+			     screencast_process);
+
+	weston_log("%s exited with status %d\n",
+		   shooter->screencast_path, status);
+	shooter->screencast_client = NULL;
+}
+
+static void
+launch_screencast_client(void *data)
+{
+	struct screenshooter *shooter = data;
+
+	shooter->screencast_client =
+		weston_client_launch(shooter->ec,
+				     &shooter->screencast_process,
+				     shooter->screencast_path,
+				     screencast_sigchld);
+}
+
 static void
 screenshooter_destroy(struct wl_listener *listener, void *data)
 {
@@ -563,6 +1629,8 @@ screenshooter_destroy(struct wl_listener *listener, void *data)
 		container_of(listener, struct screenshooter, destroy_listener);
 
 	wl_global_destroy(shooter->global);
+	free(shooter->screencast_path);
+	free(shooter->spare_pixels);
 	free(shooter);
 }
 
@@ -570,8 +1638,10 @@ void
 screenshooter_create(struct weston_compositor *ec)
 {
 	struct screenshooter *shooter;
+	struct weston_config_section *section;
+	struct wl_event_loop *loop;
 
-	shooter = malloc(sizeof *shooter);
+	shooter = zalloc(sizeof *shooter);
 	if (shooter == NULL)
 		return;
 
@@ -579,8 +1649,19 @@ screenshooter_create(struct weston_compositor *ec)
 	shooter->client = NULL;
 
 	shooter->global = wl_global_create(ec->wl_display,
-					   &screenshooter_interface, 1,
+					   &screenshooter_interface, 3,
 					   shooter, bind_shooter);
+
+	/* The screencast client is trusted with screen contents like
+	 * weston-screenshooter, so the compositor starts it itself. */
+	section = weston_config_get_section(ec->config,
+					    "screencast", NULL, NULL);
+	weston_config_section_get_string(section, "path",
+					 &shooter->screencast_path, NULL);
+	if (shooter->screencast_path) {
+		loop = wl_display_get_event_loop(ec->wl_display);
+		wl_event_loop_add_idle(loop, launch_screencast_client, shooter);
+	}
 	weston_compositor_add_key_binding(ec, KEY_S, MODIFIER_SUPER,
 					  screenshooter_binding, shooter);
 	weston_compositor_add_key_binding(ec, KEY_R, MODIFIER_SUPER,
@@ -33,14 +33,21 @@
 #include <signal.h>
 #include <math.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 
 #include "compositor.h"
 #include "desktop-shell-server-protocol.h"
 #include "input-method-server-protocol.h"
 #include "workspaces-server-protocol.h"
+#include "window-registry.h"
+#include "trace.h"
 #include "../shared/config-parser.h"
+#include "../shared/os-compatibility.h"
 
 #define DEFAULT_NUM_WORKSPACES 1
+#define THUMBNAIL_MAX_WIDTH 64
+#define THUMBNAIL_MAX_HEIGHT 48
+#define MINIMIZED_RESTORE_TIMEOUT 500
 #define DEFAULT_WORKSPACE_CHANGE_ANIMATION_LENGTH 200
 
 enum animation_type {
@@ -87,7 +94,23 @@ struct input_panel_surface {
 
 struct taskbar {
 	struct weston_layer layer;
-	unsigned int id_count;
+	struct window_registry windows;
+};
+
+struct shell_thumbnail {
+	struct shell_surface *shsurf;
+
+	pixman_image_t *image;
+	void *data;
+	size_t size;
+	int32_t width, height;
+	int fd;			/* kept to resend to a new desktop-shell */
+
+	/* the buffer to sample from on the next idle pass, and the
+	 * parts of it that changed since the last one */
+	struct weston_buffer_reference buffer_ref;
+	pixman_region32_t damage;
+	struct wl_list link;
 };
 
 struct desktop_shell {
@@ -174,9 +197,18 @@ struct desktop_shell {
 	uint32_t binding_modifier;
 	enum animation_type win_animation_type;
 	enum animation_type startup_animation_type;
+	int minimized_memory;
+
+	struct {
+		struct wl_list dirty_list;
+		struct wl_event_source *idle_source;
+	} thumbnails;
 
-	 /* for the taskbar, memorize toplevel shell surfaces */
-	struct wl_list shsurf_list;
+	struct {
+		struct wl_list pending_list;
+		struct wl_array removed;
+		struct wl_event_source *idle_source;
+	} window_list;
 };
 
 enum shell_surface_type {
@@ -210,6 +242,15 @@ struct shell_surface {
 	bool saved_rotation_valid;
 	int unresponsive;
 	unsigned int id;
+	struct shell_thumbnail *thumbnail;
+	uint32_t window_changes;
+	struct wl_list window_link;
+
+	struct {
+		bool released;
+		bool restore_pending;
+		struct wl_event_source *restore_timer;
+	} minimized;
 
 	struct {
 		struct weston_transform transform;
@@ -241,7 +282,6 @@ struct shell_surface {
 
 	struct weston_output *fullscreen_output;
 	struct weston_output *output;
-	struct wl_list link;
 
 	const struct weston_shell_client *client;
 };
@@ -473,6 +513,8 @@ shell_configuration(struct desktop_shell *shell)
 	weston_config_section_get_uint(section, "num-workspaces",
 				       &shell->workspaces.num,
 				       DEFAULT_NUM_WORKSPACES);
+	weston_config_section_get_bool(section, "minimized-memory",
+				       &shell->minimized_memory, 0);
 }
 
 static void
@@ -687,10 +729,17 @@ taskbar_create(void)
 		return NULL;
 
 	weston_layer_init(&tb->layer, NULL);
-	tb->id_count = 0;
+	window_registry_init(&tb->windows);
 	return tb;
 }
 
+static void
+taskbar_destroy(struct taskbar *tb)
+{
+	window_registry_release(&tb->windows);
+	free(tb);
+}
+
 static struct taskbar *
 get_taskbar(struct desktop_shell *shell)
 {
@@ -704,6 +753,469 @@ activate_taskbar(struct desktop_shell *shell)
 	/* DO NOTHING YET (WE DON'T SHOW ANYTHING) */
 }
 
+enum window_change {
+	WINDOW_CHANGE_ADDED = (1 << 0),
+	WINDOW_CHANGE_TITLE = (1 << 1)
+};
+
+static int
+shell_window_list_batched(struct desktop_shell *shell)
+{
+	return shell->child.desktop_shell &&
+		wl_resource_get_version(shell->child.desktop_shell) >= 4;
+}
+
+static const char *
+shell_surface_get_window_title(struct shell_surface *shsurf)
+{
+	return shsurf->title ? shsurf->title : "<Default>";
+}
+
+static void
+shell_window_list_clear_pending(struct shell_surface *shsurf)
+{
+	shsurf->window_changes = 0;
+	wl_list_remove(&shsurf->window_link);
+	wl_list_init(&shsurf->window_link);
+}
+
+static void
+shell_window_list_flush(void *data)
+{
+	struct desktop_shell *shell = data;
+	struct wl_resource *resource = shell->child.desktop_shell;
+	struct shell_surface *shsurf, *next;
+	uint32_t *id;
+
+	shell->window_list.idle_source = NULL;
+
+	if (shell_window_list_batched(shell)) {
+		wl_array_for_each(id, &shell->window_list.removed)
+			desktop_shell_send_window_removed(resource, *id);
+
+		wl_list_for_each(shsurf, &shell->window_list.pending_list,
+				 window_link) {
+			if (shsurf->window_changes & WINDOW_CHANGE_ADDED)
+				desktop_shell_send_window_added(resource,
+					shsurf->id,
+					shell_surface_get_window_title(shsurf));
+			else if (shsurf->window_changes & WINDOW_CHANGE_TITLE)
+				desktop_shell_send_window_title(resource,
+					shsurf->id,
+					shell_surface_get_window_title(shsurf));
+		}
+
+		desktop_shell_send_done(resource);
+	}
+
+	shell->window_list.removed.size = 0;
+	wl_list_for_each_safe(shsurf, next, &shell->window_list.pending_list,
+			      window_link)
+		shell_window_list_clear_pending(shsurf);
+}
+
+static void
+shell_window_list_schedule(struct desktop_shell *shell)
+{
+	struct wl_event_loop *loop;
+
+	if (shell->window_list.idle_source)
+		return;
+
+	loop = wl_display_get_event_loop(shell->compositor->wl_display);
+	shell->window_list.idle_source =
+		wl_event_loop_add_idle(loop, shell_window_list_flush, shell);
+}
+
+static void
+shell_window_list_changed(struct shell_surface *shsurf, uint32_t change)
+{
+	struct desktop_shell *shell = shsurf->shell;
+
+	if (!shell_window_list_batched(shell))
+		return;
+
+	shsurf->window_changes |= change;
+	if (wl_list_empty(&shsurf->window_link))
+		wl_list_insert(shell->window_list.pending_list.prev,
+			       &shsurf->window_link);
+
+	shell_window_list_schedule(shell);
+}
+
+static void
+shell_taskbar_window_mapped(struct shell_surface *shsurf)
+{
+	struct desktop_shell *shell = shsurf->shell;
+
+	if (shell_window_list_batched(shell))
+		shell_window_list_changed(shsurf, WINDOW_CHANGE_ADDED);
+	else if (shell->child.desktop_shell)
+		desktop_shell_send_map(shell->child.desktop_shell, shsurf->id,
+				       shell_surface_get_window_title(shsurf));
+}
+
+static void
+shell_taskbar_window_unmapped(struct shell_surface *shsurf)
+{
+	struct desktop_shell *shell = shsurf->shell;
+	uint32_t changes = shsurf->window_changes;
+	uint32_t *id;
+
+	shell_window_list_clear_pending(shsurf);
+
+	if (!shell_window_list_batched(shell)) {
+		if (shell->child.desktop_shell)
+			desktop_shell_send_unmap(shell->child.desktop_shell,
+				shsurf->id,
+				shell_surface_get_window_title(shsurf));
+		return;
+	}
+
+	/* the client never heard of this window */
+	if (changes & WINDOW_CHANGE_ADDED)
+		return;
+
+	id = wl_array_add(&shell->window_list.removed, sizeof *id);
+	if (id == NULL)
+		return;
+	*id = shsurf->id;
+
+	shell_window_list_schedule(shell);
+}
+
+static void
+send_window_list_entry(uint32_t id, void *data, void *user)
+{
+	struct shell_surface *shsurf = data;
+	struct wl_resource *resource = user;
+
+	desktop_shell_send_window_added(resource, id,
+					shell_surface_get_window_title(shsurf));
+	shell_window_list_clear_pending(shsurf);
+}
+
+/* A full snapshot supersedes whatever was queued for the previous
+ * desktop-shell instance. */
+static void
+shell_window_list_send_snapshot(struct desktop_shell *shell)
+{
+	shell->window_list.removed.size = 0;
+	window_registry_for_each(&get_taskbar(shell)->windows,
+				 send_window_list_entry,
+				 shell->child.desktop_shell);
+	desktop_shell_send_done(shell->child.desktop_shell);
+}
+
+static int
+shell_thumbnails_supported(struct desktop_shell *shell)
+{
+	return shell->child.desktop_shell &&
+		wl_resource_get_version(shell->child.desktop_shell) >= 3;
+}
+
+static void
+send_window_thumbnail(uint32_t id, void *data, void *user)
+{
+	struct shell_surface *shsurf = data;
+	struct shell_thumbnail *thumb = shsurf->thumbnail;
+	struct wl_resource *resource = user;
+
+	if (thumb == NULL || thumb->image == NULL)
+		return;
+
+	desktop_shell_send_thumbnail(resource, id, thumb->fd,
+				     thumb->width, thumb->height,
+				     pixman_image_get_stride(thumb->image));
+}
+
+/* Thumbnails only get sent again when their size changes, so a
+ * respawned desktop-shell gets the existing ones when it binds. */
+static void
+shell_thumbnails_send_all(struct desktop_shell *shell)
+{
+	if (!shell_thumbnails_supported(shell))
+		return;
+
+	window_registry_for_each(&get_taskbar(shell)->windows,
+				 send_window_thumbnail,
+				 shell->child.desktop_shell);
+}
+
+static void
+shell_thumbnail_destroy(struct shell_thumbnail *thumb)
+{
+	thumb->shsurf->thumbnail = NULL;
+
+	weston_buffer_reference(&thumb->buffer_ref, NULL);
+	pixman_region32_fini(&thumb->damage);
+	wl_list_remove(&thumb->link);
+
+	if (thumb->image)
+		pixman_image_unref(thumb->image);
+	if (thumb->data)
+		munmap(thumb->data, thumb->size);
+	if (thumb->fd >= 0)
+		close(thumb->fd);
+
+	free(thumb);
+}
+
+/* (Re)allocate the shared-memory image backing a thumbnail, and hand
+ * it to desktop-shell.  The compositor keeps writing into this memory
+ * in place; desktop-shell is told which part changed through
+ * desktop_shell.thumbnail_damage. */
+static int
+shell_thumbnail_resize(struct shell_thumbnail *thumb,
+		       int32_t buffer_width, int32_t buffer_height)
+{
+	struct desktop_shell *shell = thumb->shsurf->shell;
+	int32_t width, height, stride;
+	size_t size;
+	void *data;
+	int fd;
+
+	width = THUMBNAIL_MAX_WIDTH;
+	height = buffer_height * THUMBNAIL_MAX_WIDTH / buffer_width;
+	if (height > THUMBNAIL_MAX_HEIGHT) {
+		height = THUMBNAIL_MAX_HEIGHT;
+		width = buffer_width * THUMBNAIL_MAX_HEIGHT / buffer_height;
+	}
+	if (width < 1)
+		width = 1;
+	if (height < 1)
+		height = 1;
+
+	if (thumb->image && width == thumb->width && height == thumb->height)
+		return 0;
+
+	stride = width * 4;
+	size = stride * height;
+
+	fd = os_create_anonymous_file(size);
+	if (fd < 0) {
+		weston_log("taskbar: creating thumbnail buffer failed: %m\n");
+		return -1;
+	}
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		weston_log("taskbar: mapping thumbnail buffer failed: %m\n");
+		close(fd);
+		return -1;
+	}
+
+	if (thumb->image)
+		pixman_image_unref(thumb->image);
+	if (thumb->data)
+		munmap(thumb->data, thumb->size);
+	if (thumb->fd >= 0)
+		close(thumb->fd);
+
+	thumb->fd = fd;
+	thumb->data = data;
+	thumb->size = size;
+	thumb->width = width;
+	thumb->height = height;
+	thumb->image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+						width, height, data, stride);
+
+	desktop_shell_send_thumbnail(shell->child.desktop_shell,
+				     thumb->shsurf->id, fd,
+				     width, height, stride);
+
+	/* a new image needs to be sampled completely */
+	pixman_region32_fini(&thumb->damage);
+	pixman_region32_init_rect(&thumb->damage, 0, 0,
+				  buffer_width, buffer_height);
+
+	return 0;
+}
+
+static void
+shell_thumbnail_sample(struct shell_thumbnail *thumb)
+{
+	struct desktop_shell *shell = thumb->shsurf->shell;
+	struct weston_buffer *buffer = thumb->buffer_ref.buffer;
+	struct wl_shm_buffer *shm_buffer;
+	pixman_format_code_t format;
+	pixman_image_t *source;
+	pixman_transform_t transform;
+	pixman_region32_t updated;
+	pixman_box32_t *rects, *extents;
+	int32_t bw, bh, x1, y1, x2, y2;
+	int i, n;
+
+	shm_buffer = wl_shm_buffer_get(buffer->resource);
+	switch (wl_shm_buffer_get_format(shm_buffer)) {
+	case WL_SHM_FORMAT_XRGB8888:
+		format = PIXMAN_x8r8g8b8;
+		break;
+	case WL_SHM_FORMAT_ARGB8888:
+		format = PIXMAN_a8r8g8b8;
+		break;
+	case WL_SHM_FORMAT_RGB565:
+		format = PIXMAN_r5g6b5;
+		break;
+	default:
+		return;
+	}
+
+	bw = wl_shm_buffer_get_width(shm_buffer);
+	bh = wl_shm_buffer_get_height(shm_buffer);
+	if (bw <= 0 || bh <= 0 || shell_thumbnail_resize(thumb, bw, bh) < 0)
+		return;
+
+	source = pixman_image_create_bits(format, bw, bh,
+					  wl_shm_buffer_get_data(shm_buffer),
+					  wl_shm_buffer_get_stride(shm_buffer));
+	pixman_transform_init_scale(&transform,
+				    pixman_double_to_fixed((double) bw /
+							   thumb->width),
+				    pixman_double_to_fixed((double) bh /
+							   thumb->height));
+	pixman_image_set_transform(source, &transform);
+	pixman_image_set_filter(source, PIXMAN_FILTER_BILINEAR, NULL, 0);
+
+	/* Only resample the part of the thumbnail covered by the damage,
+	 * grown by one pixel for the filter footprint. */
+	pixman_region32_intersect_rect(&thumb->damage, &thumb->damage,
+				       0, 0, bw, bh);
+	pixman_region32_init(&updated);
+	rects = pixman_region32_rectangles(&thumb->damage, &n);
+	for (i = 0; i < n; i++) {
+		x1 = rects[i].x1 * thumb->width / bw - 1;
+		y1 = rects[i].y1 * thumb->height / bh - 1;
+		x2 = (rects[i].x2 * thumb->width + bw - 1) / bw + 1;
+		y2 = (rects[i].y2 * thumb->height + bh - 1) / bh + 1;
+		pixman_region32_union_rect(&updated, &updated,
+					   x1, y1, x2 - x1, y2 - y1);
+	}
+	pixman_region32_intersect_rect(&updated, &updated, 0, 0,
+				       thumb->width, thumb->height);
+
+	rects = pixman_region32_rectangles(&updated, &n);
+	for (i = 0; i < n; i++)
+		pixman_image_composite32(PIXMAN_OP_SRC,
+					 source, NULL, thumb->image,
+					 rects[i].x1, rects[i].y1,
+					 0, 0,
+					 rects[i].x1, rects[i].y1,
+					 rects[i].x2 - rects[i].x1,
+					 rects[i].y2 - rects[i].y1);
+
+	pixman_image_unref(source);
+
+	if (pixman_region32_not_empty(&updated)) {
+		extents = pixman_region32_extents(&updated);
+		desktop_shell_send_thumbnail_damage(shell->child.desktop_shell,
+						    thumb->shsurf->id,
+						    extents->x1, extents->y1,
+						    extents->x2 - extents->x1,
+						    extents->y2 - extents->y1);
+	}
+	pixman_region32_fini(&updated);
+}
+
+static void
+shell_thumbnails_idle(void *data)
+{
+	struct desktop_shell *shell = data;
+	struct shell_thumbnail *thumb, *next;
+
+	shell->thumbnails.idle_source = NULL;
+
+	wl_list_for_each_safe(thumb, next, &shell->thumbnails.dirty_list,
+			      link) {
+		if (thumb->buffer_ref.buffer && shell_thumbnails_supported(shell))
+			shell_thumbnail_sample(thumb);
+
+		/* let the client have its buffer back */
+		weston_buffer_reference(&thumb->buffer_ref, NULL);
+		pixman_region32_fini(&thumb->damage);
+		pixman_region32_init(&thumb->damage);
+		wl_list_remove(&thumb->link);
+		wl_list_init(&thumb->link);
+	}
+}
+
+/* Called on commit: record what changed in the window and hold on to
+ * its buffer until the next time the compositor goes idle, so that
+ * the downsampling never runs inside a repaint. */
+static void
+shell_thumbnail_commit(struct shell_surface *shsurf)
+{
+	struct desktop_shell *shell = shsurf->shell;
+	struct weston_surface *surface = shsurf->surface;
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+	struct shell_thumbnail *thumb = shsurf->thumbnail;
+	struct wl_event_loop *loop;
+	struct wl_shm_buffer *shm_buffer;
+	pixman_region32_t damage;
+	pixman_box32_t *rects;
+	int32_t scale = surface->buffer_scale;
+	int32_t bw, bh;
+	int i, n;
+
+	if (shsurf->id == 0 || !shell_thumbnails_supported(shell))
+		return;
+
+	/* only shm buffers can be read back on the CPU */
+	if (buffer == NULL)
+		return;
+	shm_buffer = wl_shm_buffer_get(buffer->resource);
+	if (shm_buffer == NULL)
+		return;
+	bw = wl_shm_buffer_get_width(shm_buffer);
+	bh = wl_shm_buffer_get_height(shm_buffer);
+
+	if (thumb == NULL) {
+		thumb = calloc(1, sizeof *thumb);
+		if (thumb == NULL)
+			return;
+		thumb->shsurf = shsurf;
+		thumb->fd = -1;
+		pixman_region32_init(&thumb->damage);
+		wl_list_init(&thumb->link);
+		shsurf->thumbnail = thumb;
+	}
+
+	/* surface-local damage to buffer coordinates */
+	if (surface->buffer_transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		pixman_region32_union_rect(&thumb->damage, &thumb->damage,
+					   0, 0, bw, bh);
+	} else {
+		pixman_region32_init(&damage);
+		pixman_region32_intersect_rect(&damage,
+					       &surface->pending.damage, 0, 0,
+					       bw / scale, bh / scale);
+		rects = pixman_region32_rectangles(&damage, &n);
+		for (i = 0; i < n; i++)
+			pixman_region32_union_rect(&thumb->damage,
+						   &thumb->damage,
+						   rects[i].x1 * scale,
+						   rects[i].y1 * scale,
+						   (rects[i].x2 - rects[i].x1) *
+						   scale,
+						   (rects[i].y2 - rects[i].y1) *
+						   scale);
+		pixman_region32_fini(&damage);
+	}
+
+	weston_buffer_reference(&thumb->buffer_ref, buffer);
+
+	if (wl_list_empty(&thumb->link))
+		wl_list_insert(shell->thumbnails.dirty_list.prev,
+			       &thumb->link);
+
+	if (shell->thumbnails.idle_source == NULL) {
+		loop = wl_display_get_event_loop(shell->compositor->wl_display);
+		shell->thumbnails.idle_source =
+			wl_event_loop_add_idle(loop, shell_thumbnails_idle,
+					       shell);
+	}
+}
+
 static unsigned int
 get_output_height(struct weston_output *output)
 {
@@ -993,8 +1505,8 @@ move_surface_to_workspace(struct desktop_shell *shell,
 	from = get_current_workspace(shell);
 	to = get_workspace(shell, workspace);
 
-	wl_list_remove(&surface->layer_link);
-	wl_list_insert(&to->layer.surface_list, &surface->layer_link);
+	weston_layer_entry_remove(surface);
+	weston_layer_entry_insert(&to->layer.surface_list, surface);
 
 	drop_focus_state(shell, from, surface);
 	wl_list_for_each(seat, &shell->compositor->seat_list, link) {
@@ -1028,8 +1540,8 @@ take_surface_to_workspace_by_seat(struct desktop_shell *shell,
 	from = get_current_workspace(shell);
 	to = get_workspace(shell, index);
 
-	wl_list_remove(&surface->layer_link);
-	wl_list_insert(&to->layer.surface_list, &surface->layer_link);
+	weston_layer_entry_remove(surface);
+	weston_layer_entry_insert(&to->layer.surface_list, surface);
 
 	replace_focus_state(shell, to, seat);
 	drop_focus_state(shell, from, surface);
@@ -1088,6 +1600,126 @@ static const struct workspace_manager_interface workspace_manager_implementation
 	workspace_manager_move_surface,
 };
 
+static void
+shell_surface_show_from_taskbar(struct shell_surface *shsurf)
+{
+	struct workspace *ws = get_current_workspace(shsurf->shell);
+
+	weston_trace_instant("taskbar-show", weston_trace_id(shsurf->surface),
+			     shsurf->id);
+
+	weston_layer_entry_remove(shsurf->surface);
+	weston_layer_entry_insert(&ws->layer.surface_list, shsurf->surface);
+	weston_surface_damage(shsurf->surface);
+}
+
+/* Minimized-memory mode: a window parked in the taskbar only keeps
+ * its thumbnail.  The buffer and the renderer state are dropped, which
+ * releases the wl_buffer and lets the client free it. */
+static void
+shell_surface_release_buffers(struct shell_surface *shsurf)
+{
+	struct weston_surface *surface = shsurf->surface;
+	size_t freed, kept = 0;
+
+	if (shsurf->minimized.restore_timer) {
+		wl_event_source_remove(shsurf->minimized.restore_timer);
+		shsurf->minimized.restore_timer = NULL;
+	}
+	shsurf->minimized.restore_pending = false;
+
+	if (shsurf->minimized.released)
+		return;
+
+	freed = (size_t) surface->geometry.width * surface->geometry.height *
+		surface->buffer_scale * surface->buffer_scale * 4;
+	if (shsurf->thumbnail)
+		kept = shsurf->thumbnail->size;
+
+	weston_surface_release_buffer(surface);
+	shsurf->minimized.released = true;
+
+	weston_log("taskbar: window %u minimized, released ~%zu kB of "
+		   "buffer and renderer state, kept a %zu kB snapshot\n",
+		   shsurf->id, freed / 1024, kept / 1024);
+}
+
+/* Ask the client to draw again, so that the next buffer it attaches
+ * is kept. */
+static void
+shell_surface_reacquire_buffers(struct shell_surface *shsurf)
+{
+	struct weston_surface *surface = shsurf->surface;
+
+	if (!shsurf->minimized.released)
+		return;
+
+	shsurf->minimized.released = false;
+	if (shsurf->client)
+		shsurf->client->send_configure(surface, 0,
+					       surface->geometry.width,
+					       surface->geometry.height);
+}
+
+static void
+shell_surface_finish_restore(struct shell_surface *shsurf)
+{
+	if (shsurf->minimized.restore_timer) {
+		wl_event_source_remove(shsurf->minimized.restore_timer);
+		shsurf->minimized.restore_timer = NULL;
+	}
+	shsurf->minimized.restore_pending = false;
+
+	shell_surface_show_from_taskbar(shsurf);
+}
+
+static int
+restore_timeout_handler(void *data)
+{
+	struct shell_surface *shsurf = data;
+
+	/* The client did not redraw in time.  Show the window anyway
+	 * if it attached a buffer; without one there is nothing to
+	 * draw, so it stays in the taskbar until its next commit with
+	 * a buffer finishes the restore. */
+	if (shsurf->surface->buffer_ref.buffer) {
+		shell_surface_finish_restore(shsurf);
+		return 1;
+	}
+
+	wl_event_source_remove(shsurf->minimized.restore_timer);
+	shsurf->minimized.restore_timer = NULL;
+	weston_log("taskbar: window %u did not redraw, "
+		   "keeping it minimized until it does\n", shsurf->id);
+
+	return 1;
+}
+
+static void
+shell_surface_restore(struct shell_surface *shsurf)
+{
+	struct wl_event_loop *loop;
+
+	/* already waiting for the client to redraw */
+	if (shsurf->minimized.restore_pending)
+		return;
+
+	if (!shsurf->minimized.released) {
+		shell_surface_show_from_taskbar(shsurf);
+		return;
+	}
+
+	/* keep the window hidden until it has contents again */
+	shell_surface_reacquire_buffers(shsurf);
+	shsurf->minimized.restore_pending = true;
+
+	loop = wl_display_get_event_loop(shsurf->shell->compositor->wl_display);
+	shsurf->minimized.restore_timer =
+		wl_event_loop_add_timer(loop, restore_timeout_handler, shsurf);
+	wl_event_source_timer_update(shsurf->minimized.restore_timer,
+				     MINIMIZED_RESTORE_TIMEOUT);
+}
+
 static void
 move_surface_to_taskbar(struct desktop_shell *shell, struct weston_surface *surface)
 {
@@ -1095,14 +1727,17 @@ move_surface_to_taskbar(struct desktop_shell *shell, struct weston_surface *surf
 	struct taskbar *tb;
 	struct weston_seat *seat;
 	struct weston_surface *focus;
+	struct shell_surface *shsurf;
 
 	assert(weston_surface_get_main_surface(surface) == surface);
 
+	weston_trace_instant("taskbar-hide", weston_trace_id(surface), 0);
+
 	current_ws = get_current_workspace(shell);
 	tb = get_taskbar(shell);
 
-	wl_list_remove(&surface->layer_link);
-	wl_list_insert(&tb->layer.surface_list, &surface->layer_link);
+	weston_layer_entry_remove(surface);
+	weston_layer_entry_insert(&tb->layer.surface_list, surface);
 
 	drop_focus_state (shell, current_ws, surface);
 	wl_list_for_each(seat, &shell->compositor->seat_list, link) {
@@ -1115,6 +1750,10 @@ move_surface_to_taskbar(struct desktop_shell *shell, struct weston_surface *surf
 	}
 
 	weston_surface_damage_below(surface);
+
+	shsurf = get_shell_surface(surface);
+	if (shell->minimized_memory && shsurf)
+		shell_surface_release_buffers(shsurf);
 }
 
 static void
@@ -1772,6 +2411,9 @@ set_title(struct shell_surface *shsurf, const char *title)
 {
 	free(shsurf->title);
 	shsurf->title = strdup(title);
+
+	if (shsurf->id > 0)
+		shell_window_list_changed(shsurf, WINDOW_CHANGE_TITLE);
 }
 
 static void
@@ -1846,8 +2488,8 @@ shell_unset_fullscreen(struct shell_surface *shsurf)
 	}
 
 	ws = get_current_workspace(shsurf->shell);
-	wl_list_remove(&shsurf->surface->layer_link);
-	wl_list_insert(&ws->layer.surface_list, &shsurf->surface->layer_link);
+	weston_layer_entry_remove(shsurf->surface);
+	weston_layer_entry_insert(&ws->layer.surface_list, shsurf->surface);
 }
 
 static void
@@ -1867,8 +2509,8 @@ shell_unset_maximized(struct shell_surface *shsurf)
 	}
 
 	ws = get_current_workspace(shsurf->shell);
-	wl_list_remove(&shsurf->surface->layer_link);
-	wl_list_insert(&ws->layer.surface_list, &shsurf->surface->layer_link);
+	weston_layer_entry_remove(shsurf->surface);
+	weston_layer_entry_insert(&ws->layer.surface_list, shsurf->surface);
 }
 
 static int
@@ -2083,9 +2725,9 @@ shell_configure_fullscreen(struct shell_surface *shsurf)
 					     output->width,
 					     output->height);
 
-	wl_list_remove(&shsurf->fullscreen.black_surface->layer_link);
-	wl_list_insert(&surface->layer_link,
-		       &shsurf->fullscreen.black_surface->layer_link);
+	weston_layer_entry_remove(shsurf->fullscreen.black_surface);
+	weston_layer_entry_insert(&surface->layer_link,
+				  shsurf->fullscreen.black_surface);
 	shsurf->fullscreen.black_surface->output = output;
 
 	surface_subsurfaces_boundingbox(surface, &surf_x, &surf_y,
@@ -2168,9 +2810,9 @@ shell_stack_fullscreen(struct shell_surface *shsurf)
 	struct weston_surface *surface = shsurf->surface;
 	struct desktop_shell *shell = shell_surface_get_shell(shsurf);
 
-	wl_list_remove(&surface->layer_link);
-	wl_list_insert(&shell->fullscreen_layer.surface_list,
-		       &surface->layer_link);
+	weston_layer_entry_remove(surface);
+	weston_layer_entry_insert(&shell->fullscreen_layer.surface_list,
+				  surface);
 	weston_surface_damage(surface);
 
 	if (!shsurf->fullscreen.black_surface)
@@ -2181,9 +2823,9 @@ shell_stack_fullscreen(struct shell_surface *shsurf)
 					     output->width,
 					     output->height);
 
-	wl_list_remove(&shsurf->fullscreen.black_surface->layer_link);
-	wl_list_insert(&surface->layer_link,
-		       &shsurf->fullscreen.black_surface->layer_link);
+	weston_layer_entry_remove(shsurf->fullscreen.black_surface);
+	weston_layer_entry_insert(&surface->layer_link,
+				  shsurf->fullscreen.black_surface);
 	weston_surface_damage(shsurf->fullscreen.black_surface);
 }
 
@@ -2506,18 +3148,22 @@ static const struct wl_shell_surface_interface shell_surface_implementation = {
 static void
 destroy_shell_surface(struct shell_surface *shsurf)
 {
+	struct desktop_shell *shell = shsurf->shell;
+
 	wl_signal_emit(&shsurf->destroy_signal, shsurf);
 
 	 /* send signal for taskbar */
-	struct desktop_shell *shell = shsurf->shell;
-	const char *title = "<Default>";
+	if (shsurf->thumbnail)
+		shell_thumbnail_destroy(shsurf->thumbnail);
+	if (shsurf->minimized.restore_timer)
+		wl_event_source_remove(shsurf->minimized.restore_timer);
 
 	if (shsurf->id > 0) {
-		if (shsurf->title)
-			title = strdup(shsurf->title);
-		desktop_shell_send_unmap(shsurf->shell->child.desktop_shell,
-					 shsurf->id, title);
+		window_registry_remove(&get_taskbar(shell)->windows,
+				       shsurf->id);
+		shell_taskbar_window_unmapped(shsurf);
 	}
+	wl_list_remove(&shsurf->window_link);
 
 	if (!wl_list_empty(&shsurf->popup.grab_link)) {
 		remove_popup_grab(shsurf);
@@ -2538,7 +3184,6 @@ destroy_shell_surface(struct shell_surface *shsurf)
 	ping_timer_destroy(shsurf);
 	free(shsurf->title);
 
-	wl_list_remove(&shsurf->link);
 	free(shsurf);
 }
 
@@ -2612,8 +3257,8 @@ create_shell_surface(void *shell, struct weston_surface *surface,
 		      &shsurf->surface_destroy_listener);
 
 	/* init link so its safe to always remove it in destroy_shell_surface */
-	wl_list_init(&shsurf->link);
 	wl_list_init(&shsurf->popup.grab_link);
+	wl_list_init(&shsurf->window_link);
 
 	/* empty when not in use */
 	wl_list_init(&shsurf->rotation.transform.link);
@@ -2741,7 +3386,7 @@ configure_static_surface(struct weston_surface *es, struct weston_layer *layer,
 	weston_surface_configure(es, es->output->x, es->output->y, width, height);
 
 	if (wl_list_empty(&es->layer_link)) {
-		wl_list_insert(&layer->surface_list, &es->layer_link);
+		weston_layer_entry_insert(&layer->surface_list, es);
 		weston_compositor_schedule_repaint(es->compositor);
 	}
 }
@@ -2827,8 +3472,8 @@ lock_surface_configure(struct weston_surface *surface, int32_t sx, int32_t sy, i
 	center_on_output(surface, get_default_output(shell->compositor));
 
 	if (!weston_surface_is_mapped(surface)) {
-		wl_list_insert(&shell->lock_layer.surface_list,
-			       &surface->layer_link);
+		weston_layer_entry_insert(&shell->lock_layer.surface_list,
+					  surface);
 		weston_surface_update_transform(surface);
 		shell_fade(shell, FADE_IN);
 	}
@@ -2878,21 +3523,15 @@ desktop_shell_set_shown(struct wl_client *client,
 	struct desktop_shell *shell = wl_resource_get_user_data(resource);
 	struct shell_surface *shsurf;
 
-	 /* iterate on the memorized toplevel shell_surfaces */
-	wl_list_for_each(shsurf, &shell->shsurf_list, link) {
-		if (shsurf->id == id) {
-			/* this surface's ID corresponds ! */
-			if (!state) {
-				move_surface_to_taskbar(shell, shsurf->surface); }
-			else {
-				struct workspace *ws;
-				ws = get_current_workspace(shsurf->shell);
-
-				wl_list_remove(&shsurf->surface->layer_link);
-				wl_list_insert(&ws->layer.surface_list, &shsurf->surface->layer_link);
-			}
-		}
-	}	
+	 /* stale ids of destroyed windows resolve to nothing */
+	shsurf = window_registry_lookup(&get_taskbar(shell)->windows, id);
+	if (shsurf == NULL)
+		return;
+
+	if (!state)
+		move_surface_to_taskbar(shell, shsurf->surface);
+	else
+		shell_surface_restore(shsurf);
 }
 
 static void
@@ -3539,8 +4178,8 @@ shell_fade_create_surface(struct desktop_shell *shell)
 
 	weston_surface_configure(surface, 0, 0, 8192, 8192);
 	weston_surface_set_color(surface, 0.0, 0.0, 0.0, 1.0);
-	wl_list_insert(&compositor->fade_layer.surface_list,
-		       &surface->layer_link);
+	weston_layer_entry_insert(&compositor->fade_layer.surface_list,
+				  surface);
 	pixman_region32_init(&surface->input);
 
 	return surface;
@@ -3693,8 +4332,8 @@ show_input_panels(struct wl_listener *listener, void *data)
 		ws = surface->surface;
 		if (!ws->buffer_ref.buffer)
 			continue;
-		wl_list_insert(&shell->input_panel_layer.surface_list,
-			       &ws->layer_link);
+		weston_layer_entry_insert(&shell->input_panel_layer.surface_list,
+					  ws);
 		weston_surface_geometry_dirty(ws);
 		weston_surface_update_transform(ws);
 		weston_surface_damage(ws);
@@ -3819,7 +4458,6 @@ map(struct desktop_shell *shell, struct weston_surface *surface,
 	struct weston_surface *parent;
 	struct weston_seat *seat;
 	struct workspace *ws;
-	struct taskbar *tb;
 	int panel_height = 0;
 	int32_t surf_x, surf_y;
 
@@ -3833,20 +4471,16 @@ map(struct desktop_shell *shell, struct weston_surface *surface,
 		weston_surface_set_initial_position(surface, shell);
 
 		/* TASKBAR : only detect toplevel surfaces for now */
-		const char *title = "<Default>";
-		if (shsurf->title)
-			title = strdup(shsurf->title);
-		/* */
-		struct taskbar *tb;
-		tb = get_taskbar(shsurf->shell);
-		tb->id_count++;					/* increment the ID counter */
-		shsurf->id = tb->id_count;		/* map the ID to the shell_surface */
+		if (shsurf->id > 0)
+			break;
+		shsurf->id = window_registry_insert(&get_taskbar(shell)->windows,
+						    shsurf);
+		if (shsurf->id == 0) {
+			weston_log("taskbar: window registry full\n");
+			break;
+		}
 		/* send a signal to desktop-shell for the taskbar */
-		desktop_shell_send_map(shsurf->shell->child.desktop_shell,
-		  						shsurf->id, title);
-		 /* track this shell_surface for later manipulation */
-		wl_list_insert(&shsurf->shell->shsurf_list, &shsurf->link);
-
+		shell_taskbar_window_mapped(shsurf);
 		break;
 	case SHELL_SURFACE_FULLSCREEN:
 		center_on_output(surface, shsurf->fullscreen_output);
@@ -3877,7 +4511,7 @@ map(struct desktop_shell *shell, struct weston_surface *surface,
 	case SHELL_SURFACE_POPUP:
 	case SHELL_SURFACE_TRANSIENT:
 		parent = shsurf->parent;
-		wl_list_insert(parent->layer_link.prev, &surface->layer_link);
+		weston_layer_entry_insert(parent->layer_link.prev, surface);
 		break;
 	case SHELL_SURFACE_FULLSCREEN:
 	case SHELL_SURFACE_NONE:
@@ -3885,7 +4519,7 @@ map(struct desktop_shell *shell, struct weston_surface *surface,
 	case SHELL_SURFACE_XWAYLAND:
 	default:
 		ws = get_current_workspace(shell);
-		wl_list_insert(&ws->layer.surface_list, &surface->layer_link);
+		weston_layer_entry_insert(&ws->layer.surface_list, surface);
 		break;
 	}
 
@@ -4008,6 +4642,15 @@ shell_surface_configure(struct weston_surface *es, int32_t sx, int32_t sy, int32
 			  es->geometry.y + to_y - from_y,
 			  width, height);
 	}
+
+	shell_thumbnail_commit(shsurf);
+
+	if (shsurf->minimized.restore_pending) {
+		if (es->buffer_ref.buffer)
+			shell_surface_finish_restore(shsurf);
+	} else if (shsurf->minimized.released)
+		/* keep windows that draw while minimized lean */
+		weston_surface_release_buffer(es);
 }
 
 static void launch_desktop_shell_process(void *data);
@@ -4087,7 +4730,7 @@ bind_desktop_shell(struct wl_client *client,
 	struct wl_resource *resource;
 
 	resource = wl_resource_create(client, &desktop_shell_interface,
-				      MIN(version, 2), id);
+				      MIN(version, 4), id);
 
 	if (client == shell->child.client) {
 		wl_resource_set_implementation(resource,
@@ -4095,6 +4738,10 @@ bind_desktop_shell(struct wl_client *client,
 					       shell, unbind_desktop_shell);
 		shell->child.desktop_shell = resource;
 
+		if (shell_window_list_batched(shell))
+			shell_window_list_send_snapshot(shell);
+		shell_thumbnails_send_all(shell);
+
 		if (version < 2)
 			shell_fade_startup(shell);
 
@@ -4121,8 +4768,8 @@ screensaver_configure(struct weston_surface *surface, int32_t sx, int32_t sy, in
 	center_on_output(surface, surface->output);
 
 	if (wl_list_empty(&surface->layer_link)) {
-		wl_list_insert(shell->lock_layer.surface_list.prev,
-			       &surface->layer_link);
+		weston_layer_entry_insert(shell->lock_layer.surface_list.prev,
+					  surface);
 		weston_surface_update_transform(surface);
 		wl_event_source_timer_update(shell->screensaver.timer,
 					     shell->screensaver.duration);
@@ -4213,8 +4860,8 @@ input_panel_configure(struct weston_surface *surface, int32_t sx, int32_t sy, in
 				 width, height);
 
 	if (show_surface) {
-		wl_list_insert(&shell->input_panel_layer.surface_list,
-			       &surface->layer_link);
+		weston_layer_entry_insert(&shell->input_panel_layer.surface_list,
+					  surface);
 		weston_surface_update_transform(surface);
 		weston_surface_damage(surface);
 		weston_slide_run(surface, surface->geometry.height, 0, NULL, NULL);
@@ -4415,18 +5062,21 @@ switcher_next(struct switcher *switcher)
 	struct shell_surface *shsurf;
 	struct workspace *ws = get_current_workspace(switcher->shell);
 	struct taskbar *tb = get_taskbar(switcher->shell); 
-	struct wl_list tbsurf_list;
+	struct weston_surface *tbsurf = NULL;
 
-	wl_list_init(&tbsurf_list);
 	 /* temporary re-display surfaces from the taskbar while Super-Tabbing... */
 	wl_list_for_each(surface, &tb->layer.surface_list, layer_link) {
-			wl_list_remove(&surface->layer_link);
-			wl_list_insert(&ws->layer.surface_list, &surface->layer_link);
+			shsurf = get_shell_surface(surface);
+			if (shsurf)
+				shell_surface_reacquire_buffers(shsurf);
+			weston_layer_entry_remove(surface);
+			weston_layer_entry_insert(&ws->layer.surface_list,
+						  surface);
 			surface->alpha = 0.25;
 			weston_surface_geometry_dirty(surface);
 			weston_surface_damage(surface);
 				/* remember to hide it after that */
-			wl_list_insert(&tbsurf_list, &surface->link);
+			tbsurf = surface;
 			break;
 	}
 
@@ -4457,16 +5107,19 @@ switcher_next(struct switcher *switcher)
 	}
 
 		/* re-hide the taskbar surface here, if it's not currently selected */
-	wl_list_for_each(surface, &tbsurf_list, link) {
-		if (surface != switcher->current) {
-			wl_list_remove(&surface->layer_link);
-			wl_list_insert(&tb->layer.surface_list, &surface->layer_link);
-			weston_surface_damage_below(surface);
+	if (tbsurf) {
+		if (tbsurf != switcher->current) {
+			weston_layer_entry_remove(tbsurf);
+			weston_layer_entry_insert(&tb->layer.surface_list,
+						  tbsurf);
+			weston_surface_damage_below(tbsurf);
+
+			shsurf = get_shell_surface(tbsurf);
+			if (switcher->shell->minimized_memory && shsurf)
+				shell_surface_release_buffers(shsurf);
 		}
-		surface->alpha = 1.0;
+		tbsurf->alpha = 1.0;
 	}
-	/* EMPTY THE LIST HERE */
-	/* XXXX */
 
 	if (next == NULL)
 		next = first;
@@ -4858,6 +5511,13 @@ shell_destroy(struct wl_listener *listener, void *data)
 		workspace_destroy(*ws);
 	wl_array_release(&shell->workspaces.array);
 
+	if (shell->thumbnails.idle_source)
+		wl_event_source_remove(shell->thumbnails.idle_source);
+	if (shell->window_list.idle_source)
+		wl_event_source_remove(shell->window_list.idle_source);
+	wl_array_release(&shell->window_list.removed);
+	taskbar_destroy(shell->shell_taskbar);
+
 	free(shell->screensaver.path);
 	free(shell);
 }
@@ -4980,8 +5640,10 @@ module_init(struct weston_compositor *ec,
 	ec->shell_interface.resize = surface_resize;
 	ec->shell_interface.set_title = set_title;
 
-		wl_list_init(&shell->shsurf_list);
 	wl_list_init(&shell->input_panel.surfaces);
+	wl_list_init(&shell->thumbnails.dirty_list);
+	wl_list_init(&shell->window_list.pending_list);
+	wl_array_init(&shell->window_list.removed);
 
 	weston_layer_init(&shell->fullscreen_layer, &ec->cursor_layer.link);
 	weston_layer_init(&shell->panel_layer, &shell->fullscreen_layer.link);
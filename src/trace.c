@@ -0,0 +1,231 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+#include "trace.h"
+
+#define TRACE_DEFAULT_EVENTS (1 << 16)
+
+struct trace_event {
+	uint64_t time;			/* ns, CLOCK_MONOTONIC */
+	const char *name;
+	uint32_t id;
+	uint32_t arg;
+	char phase;
+};
+
+struct trace_ring {
+	struct trace_event *events;
+	uint32_t mask;
+	uint64_t head;			/* events ever recorded */
+	pid_t tid;
+	struct trace_ring *next;
+};
+
+WL_EXPORT int weston_trace_enabled;
+
+static struct {
+	struct trace_ring *rings;	/* lock-free push only */
+	uint32_t size;			/* events per ring, power of two */
+	char *filename;
+	struct wl_event_source *signal_source;
+} tracer;
+
+static __thread struct trace_ring *thread_ring;
+
+static struct trace_ring *
+trace_ring_create(void)
+{
+	struct trace_ring *ring;
+
+	ring = zalloc(sizeof *ring);
+	if (ring == NULL)
+		return NULL;
+
+	ring->events = calloc(tracer.size, sizeof *ring->events);
+	if (ring->events == NULL) {
+		free(ring);
+		return NULL;
+	}
+
+	ring->mask = tracer.size - 1;
+	ring->tid = syscall(SYS_gettid);
+
+	do
+		ring->next = tracer.rings;
+	while (!__sync_bool_compare_and_swap(&tracer.rings, ring->next, ring));
+
+	return ring;
+}
+
+WL_EXPORT void
+weston_trace_record(char phase, const char *name, uint32_t id, uint32_t arg)
+{
+	struct trace_ring *ring = thread_ring;
+	struct trace_event *event;
+	struct timespec ts;
+
+	if (ring == NULL) {
+		ring = thread_ring = trace_ring_create();
+		if (ring == NULL)
+			return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	event = &ring->events[ring->head & ring->mask];
+	event->time = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	event->name = name;
+	event->id = id;
+	event->arg = arg;
+	event->phase = phase;
+
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Rings of other threads are read while they may still be written to.
+ * The oldest quarter of a ring is skipped, so that events overwritten
+ * during the export are unlikely to show up torn. */
+static void
+trace_ring_export(struct trace_ring *ring, FILE *fp, pid_t pid, int *first)
+{
+	struct trace_event *event;
+	uint64_t head, start, i;
+	uint32_t size = ring->mask + 1;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	start = head > size ? head - size + size / 4 : 0;
+
+	for (i = start; i < head; i++) {
+		event = &ring->events[i & ring->mask];
+		fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"%c\","
+			"\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%d",
+			*first ? "" : ",", event->name, event->phase,
+			(unsigned long long) (event->time / 1000),
+			(unsigned) (event->time % 1000), pid, ring->tid);
+		if (event->phase == 'i')
+			fprintf(fp, ",\"s\":\"t\"");
+		fprintf(fp, ",\"args\":{\"id\":%u,\"arg\":%u}}",
+			event->id, event->arg);
+		*first = 0;
+	}
+}
+
+WL_EXPORT int
+weston_trace_export(const char *filename)
+{
+	struct trace_ring *ring;
+	FILE *fp;
+	int first = 1;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL) {
+		weston_log("trace: failed to open %s: %m\n", filename);
+		return -1;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (ring = tracer.rings; ring; ring = ring->next)
+		trace_ring_export(ring, fp, getpid(), &first);
+	fprintf(fp, "\n]}\n");
+
+	if (fclose(fp) != 0) {
+		weston_log("trace: failed to write %s: %m\n", filename);
+		return -1;
+	}
+
+	weston_log("trace: wrote %s\n", filename);
+
+	return 0;
+}
+
+static int
+trace_signal_handler(int signal_number, void *data)
+{
+	weston_trace_export(tracer.filename);
+
+	return 1;
+}
+
+static void
+trace_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+	      void *data)
+{
+	weston_trace_export(tracer.filename);
+}
+
+WL_EXPORT int
+weston_trace_init(struct weston_compositor *ec)
+{
+	struct weston_config_section *s;
+	struct wl_event_loop *loop;
+	uint32_t size;
+
+	s = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_string(s, "trace-file",
+					 &tracer.filename, NULL);
+	if (tracer.filename == NULL)
+		return 0;
+
+	weston_config_section_get_uint(s, "trace-buffer-size", &size,
+				       TRACE_DEFAULT_EVENTS);
+	tracer.size = 1024;
+	while (tracer.size < size && tracer.size < (1u << 24))
+		tracer.size <<= 1;
+
+	loop = wl_display_get_event_loop(ec->wl_display);
+	tracer.signal_source =
+		wl_event_loop_add_signal(loop, SIGUSR2,
+					 trace_signal_handler, NULL);
+	weston_compositor_add_debug_binding(ec, KEY_E, trace_binding, NULL);
+
+	weston_log("trace: %u events per thread, export to %s on SIGUSR2\n",
+		   tracer.size, tracer.filename);
+	weston_trace_enabled = 1;
+
+	return 0;
+}
+
+/* The rings stay allocated: threads outliving the compositor may still
+ * hold theirs, and recording stops as soon as tracing is disabled. */
+WL_EXPORT void
+weston_trace_release(struct weston_compositor *ec)
+{
+	weston_trace_enabled = 0;
+
+	if (tracer.signal_source)
+		wl_event_source_remove(tracer.signal_source);
+	tracer.signal_source = NULL;
+
+	free(tracer.filename);
+	tracer.filename = NULL;
+}
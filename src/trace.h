@@ -0,0 +1,108 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_TRACE_H
+#define _WESTON_TRACE_H
+
+#include <stdint.h>
+
+/* Compositor-wide event tracer.
+ *
+ * Every thread that records an event gets its own fixed size ring
+ * buffer, so recording takes no lock: it reads the clock, fills in the
+ * next slot and publishes the new head.  When the ring is full the
+ * oldest events are overwritten.  Names must be string literals, only
+ * the pointer is stored.
+ *
+ * Tracing is off unless [core] trace-file is set.  The rings are then
+ * exported to that file as Chrome trace JSON, loadable in
+ * chrome://tracing or Perfetto, on SIGUSR2 or the debug binding E.
+ * Configuring with --disable-trace compiles the trace points out.
+ */
+
+struct weston_compositor;
+
+extern int weston_trace_enabled;
+
+/* Objects such as surfaces are told apart by their address. */
+static inline uint32_t
+weston_trace_id(const void *object)
+{
+	return (uint32_t) (uintptr_t) object;
+}
+
+void
+weston_trace_record(char phase, const char *name, uint32_t id,
+		    uint32_t arg);
+
+int
+weston_trace_init(struct weston_compositor *ec);
+
+void
+weston_trace_release(struct weston_compositor *ec);
+
+int
+weston_trace_export(const char *filename);
+
+#ifdef ENABLE_TRACE
+
+static inline void
+weston_trace_begin(const char *name, uint32_t id)
+{
+	if (weston_trace_enabled)
+		weston_trace_record('B', name, id, 0);
+}
+
+static inline void
+weston_trace_end(const char *name, uint32_t id)
+{
+	if (weston_trace_enabled)
+		weston_trace_record('E', name, id, 0);
+}
+
+static inline void
+weston_trace_instant(const char *name, uint32_t id, uint32_t arg)
+{
+	if (weston_trace_enabled)
+		weston_trace_record('i', name, id, arg);
+}
+
+#else
+
+static inline void
+weston_trace_begin(const char *name, uint32_t id)
+{
+}
+
+static inline void
+weston_trace_end(const char *name, uint32_t id)
+{
+}
+
+static inline void
+weston_trace_instant(const char *name, uint32_t id, uint32_t arg)
+{
+}
+
+#endif
+
+#endif
@@ -0,0 +1,342 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wcap-encode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__) || __GNUC__ > 4 || \
+	(__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+/* The run being built, carried over from row to row. */
+struct run {
+	uint32_t delta;
+	int length;
+};
+
+typedef uint32_t *(*encode_row_func_t)(uint32_t *p, const uint32_t *s,
+				       uint32_t *d, int n, struct run *run);
+
+struct wcap_encode_impl {
+	const char *name;
+	int (*supported)(void);
+	encode_row_func_t encode_row;
+};
+
+static inline uint32_t
+component_delta(uint32_t next, uint32_t prev)
+{
+	unsigned char dr, dg, db;
+
+	dr = (next >> 16) - (prev >> 16);
+	dg = (next >>  8) - (prev >>  8);
+	db = (next >>  0) - (prev >>  0);
+
+	return (dr << 16) | (dg << 8) | (db << 0);
+}
+
+static uint32_t *
+output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+static uint32_t *
+encode_row_c(uint32_t *p, const uint32_t *s, uint32_t *d, int n,
+	     struct run *run)
+{
+	uint32_t next, delta;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		next = s[i];
+		delta = component_delta(next, d[i]);
+		d[i] = next;
+		if (run->length == 0 || delta == run->delta) {
+			run->length++;
+		} else {
+			p = output_run(p, run->delta, run->length);
+			run->length = 1;
+		}
+		run->delta = delta;
+	}
+
+	return p;
+}
+
+/* Extends the run by the lanes whose delta equals the one before,
+ * given as bits in mask, and starts a new run at the others. */
+static inline uint32_t *
+encode_lanes(uint32_t *p, const uint32_t *deltas, int n, int mask,
+	     struct run *run)
+{
+	int k;
+
+	for (k = 0; k < n; k++) {
+		if (mask & (1 << k)) {
+			run->length++;
+		} else {
+			p = output_run(p, run->delta, run->length);
+			run->length = 1;
+			run->delta = deltas[k];
+		}
+	}
+
+	return p;
+}
+
+/* The vector versions compare each lane's delta with the previous
+ * lane's, the first one with the current run's, and only look at the
+ * lanes one by one when a run ends inside the vector.  The source
+ * pixels are loaded before any output is written, so encoding in place
+ * stays safe. */
+
+#ifdef HAVE_X86_SIMD
+
+static int
+have_sse2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2")))
+static uint32_t *
+encode_row_sse2(uint32_t *p, const uint32_t *s, uint32_t *d, int n,
+		struct run *run)
+{
+	const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+	__m128i next, delta, prev;
+	uint32_t deltas[4];
+	int i, mask;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		next = _mm_loadu_si128((const __m128i *) (s + i));
+		delta = _mm_sub_epi8(next,
+				     _mm_loadu_si128((const __m128i *) (d + i)));
+		_mm_storeu_si128((__m128i *) (d + i), next);
+		delta = _mm_and_si128(delta, rgb);
+
+		if (run->length == 0)
+			run->delta = _mm_cvtsi128_si32(delta);
+		prev = _mm_or_si128(_mm_slli_si128(delta, 4),
+				    _mm_cvtsi32_si128(run->delta));
+		mask = _mm_movemask_ps(
+			_mm_castsi128_ps(_mm_cmpeq_epi32(delta, prev)));
+
+		if (mask == 0xf) {
+			run->length += 4;
+			continue;
+		}
+
+		_mm_storeu_si128((__m128i *) deltas, delta);
+		p = encode_lanes(p, deltas, 4, mask, run);
+	}
+
+	return encode_row_c(p, s + i, d + i, n - i, run);
+}
+
+static int
+have_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static uint32_t *
+encode_row_avx2(uint32_t *p, const uint32_t *s, uint32_t *d, int n,
+		struct run *run)
+{
+	const __m256i rgb = _mm256_set1_epi32(0x00ffffff);
+	const __m256i shift = _mm256_set_epi32(6, 5, 4, 3, 2, 1, 0, 0);
+	__m256i next, delta, prev;
+	uint32_t deltas[8];
+	int i, mask;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		next = _mm256_loadu_si256((const __m256i *) (s + i));
+		delta = _mm256_sub_epi8(next,
+				_mm256_loadu_si256((const __m256i *) (d + i)));
+		_mm256_storeu_si256((__m256i *) (d + i), next);
+		delta = _mm256_and_si256(delta, rgb);
+
+		if (run->length == 0)
+			run->delta = _mm_cvtsi128_si32(
+				_mm256_castsi256_si128(delta));
+		prev = _mm256_blend_epi32(
+			_mm256_permutevar8x32_epi32(delta, shift),
+			_mm256_set1_epi32(run->delta), 0x01);
+		mask = _mm256_movemask_ps(
+			_mm256_castsi256_ps(_mm256_cmpeq_epi32(delta, prev)));
+
+		if (mask == 0xff) {
+			run->length += 8;
+			continue;
+		}
+
+		_mm256_storeu_si256((__m256i *) deltas, delta);
+		p = encode_lanes(p, deltas, 8, mask, run);
+	}
+
+	return encode_row_c(p, s + i, d + i, n - i, run);
+}
+
+#endif
+
+#ifdef HAVE_NEON
+
+static int
+have_neon(void)
+{
+	return 1;
+}
+
+static uint32_t *
+encode_row_neon(uint32_t *p, const uint32_t *s, uint32_t *d, int n,
+		struct run *run)
+{
+	const uint32x4_t rgb = vdupq_n_u32(0x00ffffff);
+	uint32x4_t next, delta, eq;
+	uint32_t deltas[4], eqs[4];
+	int i, k, mask;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		next = vld1q_u32(s + i);
+		delta = vreinterpretq_u32_u8(
+			vsubq_u8(vreinterpretq_u8_u32(next),
+				 vreinterpretq_u8_u32(vld1q_u32(d + i))));
+		vst1q_u32(d + i, next);
+		delta = vandq_u32(delta, rgb);
+
+		if (run->length == 0)
+			run->delta = vgetq_lane_u32(delta, 0);
+		eq = vceqq_u32(delta,
+			       vextq_u32(vdupq_n_u32(run->delta), delta, 3));
+
+		if (vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(eq)), 0) ==
+		    ~0ULL) {
+			run->length += 4;
+			continue;
+		}
+
+		vst1q_u32(deltas, delta);
+		vst1q_u32(eqs, eq);
+		for (k = 0, mask = 0; k < 4; k++)
+			mask |= (eqs[k] & 1) << k;
+		p = encode_lanes(p, deltas, 4, mask, run);
+	}
+
+	return encode_row_c(p, s + i, d + i, n - i, run);
+}
+
+#endif
+
+/* Best first. */
+static const struct wcap_encode_impl impls[] = {
+#ifdef HAVE_X86_SIMD
+	{ "avx2", have_avx2, encode_row_avx2 },
+	{ "sse2", have_sse2, encode_row_sse2 },
+#endif
+#ifdef HAVE_NEON
+	{ "neon", have_neon, encode_row_neon },
+#endif
+	{ "c", NULL, encode_row_c },
+};
+
+static const struct wcap_encode_impl *selected;
+
+int
+wcap_encode_select(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof impls / sizeof impls[0]; i++) {
+		if (name && strcmp(name, impls[i].name) != 0)
+			continue;
+		if (impls[i].supported && !impls[i].supported())
+			continue;
+
+		selected = &impls[i];
+		return 0;
+	}
+
+	return -1;
+}
+
+const char *
+wcap_encode_selected(void)
+{
+	if (!selected)
+		wcap_encode_select(NULL);
+
+	return selected->name;
+}
+
+uint32_t *
+wcap_encode_rect(uint32_t *out, const uint32_t *src, int width, int height,
+		 uint32_t *ref, int ref_stride)
+{
+	struct run run = { 0, 0 };
+	int y;
+
+	if (width <= 0 || height <= 0)
+		return out;
+
+	if (!selected)
+		wcap_encode_select(NULL);
+
+	for (y = 0; y < height; y++) {
+		out = selected->encode_row(out, src, ref, width, &run);
+		src += width;
+		ref += ref_stride;
+	}
+
+	return output_run(out, run.delta, run.length);
+}
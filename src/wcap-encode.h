@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef _WESTON_WCAP_ENCODE_H
+#define _WESTON_WCAP_ENCODE_H
+
+#include <stdint.h>
+
+/* The wcap recorder's delta and run length encoding.
+ *
+ * Each pixel of a damaged rectangle is stored as its per channel
+ * difference to the previous frame, and runs of equal differences are
+ * collapsed into one word: the difference in the low 24 bits and the
+ * run length in the top byte, 1 to 0xe0 as is, or 1 << (n - 0xe0 + 7)
+ * for the larger values.  See wcap/wcap-decode.c for the decoder.
+ *
+ * Runs are found four or eight pixels at a time with SSE2, AVX2 or
+ * NEON where the CPU has them, picked at the first call, and in plain
+ * C otherwise.  All of them produce the same stream.
+ */
+
+/* Encodes a width x height rectangle of pixels, packed row after row
+ * in src, against the previous frame's rows at ref, ref_stride pixels
+ * apart (negative for bottom-up), which are updated to the new pixels.
+ * The runs are written to out, which may be src: the output never
+ * catches up with the input.  Returns the end of the output. */
+uint32_t *
+wcap_encode_rect(uint32_t *out, const uint32_t *src, int width, int height,
+		 uint32_t *ref, int ref_stride);
+
+/* Restricts wcap_encode_rect() to one implementation: "c", "sse2",
+ * "avx2" or "neon", or the best one for NULL.  Returns -1 if the CPU
+ * or the build lacks it.  Meant for tests and benchmarks. */
+int
+wcap_encode_select(const char *name);
+
+const char *
+wcap_encode_selected(void);
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "window-registry.h"
+
+#define FREE_LIST_END UINT32_MAX
+
+static uint32_t
+make_id(uint32_t index, uint32_t generation)
+{
+	return (generation << WINDOW_REGISTRY_INDEX_BITS) | index;
+}
+
+void
+window_registry_init(struct window_registry *registry)
+{
+	memset(registry, 0, sizeof *registry);
+	registry->free_head = FREE_LIST_END;
+	registry->free_tail = FREE_LIST_END;
+}
+
+void
+window_registry_release(struct window_registry *registry)
+{
+	free(registry->slots);
+	window_registry_init(registry);
+}
+
+static int
+window_registry_grow(struct window_registry *registry)
+{
+	struct window_registry_slot *slots;
+	uint32_t alloc;
+
+	if (registry->alloc > WINDOW_REGISTRY_INDEX_MASK)
+		return -1;
+
+	alloc = registry->alloc ? registry->alloc * 2 : 64;
+	if (alloc > WINDOW_REGISTRY_INDEX_MASK + 1)
+		alloc = WINDOW_REGISTRY_INDEX_MASK + 1;
+
+	slots = realloc(registry->slots, alloc * sizeof *slots);
+	if (slots == NULL)
+		return -1;
+
+	registry->slots = slots;
+	registry->alloc = alloc;
+
+	return 0;
+}
+
+/* Returns the new id, or 0 if the registry is full or out of memory. */
+uint32_t
+window_registry_insert(struct window_registry *registry, void *data)
+{
+	struct window_registry_slot *slot;
+	uint32_t index;
+
+	/* Free slots are recycled in FIFO order, so that the generations
+	 * of all slots advance evenly and a given slot is reused as
+	 * late as possible. */
+	if (registry->free_head != FREE_LIST_END) {
+		index = registry->free_head;
+		slot = &registry->slots[index];
+		registry->free_head = slot->next_free;
+		if (registry->free_head == FREE_LIST_END)
+			registry->free_tail = FREE_LIST_END;
+	} else {
+		if (registry->size == registry->alloc &&
+		    window_registry_grow(registry) < 0)
+			return 0;
+
+		index = registry->size++;
+		slot = &registry->slots[index];
+		slot->generation = 1;
+	}
+
+	slot->data = data;
+	slot->next_free = FREE_LIST_END;
+	registry->count++;
+
+	return make_id(index, slot->generation);
+}
+
+static struct window_registry_slot *
+window_registry_get_slot(struct window_registry *registry, uint32_t id)
+{
+	struct window_registry_slot *slot;
+	uint32_t index = id & WINDOW_REGISTRY_INDEX_MASK;
+
+	if (index >= registry->size)
+		return NULL;
+
+	slot = &registry->slots[index];
+	if (slot->data == NULL ||
+	    slot->generation != id >> WINDOW_REGISTRY_INDEX_BITS)
+		return NULL;
+
+	return slot;
+}
+
+void *
+window_registry_lookup(struct window_registry *registry, uint32_t id)
+{
+	struct window_registry_slot *slot;
+
+	slot = window_registry_get_slot(registry, id);
+	if (slot == NULL)
+		return NULL;
+
+	return slot->data;
+}
+
+void *
+window_registry_remove(struct window_registry *registry, uint32_t id)
+{
+	struct window_registry_slot *slot;
+	uint32_t index = id & WINDOW_REGISTRY_INDEX_MASK;
+	void *data;
+
+	slot = window_registry_get_slot(registry, id);
+	if (slot == NULL)
+		return NULL;
+
+	data = slot->data;
+	slot->data = NULL;
+	registry->count--;
+
+	/* Retire the slot for good once its generation space is used up,
+	 * rather than letting an old id alias a future window. */
+	if (slot->generation == WINDOW_REGISTRY_MAX_GENERATION)
+		return data;
+
+	slot->generation++;
+	slot->next_free = FREE_LIST_END;
+	if (registry->free_tail == FREE_LIST_END)
+		registry->free_head = index;
+	else
+		registry->slots[registry->free_tail].next_free = index;
+	registry->free_tail = index;
+
+	return data;
+}
+
+/* Visits the live entries in slot order.  func must not insert into
+ * or remove from the registry. */
+void
+window_registry_for_each(struct window_registry *registry,
+			 void (*func)(uint32_t id, void *data, void *user),
+			 void *user)
+{
+	struct window_registry_slot *slot;
+	uint32_t i;
+
+	for (i = 0; i < registry->size; i++) {
+		slot = &registry->slots[i];
+		if (slot->data)
+			func(make_id(i, slot->generation), slot->data, user);
+	}
+}
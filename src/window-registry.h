@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_WINDOW_REGISTRY_H
+#define _WESTON_WINDOW_REGISTRY_H
+
+#include <stdint.h>
+
+/* A slot map from taskbar window ids to shell surfaces.
+ *
+ * An id packs a slot index in its low WINDOW_REGISTRY_INDEX_BITS bits
+ * and the slot generation in the remaining high bits.  The generation
+ * is bumped every time a slot is released, so a stale id held by the
+ * taskbar client never resolves to a newer window.  A slot whose
+ * generation is exhausted is retired instead of being recycled.  Id 0
+ * is never handed out and means "no id".
+ */
+
+#define WINDOW_REGISTRY_INDEX_BITS 20
+#define WINDOW_REGISTRY_INDEX_MASK ((1u << WINDOW_REGISTRY_INDEX_BITS) - 1)
+#define WINDOW_REGISTRY_MAX_GENERATION \
+	((1u << (32 - WINDOW_REGISTRY_INDEX_BITS)) - 1)
+
+struct window_registry_slot {
+	void *data;
+	uint32_t generation;
+	uint32_t next_free;
+};
+
+struct window_registry {
+	struct window_registry_slot *slots;
+	uint32_t size;
+	uint32_t alloc;
+	uint32_t count;
+	uint32_t free_head;
+	uint32_t free_tail;
+};
+
+void
+window_registry_init(struct window_registry *registry);
+
+void
+window_registry_release(struct window_registry *registry);
+
+uint32_t
+window_registry_insert(struct window_registry *registry, void *data);
+
+void *
+window_registry_lookup(struct window_registry *registry, uint32_t id);
+
+void *
+window_registry_remove(struct window_registry *registry, uint32_t id);
+
+void
+window_registry_for_each(struct window_registry *registry,
+			 void (*func)(uint32_t id, void *data, void *user),
+			 void *user);
+
+#endif
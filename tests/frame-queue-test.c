@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/frame-queue.h"
+
+#define QUEUE_LENGTH 4
+#define FRAME_COUNT 2000
+
+/* Each slot holds the sequence number of the frame queued in it.  The
+ * consumer overwrites it once done, the way the recorder's encoder
+ * overwrites the pixels with their runs, so a slot handed out twice or
+ * out of order shows up as a wrong number. */
+struct queue_test {
+	struct frame_queue queue;
+	int slots[QUEUE_LENGTH];
+	int consumed;
+};
+
+static void *
+slow_consumer(void *data)
+{
+	struct queue_test *test = data;
+	struct timespec delay = { 0, 20000 };
+	int slot;
+
+	while ((slot = frame_queue_wait(&test->queue)) >= 0) {
+		assert(test->slots[slot] == test->consumed);
+		nanosleep(&delay, NULL);
+		test->slots[slot] = -1;
+		test->consumed++;
+		frame_queue_pop(&test->queue);
+	}
+
+	return NULL;
+}
+
+TEST(frame_queue_slow_consumer)
+{
+	struct queue_test test = { 0 };
+	pthread_t thread;
+	int queued, slot, produced = 0, full = 0;
+
+	frame_queue_init(&test.queue, QUEUE_LENGTH);
+	assert(pthread_create(&thread, NULL, slow_consumer, &test) == 0);
+
+	while (produced < FRAME_COUNT) {
+		slot = frame_queue_tail(&test.queue, &queued);
+		assert(queued >= 0 && queued <= QUEUE_LENGTH);
+		if (slot < 0) {
+			assert(queued == QUEUE_LENGTH);
+			full++;
+			continue;
+		}
+
+		test.slots[slot] = produced++;
+		frame_queue_push(&test.queue);
+	}
+
+	frame_queue_quit(&test.queue);
+	pthread_join(thread, NULL);
+	frame_queue_release(&test.queue);
+
+	assert(test.consumed == FRAME_COUNT);
+	/* The producer did run ahead of the consumer. */
+	assert(full > 0);
+}
+
+TEST(frame_queue_quit_drains)
+{
+	struct frame_queue queue;
+	int queued, i;
+
+	frame_queue_init(&queue, QUEUE_LENGTH);
+	for (i = 0; i < QUEUE_LENGTH; i++) {
+		assert(frame_queue_tail(&queue, &queued) == i);
+		assert(queued == i);
+		frame_queue_push(&queue);
+	}
+	assert(frame_queue_tail(&queue, &queued) == -1);
+	assert(queued == QUEUE_LENGTH);
+
+	frame_queue_quit(&queue);
+	for (i = 0; i < QUEUE_LENGTH; i++) {
+		assert(frame_queue_wait(&queue) == i);
+		frame_queue_pop(&queue);
+	}
+	assert(frame_queue_wait(&queue) == -1);
+	frame_queue_release(&queue);
+}
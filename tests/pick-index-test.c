@@ -0,0 +1,199 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+
+#include "../src/compositor.h"
+
+#define PICK_SURFACES 200
+#define PICK_POINTS 20000
+#define PICK_ROUNDS 5
+
+struct pick_test {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	struct weston_layer layer;
+	struct weston_animation animation;
+	struct weston_surface *surfaces[PICK_SURFACES];
+	struct weston_transform transforms[PICK_SURFACES];
+	int round;
+};
+
+static void
+pick_test_place(struct pick_test *test, int i)
+{
+	struct weston_output *output = test->output;
+	struct weston_surface *surface = test->surfaces[i];
+	struct weston_transform *transform = &test->transforms[i];
+	int32_t w = 10 + rand() % 300;
+	int32_t h = 10 + rand() % 300;
+	float angle;
+
+	/* Some surfaces hang off the edges of the output. */
+	weston_surface_configure(surface,
+				 output->x - 50 + rand() % (output->width + 100),
+				 output->y - 50 + rand() % (output->height + 100),
+				 w, h);
+
+	pixman_region32_fini(&surface->input);
+	if (i % 5 == 0)
+		pixman_region32_init_rect(&surface->input,
+					  w / 4, h / 4, w / 2, h / 2);
+	else
+		pixman_region32_init_rect(&surface->input, 0, 0, w, h);
+
+	if (!wl_list_empty(&transform->link)) {
+		wl_list_remove(&transform->link);
+		wl_list_init(&transform->link);
+	}
+
+	weston_matrix_init(&transform->matrix);
+	switch (i % 4) {
+	case 1:
+		angle = (rand() % 360) * M_PI / 180.0;
+		weston_matrix_rotate_xy(&transform->matrix,
+					cosf(angle), sinf(angle));
+		wl_list_insert(&surface->geometry.transformation_list,
+			       &transform->link);
+		break;
+	case 2:
+		weston_matrix_scale(&transform->matrix, 2.5, 0.5, 1.0);
+		wl_list_insert(&surface->geometry.transformation_list,
+			       &transform->link);
+		break;
+	default:
+		break;
+	}
+
+	weston_surface_geometry_dirty(surface);
+}
+
+static void
+pick_test_compare(struct pick_test *test)
+{
+	struct weston_output *output = test->output;
+	struct weston_surface *indexed, *linear;
+	wl_fixed_t x, y, isx, isy, lsx, lsy;
+	int i, hits = 0;
+
+	for (i = 0; i < PICK_POINTS; i++) {
+		/* Sub-pixel positions, including some off the outputs. */
+		x = wl_fixed_from_int(output->x - 20) +
+			rand() % ((output->width + 40) * 256);
+		y = wl_fixed_from_int(output->y - 20) +
+			rand() % ((output->height + 40) * 256);
+
+		indexed = weston_compositor_pick_surface(test->compositor,
+							 x, y, &isx, &isy);
+		linear = weston_compositor_pick_surface_linear(test->compositor,
+							       x, y,
+							       &lsx, &lsy);
+		assert(indexed == linear);
+		if (indexed) {
+			assert(isx == lsx && isy == lsy);
+			hits++;
+		}
+	}
+
+	fprintf(stderr, "round %d: %d of %d points hit a surface\n",
+		test->round, hits, PICK_POINTS);
+}
+
+static void
+pick_test_frame(struct weston_animation *animation,
+		struct weston_output *output, uint32_t msecs)
+{
+	struct pick_test *test =
+		container_of(animation, struct pick_test, animation);
+	struct weston_surface *surface;
+	int i;
+
+	pick_test_compare(test);
+
+	if (++test->round == PICK_ROUNDS) {
+		wl_list_remove(&test->animation.link);
+		wl_display_terminate(test->compositor->wl_display);
+		return;
+	}
+
+	/* Move some surfaces and, every other round, reshuffle the stack
+	 * before the next repaint; the index must follow both.  Moves
+	 * alone only re-bin the moved surfaces. */
+	for (i = 0; i < PICK_SURFACES; i += 3)
+		pick_test_place(test, i);
+	assert(!test->compositor->pick_index.dirty);
+	for (i = 0; test->round % 2 && i < PICK_SURFACES / 10; i++) {
+		surface = test->surfaces[rand() % PICK_SURFACES];
+		weston_surface_restack(surface, &test->layer.surface_list);
+	}
+
+	/* Check against stale state too, before the repaint. */
+	pick_test_compare(test);
+
+	weston_output_schedule_repaint(output);
+}
+
+static void
+pick_test_start(void *data)
+{
+	struct pick_test *test = data;
+	int i;
+
+	srand(4242);
+
+	for (i = 0; i < PICK_SURFACES; i++) {
+		test->surfaces[i] = weston_surface_create(test->compositor);
+		assert(test->surfaces[i]);
+		wl_list_init(&test->transforms[i].link);
+		pick_test_place(test, i);
+		weston_layer_entry_insert(&test->layer.surface_list,
+					  test->surfaces[i]);
+	}
+
+	test->animation.frame = pick_test_frame;
+	wl_list_insert(&test->output->animation_list, &test->animation.link);
+	weston_output_schedule_repaint(test->output);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct pick_test *test;
+
+	test = calloc(1, sizeof *test);
+	assert(test);
+	assert(!wl_list_empty(&compositor->output_list));
+
+	test->compositor = compositor;
+	test->output = container_of(compositor->output_list.next,
+				    struct weston_output, link);
+	weston_layer_init(&test->layer, &compositor->cursor_layer.link);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	wl_event_loop_add_idle(loop, pick_test_start, test);
+
+	return 0;
+}
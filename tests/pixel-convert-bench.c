@@ -0,0 +1,110 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/* Screenshot pixel conversion microbenchmark.
+ *
+ * Converts a 1920x1080 frame the ways the screenshooter does, with
+ * each implementation the CPU supports, and prints the time per frame:
+ *
+ *   tests/pixel-convert-bench
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+
+#include "../src/pixel-convert.h"
+
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_FRAMES 200
+
+static const char * const impl_names[] = { "c", "sse2", "avx2", "neon" };
+
+static const struct {
+	const char *name;
+	uint32_t flags;
+	int in_place;
+} cases[] = {
+	{ "copy", 0, 0 },
+	{ "yflip", PIXEL_CONVERT_YFLIP, 0 },
+	{ "swap-rb", PIXEL_CONVERT_SWAP_RB, 0 },
+	{ "swap-rb yflip", PIXEL_CONVERT_SWAP_RB | PIXEL_CONVERT_YFLIP, 0 },
+	{ "opaque", PIXEL_CONVERT_OPAQUE, 0 },
+	{ "in place yflip", PIXEL_CONVERT_YFLIP, 1 },
+	{ "in place swap-rb yflip",
+	  PIXEL_CONVERT_SWAP_RB | PIXEL_CONVERT_YFLIP, 1 },
+};
+
+static double
+elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+		(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int stride = BENCH_WIDTH * 4;
+	uint32_t *src, *dst;
+	struct timespec start;
+	unsigned int i, c;
+	double ms;
+	int f;
+
+	src = malloc(stride * BENCH_HEIGHT);
+	dst = malloc(stride * BENCH_HEIGHT);
+	assert(src && dst);
+	for (f = 0; f < BENCH_WIDTH * BENCH_HEIGHT; f++)
+		src[f] = dst[f] = f * 2654435761u;
+
+	for (i = 0; i < sizeof impl_names / sizeof impl_names[0]; i++) {
+		if (pixel_convert_select(impl_names[i]) < 0)
+			continue;
+
+		for (c = 0; c < sizeof cases / sizeof cases[0]; c++) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (f = 0; f < BENCH_FRAMES; f++)
+				pixel_convert(dst, stride,
+					      cases[c].in_place ? dst : src,
+					      stride, BENCH_WIDTH,
+					      BENCH_HEIGHT, cases[c].flags);
+			ms = elapsed_ms(&start) / BENCH_FRAMES;
+
+			printf("%-5s %-24s %7.3f ms per frame, %6.2f GB/s\n",
+			       impl_names[i], cases[c].name, ms,
+			       stride * BENCH_HEIGHT / ms / 1e6);
+		}
+	}
+
+	free(src);
+	free(dst);
+
+	return 0;
+}
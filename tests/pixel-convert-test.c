@@ -0,0 +1,177 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/pixel-convert.h"
+
+static const char * const impl_names[] = { "c", "sse2", "avx2", "neon" };
+
+static const uint32_t all_flags[] = {
+	0,
+	PIXEL_CONVERT_SWAP_RB,
+	PIXEL_CONVERT_OPAQUE,
+	PIXEL_CONVERT_SWAP_RB | PIXEL_CONVERT_OPAQUE,
+	PIXEL_CONVERT_YFLIP,
+	PIXEL_CONVERT_YFLIP | PIXEL_CONVERT_SWAP_RB,
+	PIXEL_CONVERT_YFLIP | PIXEL_CONVERT_OPAQUE,
+	PIXEL_CONVERT_YFLIP | PIXEL_CONVERT_SWAP_RB | PIXEL_CONVERT_OPAQUE,
+};
+
+#define N_FLAGS (sizeof all_flags / sizeof all_flags[0])
+#define N_IMPLS (sizeof impl_names / sizeof impl_names[0])
+
+static uint32_t
+reference_pixel(uint32_t v, uint32_t flags)
+{
+	uint8_t a = v >> 24, r = v >> 16, g = v >> 8, b = v;
+
+	if (flags & PIXEL_CONVERT_SWAP_RB) {
+		r = v;
+		b = v >> 16;
+	}
+	if (flags & PIXEL_CONVERT_OPAQUE)
+		a = 0xff;
+
+	return (uint32_t) a << 24 | r << 16 | g << 8 | b;
+}
+
+static uint32_t *
+random_pixels(int stride, int height)
+{
+	uint32_t *p;
+	int i;
+
+	p = malloc(stride * height);
+	assert(p);
+	for (i = 0; i < stride * height / 4; i++)
+		p[i] = (uint32_t) rand() << 16 ^ rand();
+
+	return p;
+}
+
+/* Converts width x height pixels with every implementation and flag
+ * combination, into a separate buffer and in place, and compares each
+ * pixel with reference_pixel(); padding must be left alone. */
+static void
+check_convert(int width, int height, int src_pad, int dst_pad)
+{
+	int src_stride = (width + src_pad) * 4;
+	int dst_stride = (width + dst_pad) * 4;
+	uint32_t *src, *dst, *pristine, *expected;
+	unsigned int i, f;
+	int x, y, sy;
+
+	src = random_pixels(src_stride, height);
+	pristine = random_pixels(dst_stride, height);
+	dst = malloc(dst_stride * height);
+	expected = malloc(src_stride * height);
+	assert(dst && expected);
+
+	for (i = 0; i < N_IMPLS; i++) {
+		if (pixel_convert_select(impl_names[i]) < 0)
+			continue;
+
+		for (f = 0; f < N_FLAGS; f++) {
+			memcpy(dst, pristine, dst_stride * height);
+			pixel_convert(dst, dst_stride, src, src_stride,
+				      width, height, all_flags[f]);
+
+			for (y = 0; y < height; y++) {
+				sy = all_flags[f] & PIXEL_CONVERT_YFLIP ?
+					height - 1 - y : y;
+				for (x = 0; x < width + dst_pad; x++) {
+					uint32_t *d = dst + y * dst_stride / 4;
+					uint32_t *s = src + sy * src_stride / 4;
+					uint32_t *p = pristine +
+						y * dst_stride / 4;
+
+					if (x < width)
+						assert(d[x] == reference_pixel(s[x], all_flags[f]));
+					else
+						assert(d[x] == p[x]);
+				}
+			}
+
+			/* In place, with the source stride. */
+			memcpy(expected, src, src_stride * height);
+			pixel_convert(expected, src_stride,
+				      expected, src_stride,
+				      width, height, all_flags[f]);
+			for (y = 0; y < height; y++) {
+				sy = all_flags[f] & PIXEL_CONVERT_YFLIP ?
+					height - 1 - y : y;
+				for (x = 0; x < width; x++)
+					assert(expected[y * src_stride / 4 + x] ==
+					       reference_pixel(src[sy * src_stride / 4 + x],
+							       all_flags[f]));
+			}
+		}
+	}
+
+	pixel_convert_select(NULL);
+
+	free(src);
+	free(dst);
+	free(pristine);
+	free(expected);
+}
+
+TEST(pixel_convert_small)
+{
+	int w, h;
+
+	srand(1);
+	for (h = 1; h <= 4; h++)
+		for (w = 1; w <= 37; w++)
+			check_convert(w, h, 0, 0);
+}
+
+TEST(pixel_convert_strides)
+{
+	srand(2);
+	check_convert(33, 7, 3, 0);
+	check_convert(33, 7, 0, 5);
+	check_convert(64, 9, 1, 16);
+}
+
+TEST(pixel_convert_large)
+{
+	srand(3);
+	/* Wider than the in-place flip chunk, odd height. */
+	check_convert(1031, 67, 0, 0);
+	check_convert(640, 480, 0, 0);
+}
+
+TEST(pixel_convert_select_names)
+{
+	assert(pixel_convert_select("c") == 0);
+	assert(strcmp(pixel_convert_selected(), "c") == 0);
+	assert(pixel_convert_select("no-such-cpu") < 0);
+	assert(pixel_convert_select(NULL) == 0);
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Renders a fixed scene of solid colour and shm buffer surfaces, some
+ * of them translucent, rotated or with a buffer scale, with the pixman
+ * renderer and prints checksums of the output pixels.
+ * pixman-threads-test.sh compares the checksums of a single-threaded
+ * and a threaded renderer, which have to be identical.
+ *
+ * The renderer keeps resampled images of transformed surfaces, so the
+ * scene is repainted until those come from the cache, and the pixels
+ * must not change on the way.  Then one surface is turned further,
+ * which draws it with the NEAREST filter until the renderer's settle
+ * timer redraws it properly; that frame must match an uncached repaint
+ * of the same surface.
+ *
+ * The shm buffers belong to a client connected over a socketpair that
+ * never speaks; the module creates them on its behalf.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <sys/socket.h>
+
+#include "../src/compositor.h"
+
+#define SCENE_SURFACES 60
+
+/* Well past the renderer's settle timeout of 150 ms. */
+#define SCENE_SETTLE_MSECS 500
+
+struct scene {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	struct weston_layer layer;
+	struct weston_animation animation;
+	struct weston_transform transforms[SCENE_SURFACES];
+
+	struct weston_surface *turned;
+	struct weston_transform *turned_transform;
+	struct wl_event_source *settle_timer;
+	int frame;
+	uint32_t uncached, settled;
+
+	struct wl_client *client;
+	int client_fd;
+	uint32_t next_id;
+};
+
+static uint32_t
+fnv1a(const uint8_t *data, size_t size)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* A premultiplied argb8888 buffer with gradients and a checkerboard,
+ * so that resampling has edges to get wrong. */
+static struct weston_buffer *
+scene_create_buffer(struct scene *scene, int32_t width, int32_t height,
+		    uint32_t alpha)
+{
+	struct wl_shm_buffer *shm;
+	struct wl_resource *resource;
+	uint32_t *pixels, r, g, b;
+	int32_t x, y;
+
+	shm = wl_shm_buffer_create(scene->client, scene->next_id,
+				   width, height, width * 4,
+				   WL_SHM_FORMAT_ARGB8888);
+	assert(shm);
+	resource = wl_client_get_object(scene->client, scene->next_id++);
+	assert(resource);
+
+	pixels = wl_shm_buffer_get_data(shm);
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			r = x * 255 / width;
+			g = y * 255 / height;
+			b = ((x >> 3) ^ (y >> 3)) & 1 ? 0xff : 0x20;
+			pixels[y * width + x] = alpha << 24 |
+				(r * alpha / 255) << 16 |
+				(g * alpha / 255) << 8 |
+				(b * alpha / 255);
+		}
+	}
+
+	return weston_buffer_from_resource(resource);
+}
+
+static void
+scene_attach(struct weston_surface *surface, struct weston_buffer *buffer,
+	     int32_t scale)
+{
+	weston_buffer_reference(&surface->buffer_ref, buffer);
+	surface->buffer_scale = scale;
+	surface->compositor->renderer->attach(surface, buffer);
+}
+
+static uint32_t
+scene_checksum(struct scene *scene)
+{
+	struct weston_output *output = scene->output;
+	int width = output->current_mode->width;
+	int height = output->current_mode->height;
+	uint32_t *pixels, sum;
+	int r;
+
+	pixels = malloc(width * height * 4);
+	assert(pixels);
+
+	r = scene->compositor->renderer->read_pixels(output, PIXMAN_a8r8g8b8,
+						     pixels, 0, 0,
+						     width, height);
+	assert(r == 0);
+
+	sum = fnv1a((uint8_t *) pixels, width * height * 4);
+	free(pixels);
+
+	return sum;
+}
+
+static void
+scene_turn(struct scene *scene)
+{
+	weston_matrix_rotate_xy(&scene->turned_transform->matrix,
+				cosf(M_PI / 6), sinf(M_PI / 6));
+	weston_surface_geometry_dirty(scene->turned);
+}
+
+static void
+scene_frame(struct weston_animation *animation,
+	    struct weston_output *output, uint32_t msecs)
+{
+	struct scene *scene = container_of(animation, struct scene, animation);
+	uint32_t sum;
+
+	sum = scene_checksum(scene);
+
+	switch (scene->frame++) {
+	case 0:
+		/* The shm contents were just flushed, so the transformed
+		 * surfaces were resampled directly.  Repaint everything
+		 * with the same contents, which fills the cache... */
+		scene->uncached = sum;
+		weston_output_damage(output);
+		break;
+	case 1:
+		/* ...and once more, which draws from it. */
+		assert(sum == scene->uncached);
+		weston_output_damage(output);
+		break;
+	case 2:
+		assert(sum == scene->uncached);
+		fprintf(stderr, "pixman checksum: %08x\n", sum);
+
+		/* Leave the NEAREST frames alone; scene_settled picks
+		 * up again after the renderer's settle timer. */
+		scene_turn(scene);
+		wl_list_remove(&scene->animation.link);
+		wl_event_source_timer_update(scene->settle_timer,
+					     SCENE_SETTLE_MSECS);
+		break;
+	default:
+		/* The turned surface resampled directly again. */
+		assert(sum == scene->settled);
+		fprintf(stderr, "pixman checksum: %08x\n", sum);
+
+		wl_list_remove(&scene->animation.link);
+		wl_display_terminate(scene->compositor->wl_display);
+		return;
+	}
+
+	weston_output_schedule_repaint(output);
+}
+
+static int
+scene_settled(void *data)
+{
+	struct scene *scene = data;
+
+	/* The settled frame came from a freshly filled cache.  New
+	 * contents bump the generation of the turned surface, so the
+	 * next repaint resamples it without the cache. */
+	scene->settled = scene_checksum(scene);
+	weston_surface_damage(scene->turned);
+
+	wl_list_insert(&scene->output->animation_list,
+		       &scene->animation.link);
+	weston_output_schedule_repaint(scene->output);
+
+	return 1;
+}
+
+static void
+scene_start(void *data)
+{
+	struct scene *scene = data;
+	struct weston_output *output = scene->output;
+	struct weston_surface *surface;
+	struct weston_transform *transform;
+	struct weston_buffer *buffer;
+	int32_t width, height, scale;
+	int translucent;
+	float angle;
+	int i;
+
+	srand(1234);
+
+	for (i = 0; i < SCENE_SURFACES; i++) {
+		surface = weston_surface_create(scene->compositor);
+		assert(surface);
+
+		translucent = i % 3 == 0;
+		width = 20 + rand() % 400;
+		height = 20 + rand() % 300;
+
+		/* Every other surface draws from an shm buffer, some of
+		 * them with a buffer scale that needs resampling. */
+		if (i % 2 == 0) {
+			scale = i % 10 == 4 ? 2 : 1;
+			buffer = scene_create_buffer(scene,
+						     width * scale,
+						     height * scale,
+						     translucent ? 0x80 : 0xff);
+			scene_attach(surface, buffer, scale);
+		} else {
+			weston_surface_set_color(surface,
+						 (rand() % 256) / 255.0,
+						 (rand() % 256) / 255.0,
+						 (rand() % 256) / 255.0,
+						 translucent ? 0.5 : 1.0);
+		}
+
+		weston_surface_configure(surface,
+					 output->x - 40 +
+					 rand() % (output->width + 80),
+					 output->y - 40 +
+					 rand() % (output->height + 80),
+					 width, height);
+		/* The surface that gets turned later on sits near the top
+		 * of the stack, in the middle of the output. */
+		if (i == SCENE_SURFACES - 2) {
+			weston_surface_set_position(surface,
+						    output->x +
+						    output->width / 2,
+						    output->y +
+						    output->height / 2);
+			scene->turned = surface;
+			scene->turned_transform = &scene->transforms[i];
+		}
+		if (!translucent)
+			pixman_region32_init_rect(&surface->opaque, 0, 0,
+						  surface->geometry.width,
+						  surface->geometry.height);
+
+		transform = &scene->transforms[i];
+		wl_list_init(&transform->link);
+		if (i % 4 == 1 || i % 4 == 2) {
+			angle = (rand() % 360) * M_PI / 180.0;
+			weston_matrix_init(&transform->matrix);
+			weston_matrix_rotate_xy(&transform->matrix,
+						cosf(angle), sinf(angle));
+			wl_list_insert(&surface->geometry.transformation_list,
+				       &transform->link);
+			weston_surface_geometry_dirty(surface);
+		}
+
+		weston_layer_entry_insert(&scene->layer.surface_list, surface);
+		weston_surface_damage(surface);
+	}
+
+	scene->animation.frame = scene_frame;
+	wl_list_insert(&output->animation_list, &scene->animation.link);
+	weston_output_schedule_repaint(output);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct scene *scene;
+	int sv[2], r;
+
+	scene = calloc(1, sizeof *scene);
+	assert(scene);
+	assert(!wl_list_empty(&compositor->output_list));
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv);
+	assert(r == 0);
+	scene->client = wl_client_create(compositor->wl_display, sv[0]);
+	assert(scene->client);
+	scene->client_fd = sv[1];
+	/* Id 1 is the client's wl_display. */
+	scene->next_id = 2;
+
+	scene->compositor = compositor;
+	scene->output = container_of(compositor->output_list.next,
+				     struct weston_output, link);
+	weston_layer_init(&scene->layer, &compositor->cursor_layer.link);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	wl_event_loop_add_idle(loop, scene_start, scene);
+	scene->settle_timer = wl_event_loop_add_timer(loop, scene_settled,
+						      scene);
+	assert(scene->settle_timer);
+
+	return 0;
+}
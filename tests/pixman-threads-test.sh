@@ -0,0 +1,44 @@
+#!/bin/bash
+
+# Renders the scene of pixman-threads-test.so with one and with four
+# pixman renderer threads on the headless backend, for a few output
+# transforms and scales, and fails unless the pixels are identical.
+# The module prints one checksum once transformed surfaces are drawn
+# from the renderer's cache and one after a surface settled from an
+# animation, and dies on a failed assert if either differs from an
+# uncached repaint.
+
+WESTON=$abs_builddir/../src/weston
+BACKEND=$abs_builddir/../src/.libs/headless-backend.so
+MODULE=$abs_builddir/.libs/pixman-threads-test.so
+LOGDIR=$abs_builddir/logs
+CONFIG_DIR=$(mktemp -d)
+
+trap 'rm -rf "$CONFIG_DIR"' EXIT
+mkdir -p "$LOGDIR"
+
+checksum() {
+	local threads=$1
+	shift
+	local log="$LOGDIR/pixman-threads-$threads-$(echo $@ | tr -c 'a-z0-9\n' _).txt"
+
+	printf "[core]\npixman-threads=%s\n" $threads > "$CONFIG_DIR/weston.ini"
+	XDG_CONFIG_HOME=$CONFIG_DIR $WESTON --backend=$BACKEND --use-pixman \
+		--socket=test-pixman-threads --modules=$MODULE "$@" \
+		&> "$log"
+	sed -n 's/^pixman checksum: //p' "$log" | paste -sd ' '
+}
+
+status=0
+for args in "--width=1024 --height=640" \
+	    "--width=801 --height=599 --transform=90" \
+	    "--width=640 --height=480 --scale=2 --transform=flipped-180"; do
+	single=$(checksum 1 $args)
+	threaded=$(checksum 4 $args)
+	echo "$args: single $single, threaded $threaded"
+	if test $(echo $single | wc -w) -ne 2 -o "$single" != "$threaded"; then
+		status=1
+	fi
+done
+
+exit $status
@@ -0,0 +1,91 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/repaint-stats.h"
+
+TEST(repaint_histogram_exact_small_values)
+{
+	struct repaint_histogram h;
+	uint32_t i;
+
+	repaint_histogram_reset(&h);
+	for (i = 1; i <= 10; i++)
+		repaint_histogram_add(&h, i);
+
+	assert(h.count == 10);
+	assert(h.max == 10);
+	assert(h.sum == 55);
+	assert(repaint_histogram_percentile(&h, 50) == 5);
+	assert(repaint_histogram_percentile(&h, 99) == 10);
+	assert(repaint_histogram_percentile(&h, 100) == 10);
+}
+
+TEST(repaint_histogram_relative_error)
+{
+	struct repaint_histogram h;
+	uint32_t v, p;
+
+	/* a single sample must come back within one bucket width */
+	for (v = 1; v < 100000000; v = v * 3 / 2 + 1) {
+		repaint_histogram_reset(&h);
+		repaint_histogram_add(&h, v);
+		repaint_histogram_add(&h, UINT32_MAX);
+		p = repaint_histogram_percentile(&h, 50);
+		assert(p >= v);
+		assert(p - v <= v / 8);
+	}
+}
+
+TEST(repaint_histogram_percentiles)
+{
+	struct repaint_histogram h;
+	uint32_t p50, p99;
+	int i;
+
+	repaint_histogram_reset(&h);
+	for (i = 0; i < 990; i++)
+		repaint_histogram_add(&h, 1000);
+	for (i = 0; i < 10; i++)
+		repaint_histogram_add(&h, 20000);
+
+	p50 = repaint_histogram_percentile(&h, 50);
+	p99 = repaint_histogram_percentile(&h, 99);
+	assert(p50 >= 1000 && p50 <= 1125);
+	assert(p99 >= 1000 && p99 <= 1125);
+	assert(repaint_histogram_percentile(&h, 99.5) == 20000);
+	assert(h.max == 20000);
+}
+
+TEST(repaint_histogram_empty)
+{
+	struct repaint_histogram h;
+
+	repaint_histogram_reset(&h);
+	assert(repaint_histogram_percentile(&h, 50) == 0);
+	assert(repaint_histogram_percentile(&h, 99) == 0);
+}
@@ -0,0 +1,286 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/* The [screencast] client of screencast-test.sh.  Streams the output
+ * furthest right, checks that every damage rectangle lies within the
+ * framebuffer, and exits with 0 once frames after the first full one
+ * kept bringing damage, including red pixels from screencast-test.so.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <wayland-client.h>
+
+#include "../shared/os-compatibility.h"
+#include "screenshooter-client-protocol.h"
+
+#define CLIENT_BUFFERS 2
+#define CLIENT_FRAMES 20
+
+struct client_output {
+	struct wl_output *output;
+	int32_t x;
+	struct wl_list link;
+};
+
+struct client_buffer {
+	struct wl_buffer *buffer;
+	uint32_t *data;
+};
+
+struct client {
+	struct wl_display *display;
+	struct wl_shm *shm;
+	struct screenshooter *shooter;
+	struct wl_list outputs;
+	struct screencast_stream *stream;
+	int32_t width, height;
+	struct client_buffer buffers[CLIENT_BUFFERS];
+	uint32_t *mirror;
+	int damaged;		/* damage events in the current frame */
+	int frames, damaged_frames;
+	int failed;
+};
+
+static void
+output_handle_geometry(void *data, struct wl_output *wl_output,
+		       int32_t x, int32_t y,
+		       int32_t physical_width, int32_t physical_height,
+		       int32_t subpixel, const char *make, const char *model,
+		       int32_t transform)
+{
+	struct client_output *output = data;
+
+	output->x = x;
+}
+
+static void
+output_handle_mode(void *data, struct wl_output *wl_output, uint32_t flags,
+		   int32_t width, int32_t height, int32_t refresh)
+{
+}
+
+static const struct wl_output_listener output_listener = {
+	output_handle_geometry,
+	output_handle_mode
+};
+
+static void
+handle_global(void *data, struct wl_registry *registry,
+	      uint32_t name, const char *interface, uint32_t version)
+{
+	struct client *client = data;
+	struct client_output *output;
+
+	if (strcmp(interface, "wl_output") == 0) {
+		output = calloc(1, sizeof *output);
+		if (output == NULL)
+			exit(1);
+		output->output = wl_registry_bind(registry, name,
+						  &wl_output_interface, 1);
+		wl_output_add_listener(output->output,
+				       &output_listener, output);
+		wl_list_insert(&client->outputs, &output->link);
+	} else if (strcmp(interface, "wl_shm") == 0) {
+		client->shm = wl_registry_bind(registry, name,
+					       &wl_shm_interface, 1);
+	} else if (strcmp(interface, "screenshooter") == 0 && version >= 3) {
+		client->shooter = wl_registry_bind(registry, name,
+						   &screenshooter_interface, 3);
+	}
+}
+
+static const struct wl_registry_listener registry_listener = {
+	handle_global
+};
+
+static struct wl_buffer *
+create_buffer(struct client *client, uint32_t **data)
+{
+	struct wl_shm_pool *pool;
+	struct wl_buffer *buffer;
+	int stride = client->width * 4;
+	int size = stride * client->height;
+	int fd;
+
+	fd = os_create_anonymous_file(size);
+	if (fd < 0)
+		exit(1);
+
+	*data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (*data == MAP_FAILED)
+		exit(1);
+
+	pool = wl_shm_create_pool(client->shm, fd, size);
+	buffer = wl_shm_pool_create_buffer(pool, 0, client->width,
+					   client->height, stride,
+					   WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	return buffer;
+}
+
+static void
+stream_handle_format(void *data, struct screencast_stream *stream,
+		     int32_t width, int32_t height)
+{
+	struct client *client = data;
+	int i;
+
+	/* Only the initial format event is expected. */
+	if (client->width) {
+		fprintf(stderr, "unexpected format %dx%d\n", width, height);
+		exit(1);
+	}
+
+	client->width = width;
+	client->height = height;
+	client->mirror = calloc(width * height, 4);
+	if (client->mirror == NULL)
+		exit(1);
+
+	for (i = 0; i < CLIENT_BUFFERS; i++) {
+		client->buffers[i].buffer =
+			create_buffer(client, &client->buffers[i].data);
+		screencast_stream_lend_buffer(stream,
+					      client->buffers[i].buffer);
+	}
+}
+
+static void
+stream_handle_damage(void *data, struct screencast_stream *stream,
+		     int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct client *client = data;
+
+	if (x < 0 || y < 0 || width <= 0 || height <= 0 ||
+	    x + width > client->width || y + height > client->height) {
+		fprintf(stderr, "damage %d,%d %dx%d outside of %dx%d\n",
+			x, y, width, height, client->width, client->height);
+		client->failed = 1;
+		return;
+	}
+
+	/* The pixels come with the buffer of the frame event. */
+	client->damaged++;
+}
+
+static void
+stream_handle_frame(void *data, struct screencast_stream *stream,
+		    struct wl_buffer *buffer, uint32_t time, uint32_t frames)
+{
+	struct client *client = data;
+	struct client_buffer *b = NULL;
+	int i;
+
+	for (i = 0; i < CLIENT_BUFFERS; i++)
+		if (client->buffers[i].buffer == buffer)
+			b = &client->buffers[i];
+	if (b == NULL) {
+		fprintf(stderr, "frame returned an unknown buffer\n");
+		exit(1);
+	}
+
+	if (client->frames++ > 0 && client->damaged > 0)
+		client->damaged_frames++;
+	client->damaged = 0;
+
+	memcpy(client->mirror, b->data, client->width * client->height * 4);
+	screencast_stream_lend_buffer(stream, buffer);
+}
+
+static const struct screencast_stream_listener stream_listener = {
+	stream_handle_format,
+	stream_handle_damage,
+	stream_handle_frame
+};
+
+static int
+mirror_has_red(struct client *client)
+{
+	int i;
+
+	for (i = 0; i < client->width * client->height; i++)
+		if ((client->mirror[i] & 0xffffff) == 0xff0000)
+			return 1;
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct client client;
+	struct client_output *output, *right = NULL;
+	struct wl_registry *registry;
+
+	memset(&client, 0, sizeof client);
+	wl_list_init(&client.outputs);
+
+	client.display = wl_display_connect(NULL);
+	if (client.display == NULL)
+		return 1;
+
+	registry = wl_display_get_registry(client.display);
+	wl_registry_add_listener(registry, &registry_listener, &client);
+	wl_display_roundtrip(client.display);
+	wl_display_roundtrip(client.display);
+
+	if (client.shm == NULL || client.shooter == NULL) {
+		fprintf(stderr, "no wl_shm or screenshooter version 3\n");
+		return 1;
+	}
+
+	wl_list_for_each(output, &client.outputs, link)
+		if (right == NULL || output->x > right->x)
+			right = output;
+	if (right == NULL || right->x == 0) {
+		fprintf(stderr, "needs an output right of another one\n");
+		return 1;
+	}
+
+	client.stream = screenshooter_screencast(client.shooter,
+						 right->output);
+	screencast_stream_add_listener(client.stream, &stream_listener,
+				       &client);
+
+	while (!client.failed && client.damaged_frames < CLIENT_FRAMES)
+		if (wl_display_dispatch(client.display) < 0)
+			return 1;
+
+	if (client.failed || !mirror_has_red(&client)) {
+		fprintf(stderr, "screencast of output at x=%d failed\n",
+			right->x);
+		return 1;
+	}
+
+	fprintf(stderr, "screencast of output at x=%d: %d damaged frames\n",
+		right->x, client.damaged_frames);
+	return 0;
+}
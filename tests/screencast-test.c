@@ -0,0 +1,111 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/* Moves a red square around the last output, which the headless
+ * backend places right of the others, for screencast-test.sh.  A second
+ * square straddles the edge between the last two outputs. */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "../src/compositor.h"
+
+#define SQUARE_SIZE 64
+
+struct screencast_test {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	struct weston_layer layer;
+	struct weston_animation animation;
+	struct weston_surface *moving;
+};
+
+static struct weston_surface *
+red_square(struct screencast_test *test, int32_t x, int32_t y)
+{
+	struct weston_surface *surface;
+
+	surface = weston_surface_create(test->compositor);
+	assert(surface);
+	weston_surface_set_color(surface, 1.0, 0.0, 0.0, 1.0);
+	weston_surface_configure(surface, x, y, SQUARE_SIZE, SQUARE_SIZE);
+	pixman_region32_init_rect(&surface->opaque, 0, 0,
+				  SQUARE_SIZE, SQUARE_SIZE);
+	weston_layer_entry_insert(&test->layer.surface_list, surface);
+	weston_surface_damage(surface);
+
+	return surface;
+}
+
+static void
+screencast_test_frame(struct weston_animation *animation,
+		      struct weston_output *output, uint32_t msecs)
+{
+	struct screencast_test *test =
+		container_of(animation, struct screencast_test, animation);
+	int range = output->width - SQUARE_SIZE;
+
+	weston_surface_set_position(test->moving,
+				    output->x +
+				    (animation->frame_counter * 16) % range,
+				    output->y + output->height / 2);
+	weston_surface_damage(test->moving);
+	weston_output_schedule_repaint(output);
+}
+
+static void
+screencast_test_start(void *data)
+{
+	struct screencast_test *test = data;
+	struct weston_output *output = test->output;
+
+	test->moving = red_square(test, output->x, output->y);
+	red_square(test, output->x - SQUARE_SIZE / 2, output->y + 10);
+
+	test->animation.frame = screencast_test_frame;
+	wl_list_insert(&output->animation_list, &test->animation.link);
+	weston_output_schedule_repaint(output);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct screencast_test *test;
+	struct weston_output *output;
+
+	test = calloc(1, sizeof *test);
+	assert(test);
+
+	test->compositor = compositor;
+	wl_list_for_each(output, &compositor->output_list, link)
+		if (test->output == NULL || output->x > test->output->x)
+			test->output = output;
+	assert(test->output && test->output->x > 0);
+	weston_layer_init(&test->layer, &compositor->cursor_layer.link);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	wl_event_loop_add_idle(loop, screencast_test_start, test);
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# Streams the second of two headless outputs to screencast-client, the
+# configured [screencast] client, while screencast-test.so animates a
+# surface on it.  The client checks that the damage it gets lies within
+# the output's framebuffer and exits with its verdict.
+
+WESTON=$abs_builddir/../src/weston
+BACKEND=$abs_builddir/../src/.libs/headless-backend.so
+MODULE=$abs_builddir/.libs/screencast-test.so
+CLIENT=$abs_builddir/screencast-client
+LOGDIR=$abs_builddir/logs
+LOG=$LOGDIR/screencast-test.txt
+CONFIG_DIR=$(mktemp -d)
+
+trap 'rm -rf "$CONFIG_DIR"' EXIT
+mkdir -p "$LOGDIR"
+
+printf "[screencast]\npath=%s\n" "$CLIENT" > "$CONFIG_DIR/weston.ini"
+XDG_CONFIG_HOME=$CONFIG_DIR $WESTON --backend=$BACKEND --use-pixman \
+	--output-count=2 --width=320 --height=240 \
+	--socket=test-screencast --modules=$MODULE &> "$LOG" &
+pid=$!
+
+for i in $(seq 100); do
+	if grep -q "$CLIENT exited with status" "$LOG"; then
+		break
+	fi
+	if ! kill -0 $pid 2> /dev/null; then
+		break
+	fi
+	sleep 0.2
+done
+
+kill $pid 2> /dev/null
+wait $pid 2> /dev/null
+
+grep "screencast of output" "$LOG"
+grep -q "$CLIENT exited with status 0" "$LOG"
@@ -0,0 +1,164 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "../src/compositor.h"
+
+#define DIRTY_ROUNDS 5
+
+/* Shells update the transform of a surface they just moved, before the
+ * next repaint gets to the transform dirty list.  Moving it again must
+ * not link it into that list twice.  Moving a parent dirties its child
+ * after it, which puts the child ahead of the parent in the list; the
+ * repaint must still get through both. */
+
+struct dirty_test {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	struct weston_layer layer;
+	struct weston_animation animation;
+	struct weston_surface *surface;
+	struct weston_surface *parent, *child;
+	int round;
+};
+
+/* How often a surface is linked into the transform dirty list,
+ * checking that the list is sound on the way. */
+static int
+dirty_list_count(struct dirty_test *test, struct weston_surface *surface)
+{
+	struct wl_list *list = &test->compositor->transform_dirty_list;
+	struct wl_list *link;
+	int count = 0, length = 0;
+
+	for (link = list->next; link != list; link = link->next) {
+		assert(link->next->prev == link);
+		assert(++length < 1000);
+		if (link == &surface->transform.dirty_link)
+			count++;
+	}
+
+	return count;
+}
+
+static void
+dirty_test_move(struct dirty_test *test)
+{
+	struct weston_surface *surface = test->surface;
+	float x, y;
+
+	weston_surface_set_position(surface, 10 * test->round, 20);
+	weston_surface_update_transform(surface);
+	assert(dirty_list_count(test, surface) == 0);
+
+	weston_surface_to_global_float(surface, 0, 0, &x, &y);
+	assert(x == 10 * test->round && y == 20);
+
+	weston_surface_set_position(surface, 10 * test->round + 5, 30);
+	assert(dirty_list_count(test, surface) == 1);
+
+	weston_surface_set_position(test->parent, 200, 10 * test->round);
+	assert(dirty_list_count(test, test->parent) == 1);
+	assert(dirty_list_count(test, test->child) == 1);
+}
+
+static void
+dirty_test_frame(struct weston_animation *animation,
+		 struct weston_output *output, uint32_t msecs)
+{
+	struct dirty_test *test =
+		container_of(animation, struct dirty_test, animation);
+	float x, y;
+
+	/* The repaint has updated the last positions. */
+	if (test->round > 0) {
+		assert(wl_list_empty(&test->compositor->transform_dirty_list));
+		weston_surface_to_global_float(test->surface, 0, 0, &x, &y);
+		assert(x == 10 * test->round + 5 && y == 30);
+		weston_surface_to_global_float(test->child, 0, 0, &x, &y);
+		assert(x == 200 + 10 && y == 10 * test->round + 10);
+	}
+
+	if (++test->round == DIRTY_ROUNDS) {
+		wl_list_remove(&test->animation.link);
+		weston_layer_entry_remove(test->surface);
+		weston_surface_destroy(test->surface);
+		weston_layer_entry_remove(test->child);
+		weston_surface_destroy(test->child);
+		weston_layer_entry_remove(test->parent);
+		weston_surface_destroy(test->parent);
+		wl_display_terminate(test->compositor->wl_display);
+		return;
+	}
+
+	dirty_test_move(test);
+	weston_output_schedule_repaint(output);
+}
+
+static void
+dirty_test_start(void *data)
+{
+	struct dirty_test *test = data;
+
+	test->surface = weston_surface_create(test->compositor);
+	assert(test->surface);
+	weston_surface_configure(test->surface, 0, 0, 100, 100);
+	weston_layer_entry_insert(&test->layer.surface_list, test->surface);
+
+	test->parent = weston_surface_create(test->compositor);
+	test->child = weston_surface_create(test->compositor);
+	assert(test->parent && test->child);
+	weston_surface_configure(test->parent, 200, 0, 50, 50);
+	weston_surface_configure(test->child, 10, 10, 20, 20);
+	weston_surface_set_transform_parent(test->child, test->parent);
+	weston_layer_entry_insert(&test->layer.surface_list, test->parent);
+	weston_layer_entry_insert(&test->layer.surface_list, test->child);
+
+	test->animation.frame = dirty_test_frame;
+	wl_list_insert(&test->output->animation_list, &test->animation.link);
+	weston_output_schedule_repaint(test->output);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct dirty_test *test;
+
+	test = calloc(1, sizeof *test);
+	assert(test);
+	assert(!wl_list_empty(&compositor->output_list));
+
+	test->compositor = compositor;
+	test->output = container_of(compositor->output_list.next,
+				    struct weston_output, link);
+	weston_layer_init(&test->layer, &compositor->cursor_layer.link);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	wl_event_loop_add_idle(loop, dirty_test_start, test);
+
+	return 0;
+}
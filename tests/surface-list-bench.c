@@ -0,0 +1,206 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Surface list repaint microbenchmark.
+ *
+ * Stacks an increasing number of surfaces and measures the compositor
+ * CPU time spent per output frame.  A "static" run leaves the stack
+ * alone, so the surface list is reused from frame to frame; a
+ * "restack" run raises one surface every frame, forcing a rebuild.
+ * Run it against the headless backend:
+ *
+ *   weston --backend=headless-backend.so \
+ *          --modules=tests/.libs/surface-list-bench.so
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+
+#include "../src/compositor.h"
+
+#define BENCH_WARMUP_FRAMES 5
+#define BENCH_FRAMES 60
+
+static const int bench_surface_counts[] = { 10, 100, 300, 1000, 3000 };
+
+#define BENCH_RUNS \
+	(2 * sizeof bench_surface_counts / sizeof bench_surface_counts[0])
+
+struct bench {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	struct weston_layer layer;
+	struct weston_animation animation;
+	struct weston_surface **surfaces;
+	int count;
+	int restack;
+	unsigned int run;
+	struct timespec start;
+};
+
+static double
+cpu_elapsed_us(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000000.0 +
+		(now.tv_nsec - start->tv_nsec) / 1000.0;
+}
+
+static void
+bench_destroy_surfaces(struct bench *bench)
+{
+	int i;
+
+	for (i = 0; i < bench->count; i++) {
+		weston_layer_entry_remove(bench->surfaces[i]);
+		weston_surface_destroy(bench->surfaces[i]);
+	}
+
+	free(bench->surfaces);
+	bench->surfaces = NULL;
+	bench->count = 0;
+}
+
+static void
+bench_create_surfaces(struct bench *bench, int count)
+{
+	struct weston_output *output = bench->output;
+	struct weston_surface *surface;
+	int i;
+
+	bench->surfaces = calloc(count, sizeof *bench->surfaces);
+	assert(bench->surfaces);
+
+	for (i = 0; i < count; i++) {
+		surface = weston_surface_create(bench->compositor);
+		assert(surface);
+		weston_surface_configure(surface,
+					 output->x + (i * 37) % output->width,
+					 output->y + (i * 53) % output->height,
+					 64, 64);
+		weston_layer_entry_insert(&bench->layer.surface_list, surface);
+		bench->surfaces[i] = surface;
+	}
+
+	bench->count = count;
+}
+
+static void
+bench_finish(struct bench *bench)
+{
+	struct weston_compositor *compositor = bench->compositor;
+
+	wl_list_remove(&bench->animation.link);
+	wl_list_remove(&bench->layer.link);
+	free(bench);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+static void
+bench_start_run(struct bench *bench)
+{
+	int count = bench_surface_counts[bench->run / 2];
+
+	bench_destroy_surfaces(bench);
+	bench_create_surfaces(bench, count);
+	bench->restack = bench->run % 2;
+	bench->animation.frame_counter = 0;
+}
+
+static void
+bench_frame(struct weston_animation *animation,
+	    struct weston_output *output, uint32_t msecs)
+{
+	struct bench *bench = container_of(animation, struct bench, animation);
+	struct weston_surface *bottom;
+	double us;
+
+	if (animation->frame_counter == BENCH_WARMUP_FRAMES)
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &bench->start);
+
+	if (animation->frame_counter ==
+	    BENCH_WARMUP_FRAMES + BENCH_FRAMES) {
+		us = cpu_elapsed_us(&bench->start) / BENCH_FRAMES;
+		fprintf(stderr, "%-8s %5d surfaces: %8.1f us per frame\n",
+			bench->restack ? "restack" : "static",
+			bench->count, us);
+
+		if (++bench->run == BENCH_RUNS) {
+			bench_destroy_surfaces(bench);
+			bench_finish(bench);
+			return;
+		}
+
+		bench_start_run(bench);
+	}
+
+	if (bench->restack) {
+		bottom = container_of(bench->layer.surface_list.prev,
+				      struct weston_surface, layer_link);
+		weston_surface_restack(bottom, &bench->layer.surface_list);
+	}
+
+	weston_output_schedule_repaint(output);
+}
+
+static void
+surface_list_bench(void *data)
+{
+	struct bench *bench = data;
+
+	bench_start_run(bench);
+
+	bench->animation.frame = bench_frame;
+	wl_list_insert(&bench->output->animation_list,
+		       &bench->animation.link);
+	weston_output_schedule_repaint(bench->output);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct bench *bench;
+
+	if (wl_list_empty(&compositor->output_list))
+		return -1;
+
+	bench = calloc(1, sizeof *bench);
+	if (bench == NULL)
+		return -1;
+
+	bench->compositor = compositor;
+	bench->output = container_of(compositor->output_list.next,
+				     struct weston_output, link);
+	weston_layer_init(&bench->layer, &compositor->cursor_layer.link);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	wl_event_loop_add_idle(loop, surface_list_bench, bench);
+
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/* wcap delta and run length encoder microbenchmark.
+ *
+ * Replays a recording made with the compositor's recorder (super+r)
+ * and encodes every damaged rectangle of every frame again with each
+ * implementation the CPU supports, checking that they all produce the
+ * same stream, and prints the encoding throughput:
+ *
+ *   tests/wcap-encode-bench capture.wcap
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "../wcap/wcap-decode.h"
+#include "../src/wcap-encode.h"
+
+static const char * const impl_names[] = { "c", "sse2", "avx2", "neon" };
+
+#define N_IMPLS (sizeof impl_names / sizeof impl_names[0])
+
+struct impl_run {
+	int supported;
+	uint32_t *ref;
+	double ms;
+	uint64_t words;
+};
+
+static double
+elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+		(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct wcap_decoder *decoder;
+	struct wcap_frame_header *header;
+	struct wcap_rectangle *rects, r;
+	struct impl_run runs[N_IMPLS];
+	uint32_t *src, *out, *expected, *end, *expected_end = NULL;
+	int frame_size, width, height, y;
+	uint64_t pixels = 0;
+	struct timespec start;
+	unsigned int i, j, nrects;
+	int first;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s FILE.wcap\n", argv[0]);
+		return 1;
+	}
+
+	decoder = wcap_decoder_create(argv[1]);
+	if (decoder == NULL) {
+		fprintf(stderr, "failed to open %s\n", argv[1]);
+		return 1;
+	}
+
+	frame_size = decoder->width * decoder->height;
+	src = malloc(frame_size * 4);
+	out = malloc(frame_size * 4);
+	expected = malloc(frame_size * 4);
+	assert(src && out && expected);
+
+	for (i = 0; i < N_IMPLS; i++) {
+		runs[i].supported = wcap_encode_select(impl_names[i]) == 0;
+		runs[i].ref = calloc(frame_size, 4);
+		runs[i].ms = 0;
+		runs[i].words = 0;
+		assert(runs[i].ref);
+	}
+
+	for (;;) {
+		header = decoder->p;
+		if (!wcap_decoder_get_frame(decoder))
+			break;
+
+		rects = (struct wcap_rectangle *) (header + 1);
+		nrects = header->nrects & ~WCAP_FRAME_KEYFRAME;
+		for (j = 0; j < nrects; j++) {
+			r = rects[j];
+			width = r.x2 - r.x1;
+			height = r.y2 - r.y1;
+			for (y = 0; y < height; y++)
+				memcpy(src + y * width,
+				       decoder->frame +
+				       (r.y1 + y) * decoder->width + r.x1,
+				       width * 4);
+			pixels += width * height;
+
+			first = 1;
+			for (i = 0; i < N_IMPLS; i++) {
+				if (!runs[i].supported)
+					continue;
+
+				wcap_encode_select(impl_names[i]);
+				clock_gettime(CLOCK_MONOTONIC, &start);
+				end = wcap_encode_rect(out, src, width, height,
+						runs[i].ref + r.y1 * decoder->width + r.x1,
+						decoder->width);
+				runs[i].ms += elapsed_ms(&start);
+				runs[i].words += end - out;
+
+				if (first) {
+					memcpy(expected, out,
+					       (end - out) * 4);
+					expected_end = expected + (end - out);
+					first = 0;
+				} else if (end - out != expected_end - expected ||
+					   memcmp(out, expected,
+						  (end - out) * 4) != 0) {
+					fprintf(stderr, "%s differs in frame %u\n",
+						impl_names[i], decoder->count);
+					return 1;
+				}
+			}
+		}
+	}
+
+	printf("%u frames, %.1f Mpixels damaged, %.1f%% of raw size\n",
+	       decoder->count, pixels / 1e6,
+	       pixels ? 100.0 * runs[0].words / pixels : 0.0);
+	for (i = 0; i < N_IMPLS; i++) {
+		if (!runs[i].supported)
+			continue;
+		printf("%-5s %9.2f ms total, %8.1f Mpixel/s\n",
+		       impl_names[i], runs[i].ms,
+		       runs[i].ms > 0 ? pixels / runs[i].ms / 1e3 : 0.0);
+	}
+
+	for (i = 0; i < N_IMPLS; i++)
+		free(runs[i].ref);
+	free(src);
+	free(out);
+	free(expected);
+	wcap_decoder_destroy(decoder);
+
+	return 0;
+}
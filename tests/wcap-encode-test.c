@@ -0,0 +1,244 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/wcap-encode.h"
+
+static const char * const impl_names[] = { "c", "sse2", "avx2", "neon" };
+
+#define N_IMPLS (sizeof impl_names / sizeof impl_names[0])
+
+/* The recorder's original pixel at a time encoder. */
+static uint32_t *
+reference_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+static uint32_t *
+reference_encode(uint32_t *p, const uint32_t *s, int width, int height,
+		 uint32_t *ref, int ref_stride)
+{
+	uint32_t next, delta, prev = 0, *d;
+	unsigned char dr, dg, db;
+	int x, y, run = 0;
+
+	for (y = 0; y < height; y++) {
+		d = ref + y * ref_stride;
+		for (x = 0; x < width; x++) {
+			next = *s++;
+			dr = (next >> 16) - (d[x] >> 16);
+			dg = (next >>  8) - (d[x] >>  8);
+			db = (next >>  0) - (d[x] >>  0);
+			delta = (dr << 16) | (dg << 8) | (db << 0);
+			d[x] = next;
+			if (run == 0 || delta == prev) {
+				run++;
+			} else {
+				p = reference_run(p, prev, run);
+				run = 1;
+			}
+			prev = delta;
+		}
+	}
+
+	return reference_run(p, prev, run);
+}
+
+/* Screen-like content: stretches of unchanged or identically changed
+ * pixels of random length, some longer than a run word holds, between
+ * noise.  The alpha byte is random and must not matter. */
+static void
+fill_frames(uint32_t *prev, uint32_t *next, int count)
+{
+	uint32_t color = 0, shift = 0;
+	int i, left = 0, kind = 0;
+
+	for (i = 0; i < count; i++) {
+		if (left == 0) {
+			kind = rand() % 4;
+			left = 1 + rand() % (rand() % 8 ? 40 : 700);
+			color = (uint32_t) rand() << 16 ^ rand();
+			shift = rand() % 2 ? 0 : 0x010101 * (rand() % 3);
+		}
+		left--;
+
+		prev[i] = (uint32_t) rand() << 16 ^ rand();
+		switch (kind) {
+		case 0:
+			next[i] = prev[i] ^ (rand() & 0xff000000);
+			break;
+		case 1:
+			next[i] = prev[i] + shift;
+			break;
+		case 2:
+			prev[i] = color + (rand() & 0xff000000);
+			next[i] = color;
+			break;
+		default:
+			next[i] = (uint32_t) rand() << 16 ^ rand();
+			break;
+		}
+	}
+}
+
+/* Encodes width x height pixels against a reference frame with a
+ * padded stride, top-down and bottom-up, with every implementation,
+ * into a separate buffer and in place, and compares the stream and
+ * the updated reference with reference_encode(). */
+static void
+check_encode(int width, int height, int pad)
+{
+	int stride = width + pad, size = stride * height;
+	uint32_t *prev, *next, *src, *ref, *expected_ref, *out, *expected;
+	uint32_t *end, *expected_end, *r, *er;
+	unsigned int i;
+	int flip, in_place, ref_stride;
+
+	prev = malloc(size * 4);
+	next = malloc(size * 4);
+	src = malloc(width * height * 4);
+	ref = malloc(size * 4);
+	expected_ref = malloc(size * 4);
+	out = malloc(width * height * 4);
+	expected = malloc(width * height * 4);
+	assert(prev && next && src && ref && expected_ref && out && expected);
+
+	fill_frames(prev, next, size);
+	for (i = 0; i < (unsigned int) height; i++)
+		memcpy(src + i * width, next + i * stride, width * 4);
+
+	for (flip = 0; flip < 2; flip++) {
+		ref_stride = flip ? -stride : stride;
+		r = ref + (flip ? (height - 1) * stride : 0);
+		er = expected_ref + (flip ? (height - 1) * stride : 0);
+
+		memcpy(expected_ref, prev, size * 4);
+		expected_end = reference_encode(expected, src, width, height,
+						er, ref_stride);
+
+		for (i = 0; i < N_IMPLS; i++) {
+			if (wcap_encode_select(impl_names[i]) < 0)
+				continue;
+
+			for (in_place = 0; in_place < 2; in_place++) {
+				memcpy(ref, prev, size * 4);
+				if (in_place) {
+					memcpy(out, src, width * height * 4);
+					end = wcap_encode_rect(out, out,
+							       width, height,
+							       r, ref_stride);
+				} else {
+					end = wcap_encode_rect(out, src,
+							       width, height,
+							       r, ref_stride);
+				}
+
+				assert(end - out == expected_end - expected);
+				assert(memcmp(out, expected,
+					      (end - out) * 4) == 0);
+				assert(memcmp(ref, expected_ref,
+					      size * 4) == 0);
+			}
+		}
+	}
+
+	wcap_encode_select(NULL);
+
+	free(prev);
+	free(next);
+	free(src);
+	free(ref);
+	free(expected_ref);
+	free(out);
+	free(expected);
+}
+
+TEST(wcap_encode_small)
+{
+	int w, h;
+
+	srand(1);
+	for (h = 1; h <= 4; h++)
+		for (w = 1; w <= 37; w++)
+			check_encode(w, h, 0);
+}
+
+TEST(wcap_encode_strides)
+{
+	srand(2);
+	check_encode(33, 7, 3);
+	check_encode(64, 9, 16);
+}
+
+TEST(wcap_encode_large)
+{
+	srand(3);
+	check_encode(1031, 67, 5);
+	check_encode(640, 480, 0);
+}
+
+TEST(wcap_encode_unchanged)
+{
+	uint32_t *ref, *src, *end;
+	int n = 1920 * 1080;
+
+	/* One run, split into power of two words. */
+	ref = calloc(n, 4);
+	src = calloc(n, 4);
+	assert(ref && src);
+	end = wcap_encode_rect(src, src, 1920, 1080, ref, 1920);
+	assert(end - src == 8);
+	assert(src[0] == 0xed000000);
+	assert(src[7] == 0xe3000000);
+
+	free(ref);
+	free(src);
+}
+
+TEST(wcap_encode_select_names)
+{
+	assert(wcap_encode_select("c") == 0);
+	assert(strcmp(wcap_encode_selected(), "c") == 0);
+	assert(wcap_encode_select("no-such-cpu") < 0);
+	assert(wcap_encode_select(NULL) == 0);
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Taskbar window registry microbenchmark.
+ *
+ * Maps, toggles and unmaps a large number of surfaces the way
+ * desktop-shell does for its taskbar, once looking windows up through
+ * the window registry and once through a linear list scan.  Run it
+ * against the headless backend:
+ *
+ *   weston --backend=headless-backend.so \
+ *          --modules=tests/.libs/window-registry-bench.so
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+
+#include "../src/compositor.h"
+#include "../src/window-registry.h"
+
+#define BENCH_WINDOWS 10000
+
+struct bench_window {
+	struct weston_surface *surface;
+	uint32_t id;
+	struct wl_list link;
+};
+
+struct bench {
+	struct weston_compositor *compositor;
+	struct weston_layer shown_layer;
+	struct weston_layer hidden_layer;
+	struct window_registry registry;
+	struct wl_list window_list;
+	struct bench_window windows[BENCH_WINDOWS];
+};
+
+static double
+elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+		(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static void
+bench_map(struct bench *bench, int use_registry)
+{
+	struct bench_window *window;
+	int i;
+
+	for (i = 0; i < BENCH_WINDOWS; i++) {
+		window = &bench->windows[i];
+		window->surface = weston_surface_create(bench->compositor);
+		assert(window->surface);
+		weston_surface_configure(window->surface,
+					 i % 1000, i / 10, 100, 100);
+		weston_layer_entry_insert(&bench->shown_layer.surface_list,
+					  window->surface);
+
+		if (use_registry) {
+			window->id = window_registry_insert(&bench->registry,
+							    window);
+			assert(window->id != 0);
+		} else {
+			window->id = i + 1;
+			wl_list_insert(&bench->window_list, &window->link);
+		}
+	}
+}
+
+static struct bench_window *
+bench_find(struct bench *bench, uint32_t id, int use_registry)
+{
+	struct bench_window *window;
+
+	if (use_registry)
+		return window_registry_lookup(&bench->registry, id);
+
+	wl_list_for_each(window, &bench->window_list, link)
+		if (window->id == id)
+			return window;
+
+	return NULL;
+}
+
+static void
+bench_toggle(struct bench *bench, int use_registry)
+{
+	struct bench_window *window;
+	struct weston_layer *layer;
+	int i, state;
+
+	for (state = 0; state < 2; state++) {
+		layer = state ? &bench->shown_layer : &bench->hidden_layer;
+		for (i = 0; i < BENCH_WINDOWS; i++) {
+			window = bench_find(bench, bench->windows[i].id,
+					    use_registry);
+			assert(window == &bench->windows[i]);
+			weston_layer_entry_remove(window->surface);
+			weston_layer_entry_insert(&layer->surface_list,
+						  window->surface);
+		}
+	}
+}
+
+static void
+bench_unmap(struct bench *bench, int use_registry)
+{
+	struct bench_window *window;
+	int i;
+
+	for (i = 0; i < BENCH_WINDOWS; i++) {
+		window = bench_find(bench, bench->windows[i].id, use_registry);
+		assert(window);
+		if (use_registry)
+			window_registry_remove(&bench->registry, window->id);
+		else
+			wl_list_remove(&window->link);
+
+		weston_layer_entry_remove(window->surface);
+		weston_surface_destroy(window->surface);
+	}
+}
+
+static void
+bench_run(struct bench *bench, int use_registry)
+{
+	struct timespec start;
+	double map, toggle, unmap;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bench_map(bench, use_registry);
+	map = elapsed_ms(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bench_toggle(bench, use_registry);
+	toggle = elapsed_ms(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bench_unmap(bench, use_registry);
+	unmap = elapsed_ms(&start);
+
+	fprintf(stderr, "%-8s %d windows: map %.2f ms, "
+		"hide+show %.2f ms, unmap %.2f ms\n",
+		use_registry ? "registry" : "list", BENCH_WINDOWS,
+		map, toggle, unmap);
+}
+
+static void
+window_registry_bench(void *data)
+{
+	struct bench *bench = data;
+	struct weston_compositor *compositor = bench->compositor;
+
+	bench_run(bench, 0);
+	bench_run(bench, 1);
+
+	window_registry_release(&bench->registry);
+	wl_list_remove(&bench->shown_layer.link);
+	free(bench);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct bench *bench;
+
+	bench = calloc(1, sizeof *bench);
+	if (bench == NULL)
+		return -1;
+
+	bench->compositor = compositor;
+	weston_layer_init(&bench->shown_layer, &compositor->cursor_layer.link);
+	/* like the taskbar layer, the hidden layer is not in the stack */
+	weston_layer_init(&bench->hidden_layer, NULL);
+	window_registry_init(&bench->registry);
+	wl_list_init(&bench->window_list);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	wl_event_loop_add_idle(loop, window_registry_bench, bench);
+
+	return 0;
+}
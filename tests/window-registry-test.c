@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/window-registry.h"
+
+TEST(window_registry_insert_lookup)
+{
+	struct window_registry registry;
+	int values[100];
+	uint32_t ids[100];
+	int i;
+
+	window_registry_init(&registry);
+
+	for (i = 0; i < 100; i++) {
+		ids[i] = window_registry_insert(&registry, &values[i]);
+		assert(ids[i] != 0);
+	}
+	assert(registry.count == 100);
+
+	for (i = 0; i < 100; i++)
+		assert(window_registry_lookup(&registry, ids[i]) == &values[i]);
+
+	assert(window_registry_lookup(&registry, 0) == NULL);
+
+	window_registry_release(&registry);
+}
+
+TEST(window_registry_stale_id)
+{
+	struct window_registry registry;
+	int a, b;
+	uint32_t id_a, id_b;
+
+	window_registry_init(&registry);
+
+	id_a = window_registry_insert(&registry, &a);
+	assert(window_registry_remove(&registry, id_a) == &a);
+	assert(window_registry_remove(&registry, id_a) == NULL);
+
+	/* the slot is recycled, but under a new generation */
+	id_b = window_registry_insert(&registry, &b);
+	assert((id_b & WINDOW_REGISTRY_INDEX_MASK) ==
+	       (id_a & WINDOW_REGISTRY_INDEX_MASK));
+	assert(id_b != id_a);
+	assert(window_registry_lookup(&registry, id_a) == NULL);
+	assert(window_registry_lookup(&registry, id_b) == &b);
+	assert(registry.count == 1);
+
+	window_registry_release(&registry);
+}
+
+TEST(window_registry_retire_slot)
+{
+	struct window_registry registry;
+	uint32_t id, first;
+	uint32_t i;
+	int a;
+
+	window_registry_init(&registry);
+
+	first = window_registry_insert(&registry, &a);
+	id = first;
+	for (i = 1; i < WINDOW_REGISTRY_MAX_GENERATION; i++) {
+		window_registry_remove(&registry, id);
+		id = window_registry_insert(&registry, &a);
+		assert((id & WINDOW_REGISTRY_INDEX_MASK) == 0);
+		assert(id != first);
+	}
+
+	/* generation space exhausted, the slot must not come back */
+	window_registry_remove(&registry, id);
+	id = window_registry_insert(&registry, &a);
+	assert((id & WINDOW_REGISTRY_INDEX_MASK) == 1);
+	assert(window_registry_lookup(&registry, first) == NULL);
+
+	window_registry_release(&registry);
+}
+
+static void
+count_entry(uint32_t id, void *data, void *user)
+{
+	int *sum = user;
+
+	*sum += *(int *) data;
+}
+
+TEST(window_registry_iterate)
+{
+	struct window_registry registry;
+	int values[4] = { 1, 10, 100, 1000 };
+	uint32_t ids[4];
+	int i, sum = 0;
+
+	window_registry_init(&registry);
+
+	for (i = 0; i < 4; i++)
+		ids[i] = window_registry_insert(&registry, &values[i]);
+	window_registry_remove(&registry, ids[1]);
+
+	window_registry_for_each(&registry, count_entry, &sum);
+	assert(sum == 1101);
+
+	window_registry_release(&registry);
+}
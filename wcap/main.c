@@ -33,17 +33,19 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <cairo.h>
 
 #include "wcap-decode.h"
 
 static void
-write_png(struct wcap_decoder *decoder, const char *filename)
+write_png(struct wcap_decoder *decoder, uint32_t *frame, const char *filename)
 {
 	cairo_surface_t *surface;
 
-	surface = cairo_image_surface_create_for_data((unsigned char *) decoder->frame,
+	surface = cairo_image_surface_create_for_data((unsigned char *) frame,
 						      CAIRO_FORMAT_ARGB32,
 						      decoder->width,
 						      decoder->height,
@@ -52,6 +54,37 @@ write_png(struct wcap_decoder *decoder, const char *filename)
 	cairo_surface_destroy(surface);
 }
 
+static int
+write_single_frame(struct wcap_decoder *decoder, int frame, int msecs)
+{
+	char filename[200];
+	int found;
+
+	if (frame >= 0) {
+		found = wcap_decoder_seek(decoder, frame);
+	} else {
+		found = wcap_decoder_seek_msecs(decoder, 0);
+		if (found)
+			found = wcap_decoder_seek_msecs(decoder,
+							decoder->msecs + msecs);
+		frame = decoder->count - 1;
+	}
+
+	if (found) {
+		snprintf(filename, sizeof filename,
+			 "wcap-frame-%d.png", frame);
+		write_png(decoder, decoder->frame, filename);
+		fprintf(stderr, "wrote %s\n", filename);
+	}
+
+	fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
+		decoder->width, decoder->height, decoder->nframes);
+
+	wcap_decoder_destroy(decoder);
+
+	return found ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 static inline int
 rgb_to_yuv(uint32_t format, uint32_t p, int *u, int *v)
 {
@@ -95,13 +128,52 @@ int clamp_uv(int u)
 		return clamp;
 }
 
+typedef int32_t v4si __attribute__((vector_size(16)));
+
+#define V4SI(x) { x, x, x, x }
+
+/* rgb_to_yuv() for four pixels at a time, which GCC and clang turn into
+ * SSE2 or NEON code.  The luma coefficients add up to 65536, so y
+ * never needs clamping. */
+static inline v4si
+rgb_to_yuv4(const uint32_t *p, int rshift, int bshift, v4si *u, v4si *v)
+{
+	const v4si mask = V4SI(0xff);
+	const v4si cr = V4SI(19595), cg = V4SI(38469), cb = V4SI(7472);
+	const v4si cu = V4SI(46727), cv = V4SI(36962);
+	v4si pixels, r, g, b, y;
+
+	memcpy(&pixels, p, sizeof pixels);
+	r = (pixels >> rshift) & mask;
+	g = (pixels >> 8) & mask;
+	b = (pixels >> bshift) & mask;
+
+	y = (cr * r + cg * g + cb * b) >> 16;
+	*u += cu * (r - y);
+	*v += cv * (b - y);
+
+	return y;
+}
+
 static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yv12(struct wcap_decoder *decoder, uint32_t *frame,
+		unsigned char *out)
 {
 	unsigned char *y1, *y2, *u, *v;
 	uint32_t *p1, *p2, *end;
-	int i, u_accum, v_accum, stride0, stride1;
+	int i, k, u_accum, v_accum, stride0, stride1, rshift, bshift;
 	uint32_t format = decoder->format;
+	v4si yv1, yv2, u4, v4;
+	const v4si zero = V4SI(0);
+
+	if (format == WCAP_FORMAT_XBGR8888) {
+		rshift = 0;
+		bshift = 16;
+	} else {
+		assert(format == WCAP_FORMAT_XRGB8888);
+		rshift = 16;
+		bshift = 0;
+	}
 
 	stride0 = decoder->width;
 	stride1 = decoder->width / 2;
@@ -110,10 +182,33 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 		y2 = y1 + stride0;
 		v = out + stride0 * decoder->height + stride1 * i / 2;
 		u = v + stride1 * decoder->height / 2;
-		p1 = decoder->frame + decoder->width * i;
+		p1 = frame + decoder->width * i;
 		p2 = p1 + decoder->width;
 		end = p1 + decoder->width;
 
+		/* Two 2x2 blocks at a time. */
+		while (end - p1 >= 4) {
+			u4 = zero;
+			v4 = zero;
+			yv1 = rgb_to_yuv4(p1, rshift, bshift, &u4, &v4);
+			yv2 = rgb_to_yuv4(p2, rshift, bshift, &u4, &v4);
+			for (k = 0; k < 4; k++) {
+				y1[k] = yv1[k];
+				y2[k] = yv2[k];
+			}
+			u[0] = clamp_uv(u4[0] + u4[1]);
+			v[0] = clamp_uv(v4[0] + v4[1]);
+			u[1] = clamp_uv(u4[2] + u4[3]);
+			v[1] = clamp_uv(v4[2] + v4[3]);
+
+			y1 += 4;
+			p1 += 4;
+			y2 += 4;
+			p2 += 4;
+			u += 2;
+			v += 2;
+		}
+
 		while (p1 < end) {
 			u_accum = 0;
 			v_accum = 0;
@@ -135,7 +230,8 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 }
 
 static void
-convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yuv444(struct wcap_decoder *decoder, uint32_t *frame,
+		  unsigned char *out)
 {
 
 	unsigned char *yp, *up, *vp;
@@ -150,7 +246,7 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 		yp = out + stride * i;
 		up = yp + (psize * 2);
 		vp = yp + (psize * 1);
-		rp = decoder->frame + decoder->width * i;
+		rp = frame + decoder->width * i;
 		end = rp + decoder->width;	
 		while (rp < end) {
 			u = 0;
@@ -166,43 +262,248 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 	}
 }
 
+/* Frames are decoded in order on the main thread, since each one is a
+ * delta against the one before, and handed to a pool of workers to be
+ * converted to YUV or written as png.  The main thread writes the YUV
+ * frames to stdout in order, when it needs their job for a new frame
+ * or at the end. */
+enum job_state {
+	JOB_FREE,
+	JOB_QUEUED,
+	JOB_DONE
+};
+
+struct job {
+	enum job_state state;
+	int number;
+	int png;
+	uint32_t *frame;
+	unsigned char *out;
+};
+
+struct pipeline {
+	struct wcap_decoder *decoder;
+	int yuv4mpeg2;
+	size_t yuv_size;
+
+	pthread_t *threads;
+	int nthreads;
+	struct job *jobs;
+	int njobs;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t queued_cond;
+	pthread_cond_t done_cond;
+	int submitted, taken, written;	/* job sequence numbers */
+	int quit;
+};
+
 static void
-output_yuv_frame(struct wcap_decoder *decoder, int depth)
+process_job(struct pipeline *pipeline, struct job *job)
 {
-	static unsigned char *out;
-	int size;
+	struct wcap_decoder *decoder = pipeline->decoder;
+	char filename[200];
 
-	if (depth == 444) {
-		size = decoder->width * decoder->height * 3;
-	} else {
-		size = decoder->width * decoder->height * 3 / 2;
+	if (job->png) {
+		snprintf(filename, sizeof filename,
+			 "wcap-frame-%d.png", job->number);
+		write_png(decoder, job->frame, filename);
 	}
-	if (out == NULL)
-		out = malloc(size);
 
-	if (depth == 444) {
-		convert_to_yuv444(decoder, out);
-	} else {
-		convert_to_yv12(decoder, out);
+	if (pipeline->yuv4mpeg2 == 444)
+		convert_to_yuv444(decoder, job->frame, job->out);
+	else if (pipeline->yuv4mpeg2)
+		convert_to_yv12(decoder, job->frame, job->out);
+}
+
+static void *
+worker_thread(void *data)
+{
+	struct pipeline *pipeline = data;
+	struct job *job;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	for (;;) {
+		if (pipeline->taken == pipeline->submitted) {
+			if (pipeline->quit)
+				break;
+			pthread_cond_wait(&pipeline->queued_cond,
+					  &pipeline->mutex);
+			continue;
+		}
+
+		job = &pipeline->jobs[pipeline->taken++ % pipeline->njobs];
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		process_job(pipeline, job);
+
+		pthread_mutex_lock(&pipeline->mutex);
+		job->state = JOB_DONE;
+		pthread_cond_broadcast(&pipeline->done_cond);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	return NULL;
+}
+
+/* Waits for the oldest job and writes it out. */
+static void
+pipeline_write_next(struct pipeline *pipeline)
+{
+	struct job *job;
+
+	job = &pipeline->jobs[pipeline->written % pipeline->njobs];
+
+	pthread_mutex_lock(&pipeline->mutex);
+	while (job->state != JOB_DONE)
+		pthread_cond_wait(&pipeline->done_cond, &pipeline->mutex);
+	job->state = JOB_FREE;
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	if (job->png)
+		fprintf(stderr, "wrote wcap-frame-%d.png\n", job->number);
+	if (pipeline->yuv4mpeg2) {
+		printf("FRAME\n");
+		fwrite(job->out, 1, pipeline->yuv_size, stdout);
+	}
+
+	pipeline->written++;
+}
+
+static void
+pipeline_submit(struct pipeline *pipeline, int number, int png)
+{
+	struct wcap_decoder *decoder = pipeline->decoder;
+	struct job *job;
+
+	if (pipeline->submitted - pipeline->written == pipeline->njobs)
+		pipeline_write_next(pipeline);
+
+	job = &pipeline->jobs[pipeline->submitted % pipeline->njobs];
+
+	job->number = number;
+	job->png = png;
+	memcpy(job->frame, decoder->frame,
+	       decoder->width * decoder->height * 4);
+
+	pthread_mutex_lock(&pipeline->mutex);
+	job->state = JOB_QUEUED;
+	pipeline->submitted++;
+	pthread_cond_signal(&pipeline->queued_cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+}
+
+static int
+pipeline_init(struct pipeline *pipeline, struct wcap_decoder *decoder,
+	      int yuv4mpeg2, int nthreads)
+{
+	int i;
+
+	if (nthreads < 1)
+		nthreads = 1;
+
+	memset(pipeline, 0, sizeof *pipeline);
+	pipeline->decoder = decoder;
+	pipeline->yuv4mpeg2 = yuv4mpeg2;
+	if (yuv4mpeg2 == 444)
+		pipeline->yuv_size = decoder->width * decoder->height * 3;
+	else
+		pipeline->yuv_size = decoder->width * decoder->height * 3 / 2;
+
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->queued_cond, NULL);
+	pthread_cond_init(&pipeline->done_cond, NULL);
+
+	/* Enough for every worker to have a frame in hand while the
+	 * next ones are decoded. */
+	pipeline->njobs = nthreads * 2;
+	pipeline->jobs = calloc(pipeline->njobs, sizeof *pipeline->jobs);
+	if (pipeline->jobs == NULL)
+		return -1;
+	for (i = 0; i < pipeline->njobs; i++) {
+		pipeline->jobs[i].frame =
+			malloc(decoder->width * decoder->height * 4);
+		if (pipeline->jobs[i].frame == NULL)
+			return -1;
+		if (yuv4mpeg2) {
+			pipeline->jobs[i].out = malloc(pipeline->yuv_size);
+			if (pipeline->jobs[i].out == NULL)
+				return -1;
+		}
+	}
+
+	pipeline->threads = calloc(nthreads, sizeof *pipeline->threads);
+	if (pipeline->threads == NULL)
+		return -1;
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&pipeline->threads[i], NULL,
+				   worker_thread, pipeline) != 0)
+			return -1;
+		pipeline->nthreads++;
+	}
+
+	return 0;
+}
+
+/* Writes out what is left and stops the workers. */
+static void
+pipeline_finish(struct pipeline *pipeline)
+{
+	int i;
+
+	while (pipeline->written < pipeline->submitted)
+		pipeline_write_next(pipeline);
+
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->quit = 1;
+	pthread_cond_broadcast(&pipeline->queued_cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	for (i = 0; i < pipeline->nthreads; i++)
+		pthread_join(pipeline->threads[i], NULL);
+	free(pipeline->threads);
+
+	if (pipeline->jobs) {
+		for (i = 0; i < pipeline->njobs; i++) {
+			free(pipeline->jobs[i].frame);
+			free(pipeline->jobs[i].out);
+		}
+		free(pipeline->jobs);
 	}
 
-	printf("FRAME\n");
-	fwrite(out, 1, size, stdout);
+	pthread_cond_destroy(&pipeline->done_cond);
+	pthread_cond_destroy(&pipeline->queued_cond);
+	pthread_mutex_destroy(&pipeline->mutex);
+}
+
+static double
+elapsed_s(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
 }
 
 static void
 usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
-		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--time=<msecs>]\n"
+		"\t[--all] [--rate=<num:denom>] [--threads=<n>] <wcap file>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--yuv4mpeg2-444\t\tdump wcap file to stdout in yuv4mpeg2 444 format\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
+		"\t--time=<msecs>\t\twrite out the frame shown at the given\n"
+		"\t\t\t\ttime from the start as png\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
-		"\t\t\t\tspecified as an integer fraction\n\n");
+		"\t\t\t\tspecified as an integer fraction\n"
+		"\t--threads=<n>\t\tconvert and write frames on n threads,\n"
+		"\t\t\t\tone per CPU by default\n\n");
 
 	exit(exit_code);
 }
@@ -211,10 +512,13 @@ int main(int argc, char *argv[])
 {
 	struct wcap_decoder *decoder;
 	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
-	int num = 30, denom = 1;
-	char filename[200];
+	int num = 30, denom = 1, output_msecs = -1, nthreads = 0;
+	int png, converted = 0;
 	char *mode;
-	uint32_t msecs, frame_time, *frame, frame_size;
+	uint32_t msecs, first_msecs, frame_time;
+	struct pipeline pipeline;
+	struct timespec start;
+	double seconds;
 
 	for (i = 1, j = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--yuv4mpeg2-444") == 0) {
@@ -227,6 +531,10 @@ int main(int argc, char *argv[])
 			all = 1;
 		} else if (sscanf(argv[i], "--frame=%d", &output_frame) == 1) {
 			;
+		} else if (sscanf(argv[i], "--time=%d", &output_msecs) == 1) {
+			;
+		} else if (sscanf(argv[i], "--threads=%d", &nthreads) == 1) {
+			;
 		} else if (sscanf(argv[i], "--rate=%d", &num) == 1) {
 			;
 		} else if (sscanf(argv[i], "--rate=%d:%d", &num, &denom) == 2) {
@@ -251,6 +559,15 @@ int main(int argc, char *argv[])
 	}
 
 	decoder = wcap_decoder_create(argv[1]);
+	if (decoder == NULL) {
+		fprintf(stderr, "failed to open %s\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Single frames are found through the index, which in v2 files
+	 * only decodes from the closest keyframe on. */
+	if (!yuv4mpeg2 && !all && (output_frame >= 0 || output_msecs >= 0))
+		return write_single_frame(decoder, output_frame, output_msecs);
 
 	if (yuv4mpeg2 && isatty(1)) {
 		fprintf(stderr, "Not dumping yuv4mpeg2 data to terminal.  Pipe output to a file or a process.\n");
@@ -272,31 +589,41 @@ int main(int argc, char *argv[])
 		fflush(stdout);
 	}
 
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (pipeline_init(&pipeline, decoder, yuv4mpeg2, nthreads) < 0) {
+		fprintf(stderr, "failed to start the converter threads\n");
+		exit(EXIT_FAILURE);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	i = 0;
 	has_frame = wcap_decoder_get_frame(decoder);
-	msecs = decoder->msecs;
+	msecs = first_msecs = decoder->msecs;
 	frame_time = 1000 * denom / num;
-	frame_size = decoder->width * decoder->height * 4;
-	frame = malloc(frame_size);
 	while (has_frame) {
-		if (decoder->msecs >= msecs)
-			memcpy(frame, decoder->frame, frame_size);
-		if (all || i == output_frame) {
-			snprintf(filename, sizeof filename,
-				 "wcap-frame-%d.png", i);
-			write_png(decoder, filename);
-			fprintf(stderr, "wrote %s\n", filename);
+		png = all || i == output_frame;
+		if (png || yuv4mpeg2) {
+			pipeline_submit(&pipeline, i, png);
+			converted++;
 		}
-		if (yuv4mpeg2)
-			output_yuv_frame(decoder, yuv4mpeg2);
 		i++;
 		msecs += frame_time;
 		while (decoder->msecs < msecs && has_frame)
 			has_frame = wcap_decoder_get_frame(decoder);
 	}
 
+	pipeline_finish(&pipeline);
+	seconds = elapsed_s(&start);
+
 	fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
 		decoder->width, decoder->height, i);
+	if (converted > 0 && seconds > 0)
+		fprintf(stderr, "converted %d frames in %.2f s on %d threads, "
+			"%.1f frames/s, %.1fx real time\n",
+			converted, seconds, pipeline.nthreads,
+			converted / seconds,
+			(decoder->msecs - first_msecs) / 1000.0 / seconds);
 
 	wcap_decoder_destroy(decoder);
 
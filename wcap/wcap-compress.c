@@ -0,0 +1,193 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <config.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "wcap-decode.h"
+#include "wcap-compress.h"
+
+/* Recording runs in real time, so all codecs use their fastest
+ * setting; the run length encoding already did the easy part. */
+
+static const char * const names[] = {
+	[WCAP_COMPRESSION_NONE] = "none",
+	[WCAP_COMPRESSION_ZLIB] = "zlib",
+	[WCAP_COMPRESSION_LZ4] = "lz4",
+	[WCAP_COMPRESSION_ZSTD] = "zstd",
+};
+
+int
+wcap_compression_supported(uint32_t compression)
+{
+	switch (compression) {
+	case WCAP_COMPRESSION_NONE:
+		return 1;
+#ifdef HAVE_ZLIB
+	case WCAP_COMPRESSION_ZLIB:
+		return 1;
+#endif
+#ifdef HAVE_LZ4
+	case WCAP_COMPRESSION_LZ4:
+		return 1;
+#endif
+#ifdef HAVE_ZSTD
+	case WCAP_COMPRESSION_ZSTD:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+int
+wcap_compression_from_name(const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < sizeof names / sizeof names[0]; i++)
+		if (strcmp(name, names[i]) == 0)
+			return wcap_compression_supported(i) ? (int) i : -1;
+
+	return -1;
+}
+
+const char *
+wcap_compression_name(uint32_t compression)
+{
+	if (compression >= sizeof names / sizeof names[0])
+		return "unknown";
+
+	return names[compression];
+}
+
+size_t
+wcap_compress_bound(uint32_t compression, size_t size)
+{
+	switch (compression) {
+#ifdef HAVE_ZLIB
+	case WCAP_COMPRESSION_ZLIB:
+		return compressBound(size);
+#endif
+#ifdef HAVE_LZ4
+	case WCAP_COMPRESSION_LZ4:
+		return LZ4_compressBound(size);
+#endif
+#ifdef HAVE_ZSTD
+	case WCAP_COMPRESSION_ZSTD:
+		return ZSTD_compressBound(size);
+#endif
+	default:
+		return size;
+	}
+}
+
+size_t
+wcap_compress(uint32_t compression, void *dst, size_t dst_size,
+	      const void *src, size_t size)
+{
+	switch (compression) {
+	case WCAP_COMPRESSION_NONE:
+		if (size > dst_size)
+			return 0;
+		memcpy(dst, src, size);
+		return size;
+#ifdef HAVE_ZLIB
+	case WCAP_COMPRESSION_ZLIB: {
+		uLongf len = dst_size;
+
+		if (compress2(dst, &len, src, size, Z_BEST_SPEED) != Z_OK)
+			return 0;
+		return len;
+	}
+#endif
+#ifdef HAVE_LZ4
+	case WCAP_COMPRESSION_LZ4: {
+		int len;
+
+		len = LZ4_compress_default(src, dst, size, dst_size);
+		return len > 0 ? (size_t) len : 0;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case WCAP_COMPRESSION_ZSTD: {
+		size_t len;
+
+		len = ZSTD_compress(dst, dst_size, src, size, 1);
+		return ZSTD_isError(len) ? 0 : len;
+	}
+#endif
+	default:
+		return 0;
+	}
+}
+
+int
+wcap_decompress(uint32_t compression, void *dst, size_t size,
+		const void *src, size_t src_size)
+{
+	switch (compression) {
+	case WCAP_COMPRESSION_NONE:
+		if (src_size != size)
+			return -1;
+		memcpy(dst, src, size);
+		return 0;
+#ifdef HAVE_ZLIB
+	case WCAP_COMPRESSION_ZLIB: {
+		uLongf len = size;
+
+		if (uncompress(dst, &len, src, src_size) != Z_OK ||
+		    len != size)
+			return -1;
+		return 0;
+	}
+#endif
+#ifdef HAVE_LZ4
+	case WCAP_COMPRESSION_LZ4:
+		if (LZ4_decompress_safe(src, dst, src_size, size) !=
+		    (int) size)
+			return -1;
+		return 0;
+#endif
+#ifdef HAVE_ZSTD
+	case WCAP_COMPRESSION_ZSTD:
+		if (ZSTD_decompress(dst, size, src, src_size) != size)
+			return -1;
+		return 0;
+#endif
+	default:
+		return -1;
+	}
+}
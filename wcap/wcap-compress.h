@@ -0,0 +1,58 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef _WCAP_COMPRESS_
+#define _WCAP_COMPRESS_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compression of the run length encoded frames of version 3 files,
+ * with whichever of zlib, lz4 and zstd the build found. */
+
+/* Returns the WCAP_COMPRESSION_* value for "none", "zlib", "lz4" or
+ * "zstd", or -1 if the name is unknown or the codec not built in. */
+int
+wcap_compression_from_name(const char *name);
+
+const char *
+wcap_compression_name(uint32_t compression);
+
+int
+wcap_compression_supported(uint32_t compression);
+
+/* The most space compressing size bytes can take. */
+size_t
+wcap_compress_bound(uint32_t compression, size_t size);
+
+/* Returns the compressed size, or 0 on failure. */
+size_t
+wcap_compress(uint32_t compression, void *dst, size_t dst_size,
+	      const void *src, size_t size);
+
+/* Decompresses into exactly size bytes; returns -1 otherwise. */
+int
+wcap_decompress(uint32_t compression, void *dst, size_t size,
+		const void *src, size_t src_size);
+
+#endif
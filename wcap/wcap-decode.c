@@ -36,6 +36,7 @@
 #include <cairo.h>
 
 #include "wcap-decode.h"
+#include "wcap-compress.h"
 
 static void
 wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
@@ -82,12 +83,62 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 	decoder->p = p;
 }
 
+/* Returns the end of a rectangle's runs without decoding them. */
+static uint32_t *
+wcap_skip_rectangle(struct wcap_rectangle *rect, uint32_t *p, uint32_t *end)
+{
+	int count = (rect->x2 - rect->x1) * (rect->y2 - rect->y1);
+	int i, l;
+
+	for (i = 0; i < count && p < end; p++) {
+		l = *p >> 24;
+		if (l < 0xe0)
+			i += l + 1;
+		else
+			i += 1 << (l - 0xe0 + 7);
+	}
+
+	return p;
+}
+
+/* Decompresses the runs of a v3 frame into decoder->runs.  Returns
+ * the start of the next frame. */
+static void *
+wcap_decoder_decompress(struct wcap_decoder *decoder,
+			struct wcap_compressed_header *compressed)
+{
+	void *data = compressed + 1;
+	uint32_t *runs;
+
+	if (decoder->runs_size < compressed->size) {
+		runs = realloc(decoder->runs, compressed->size);
+		if (runs == NULL) {
+			printf("out of memory for %u bytes of runs\n",
+			       compressed->size);
+			return NULL;
+		}
+		decoder->runs = runs;
+		decoder->runs_size = compressed->size;
+	}
+
+	if (wcap_decompress(decoder->compression, decoder->runs,
+			    compressed->size, data,
+			    compressed->compressed_size) < 0) {
+		printf("failed to decompress frame %u\n", decoder->count);
+		return NULL;
+	}
+
+	return data + ((compressed->compressed_size + 3) & ~3);
+}
+
 int
 wcap_decoder_get_frame(struct wcap_decoder *decoder)
 {
 	struct wcap_rectangle *rects;
 	struct wcap_frame_header *header;
-	uint32_t i;
+	struct wcap_compressed_header *compressed;
+	uint32_t i, nrects;
+	void *next = NULL;
 
 	if (decoder->p == decoder->end)
 		return 0;
@@ -96,14 +147,188 @@ wcap_decoder_get_frame(struct wcap_decoder *decoder)
 	decoder->msecs = header->msecs;
 	decoder->count++;
 
+	nrects = header->nrects;
+	if (decoder->version >= 2 && (nrects & WCAP_FRAME_KEYFRAME)) {
+		nrects &= ~WCAP_FRAME_KEYFRAME;
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+	}
+
 	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
-	for (i = 0; i < header->nrects; i++)
+	decoder->p = (uint32_t *) (rects + nrects);
+
+	if (decoder->version == 3) {
+		compressed = decoder->p;
+		if (compressed->compressed_size == compressed->size) {
+			/* Stored uncompressed. */
+			decoder->p = compressed + 1;
+		} else {
+			next = wcap_decoder_decompress(decoder, compressed);
+			if (next == NULL) {
+				decoder->p = (void *) (compressed + 1) +
+					((compressed->compressed_size + 3) & ~3);
+				return 1;
+			}
+			decoder->p = decoder->runs;
+		}
+	}
+
+	for (i = 0; i < nrects; i++)
 		wcap_decoder_decode_rectangle(decoder, &rects[i]);
 
+	if (next)
+		decoder->p = next;
+
 	return 1;
 }
 
+/* Reads the index at the end of a v2 file and leaves it out of the
+ * frames. */
+static int
+wcap_decoder_read_index(struct wcap_decoder *decoder)
+{
+	struct wcap_index_trailer trailer;
+	size_t size;
+	void *index;
+
+	if (decoder->end - decoder->frames < (long) sizeof trailer)
+		return -1;
+
+	memcpy(&trailer, decoder->end - sizeof trailer, sizeof trailer);
+	if (trailer.magic != WCAP_INDEX_MAGIC)
+		return -1;
+
+	size = (size_t) trailer.count * sizeof *decoder->index;
+	if ((size_t) (decoder->end - decoder->frames) < size + sizeof trailer)
+		return -1;
+
+	index = decoder->end - sizeof trailer - size;
+	decoder->index = malloc(size);
+	if (size > 0 && decoder->index == NULL)
+		return -1;
+
+	/* The entries are not necessarily 8 byte aligned in the file. */
+	memcpy(decoder->index, index, size);
+	decoder->nframes = trailer.count;
+	decoder->end = index;
+
+	return 0;
+}
+
+/* Indexes the frames of a v1 file, or of a v2 file whose recording
+ * did not finish, by walking the frame headers and skipping over the
+ * runs. */
+static int
+wcap_decoder_scan_index(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header *header;
+	struct wcap_rectangle *rects;
+	struct wcap_compressed_header *compressed;
+	struct wcap_index_entry *index;
+	uint32_t i, nrects, alloc = 0;
+	uint32_t *p = decoder->frames;
+
+	decoder->nframes = 0;
+	while ((void *) p < decoder->end) {
+		if (decoder->nframes == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			index = realloc(decoder->index,
+					alloc * sizeof *index);
+			if (index == NULL)
+				return -1;
+			decoder->index = index;
+		}
+
+		header = (struct wcap_frame_header *) p;
+		nrects = header->nrects;
+		index = &decoder->index[decoder->nframes++];
+		index->offset = (void *) p - decoder->map;
+		index->msecs = header->msecs;
+		index->flags = 0;
+		if (decoder->version >= 2 && (nrects & WCAP_FRAME_KEYFRAME)) {
+			nrects &= ~WCAP_FRAME_KEYFRAME;
+			index->flags = WCAP_FRAME_KEYFRAME;
+		}
+
+		rects = (struct wcap_rectangle *) (header + 1);
+		p = (uint32_t *) (rects + nrects);
+		if (decoder->version == 3) {
+			compressed = (struct wcap_compressed_header *) p;
+			p = (uint32_t *) (compressed + 1) +
+				(compressed->compressed_size + 3) / 4;
+			continue;
+		}
+		for (i = 0; i < nrects; i++)
+			p = wcap_skip_rectangle(&rects[i], p, decoder->end);
+	}
+
+	return 0;
+}
+
+static int
+wcap_decoder_ensure_index(struct wcap_decoder *decoder)
+{
+	if (decoder->index)
+		return 0;
+
+	return wcap_decoder_scan_index(decoder);
+}
+
+/* Decodes the given frame, counting from 0, starting from the closest
+ * keyframe before it, or from where the decoder is if that is closer.
+ * v1 files have no keyframes but the first frame.  Returns 0 past the
+ * last frame. */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t frame)
+{
+	uint32_t start;
+
+	if (wcap_decoder_ensure_index(decoder) < 0 ||
+	    frame >= decoder->nframes)
+		return 0;
+
+	start = frame;
+	while (start > 0 &&
+	       !(decoder->index[start].flags & WCAP_FRAME_KEYFRAME))
+		start--;
+
+	if (decoder->count <= start || decoder->count > frame + 1) {
+		if (start == 0)
+			memset(decoder->frame, 0,
+			       decoder->width * decoder->height * 4);
+		decoder->p = decoder->map + decoder->index[start].offset;
+		decoder->count = start;
+	}
+
+	while (decoder->count <= frame)
+		wcap_decoder_get_frame(decoder);
+
+	return 1;
+}
+
+/* Decodes the last frame shown at the given time, or the first frame
+ * for earlier times. */
+int
+wcap_decoder_seek_msecs(struct wcap_decoder *decoder, uint32_t msecs)
+{
+	uint32_t lo, hi, mid;
+
+	if (wcap_decoder_ensure_index(decoder) < 0 || decoder->nframes == 0)
+		return 0;
+
+	lo = 0;
+	hi = decoder->nframes;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (decoder->index[mid].msecs <= msecs)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return wcap_decoder_seek(decoder, lo);
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
@@ -134,6 +359,33 @@ wcap_decoder_create(const char *filename)
 	decoder->height = header->height;
 	decoder->p = header + 1;
 	decoder->end = decoder->map + decoder->size;
+	decoder->version = 1;
+	decoder->compression = WCAP_COMPRESSION_NONE;
+	decoder->runs = NULL;
+	decoder->runs_size = 0;
+	decoder->index = NULL;
+	decoder->nframes = 0;
+
+	if (header->magic == WCAP_HEADER_MAGIC_V2) {
+		decoder->version = 2;
+	} else if (header->magic == WCAP_HEADER_MAGIC_V3) {
+		decoder->version = 3;
+		decoder->compression = *(uint32_t *) decoder->p;
+		decoder->p = (uint32_t *) decoder->p + 1;
+		if (!wcap_compression_supported(decoder->compression)) {
+			fprintf(stderr, "%s: unsupported compression %s\n",
+				filename,
+				wcap_compression_name(decoder->compression));
+			munmap(decoder->map, decoder->size);
+			close(decoder->fd);
+			free(decoder);
+			return NULL;
+		}
+	}
+
+	decoder->frames = decoder->p;
+	if (decoder->version >= 2)
+		wcap_decoder_read_index(decoder);
 
 	frame_size = header->width * header->height * 4;
 	decoder->frame = malloc(frame_size);
@@ -147,6 +399,8 @@ wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
 	munmap(decoder->map, decoder->size);
 	close(decoder->fd);
+	free(decoder->index);
+	free(decoder->runs);
 	free(decoder->frame);
 	free(decoder);
 }
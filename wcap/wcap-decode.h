@@ -24,6 +24,8 @@
 #define _WCAP_DECODE_
 
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_HEADER_MAGIC_V3	0x57434133
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -41,6 +43,39 @@ struct wcap_frame_header {
 	uint32_t nrects;
 };
 
+/* In v2 files, set in nrects for frames decoded against all zero
+ * pixels instead of the previous frame. */
+#define WCAP_FRAME_KEYFRAME	0x80000000
+
+/* v2 files end with an index of all frames, followed by the trailer. */
+#define WCAP_INDEX_MAGIC	0x57494458
+
+struct wcap_index_entry {
+	uint64_t offset;
+	uint32_t msecs;
+	uint32_t flags;
+};
+
+struct wcap_index_trailer {
+	uint32_t magic;
+	uint32_t count;
+};
+
+/* v3 files are v2 files whose header is followed by the codec the
+ * frames' runs are compressed with. */
+#define WCAP_COMPRESSION_NONE	0
+#define WCAP_COMPRESSION_ZLIB	1
+#define WCAP_COMPRESSION_LZ4	2
+#define WCAP_COMPRESSION_ZSTD	3
+
+/* In v3 files, follows the rectangles of a frame, and is followed by
+ * the compressed runs of all of them, padded to 4 bytes.  If both sizes
+ * are equal, the runs are stored uncompressed. */
+struct wcap_compressed_header {
+	uint32_t size;
+	uint32_t compressed_size;
+};
+
 struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
@@ -54,9 +89,18 @@ struct wcap_decoder {
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+	int version;
+	uint32_t compression;
+	uint32_t *runs;
+	size_t runs_size;
+	void *frames;
+	struct wcap_index_entry *index;
+	uint32_t nframes;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t frame);
+int wcap_decoder_seek_msecs(struct wcap_decoder *decoder, uint32_t msecs);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 